@@ -71,6 +71,14 @@ inline StringRef getSaveFileName() {
   return "__arthas_save_file";
 }
 
+inline StringRef getPoolRegisterName() {
+  return "__arthas_register_pool";
+}
+
+inline StringRef getPoolUnregisterName() {
+  return "__arthas_unregister_pool";
+}
+
 class PmemAddrInstrumenter {
  public:
   // by default we will use our lightweight runtime library for tracking
@@ -89,6 +97,10 @@ class PmemAddrInstrumenter {
       slicing::Slice *slice,
       std::map<llvm::Instruction *, std::set<llvm::Value *>> &useDefMap);
 
+  // instrument every pool create/open/map and close/unmap call in the module
+  // to feed the pool registry of the address tracker
+  bool instrumentPoolCalls(Module &M);
+
   // dump the guid to instruction map to file so that we can later connect the
   // address back to the LLVM instruction
   bool writeGuidHookPointMap(std::string fileName);
@@ -114,6 +126,8 @@ class PmemAddrInstrumenter {
   Function *_low_level_flush_func;
   Function *_low_level_fence_func;
   Function *_save_file_func;
+  Function *_register_pool_func;
+  Function *_unregister_pool_func;
 
   std::map<uint64_t, Instruction *> _guid_hook_point_map;
   std::map<Instruction *, uint64_t> _hook_point_guid_map;
@@ -20,6 +20,9 @@
 #include <string>
 #include <vector>
 
+// defined in the address tracker's addr_trace_format.h
+struct arthas_trace_header;
+
 namespace llvm {
 
 // forward declare the llvm::Instruction
@@ -44,10 +47,19 @@ class PmemAddrTraceItem {
   uint64_t guid;
   // the offset within an owner pool address (default 0)
   uint64_t pool_offset;
+  // if pool_offset was resolved, the address is within a pool
+  bool has_pool_offset;
+  // id of the owner pool in the tracker's pool registry, 0 if unknown
+  uint32_t pool_id;
+  // tracker clock stamp of the access, 0 for the text trace format
+  uint64_t stamp;
   // if the address is a pool address or not
   bool is_pool;
   // if the address is a pmem file address or not
   bool is_mmap;
+  // if the record is a page first written in an epoch of the page tracker,
+  // addr is then the start of the page
+  bool is_page;
   // the associated guid map entry to locate the source instruction
   PmemVarGuidMapEntry *var;
   // the LLVM instruction responsible for generating the address
@@ -58,19 +70,114 @@ class PmemAddrTraceItem {
   static const int EntryFields = 2;
 
   PmemAddrTraceItem()
-      : addr(0), guid(0), pool_offset(0), is_pool(false), is_mmap(false),
-        var(nullptr), instr(nullptr) {}
+      : addr(0), guid(0), pool_offset(0), has_pool_offset(false), pool_id(0),
+        stamp(0),
+        is_pool(false), is_mmap(false), is_page(false), var(nullptr),
+        instr(nullptr) {}
 
   static bool parse(std::string &item_str, PmemAddrTraceItem &item,
                     PmemVarGuidMap *varMap = nullptr);
+  // Resolve the guid map entry of the item and whether it is a pool address
+  static void resolve(PmemAddrTraceItem &item, PmemVarGuidMap *varMap);
+};
+
+// Per-site sampling statistics written into the trace header by the address
+// tracker when it runs in sampling mode
+class PmemAddrSampleStats {
+ public:
+  uint64_t guid;
+  // number of events the site generated at runtime
+  uint64_t seen;
+  // number of events the tracker wrote into the trace
+  uint64_t recorded;
+  // number of distinct addresses recorded before sampling kicked in
+  uint64_t distinct;
+  // the largest sampling period (2^shift) the site reached
+  uint32_t max_shift;
+
+  // should be consistent with address tracker runtime lib
+  static const char HeaderChar;
+  static const char *SampleTag;
+  static const int EntryFields = 6;
+
+  PmemAddrSampleStats()
+      : guid(0), seen(0), recorded(0), distinct(0), max_shift(0) {}
+
+  // some addresses of this site may be missing from the trace
+  bool incomplete() const { return recorded < seen; }
+
+  static bool parse(std::string &item_str, PmemAddrSampleStats &stats);
 };
 
 class PmemAddrPool {
  public:
+  // the pool creation hook item of a pool inferred from the trace, nullptr
+  // for a pool from the tracker's pool registry
   PmemAddrTraceItem *pool_addr;
+  // registry id, 0 for a pool inferred from the trace
+  uint32_t id;
+  // base address and size (0 if unknown) of the pool in the traced run
+  uint64_t base;
+  uint64_t size;
+  std::string path;
   std::vector<PmemAddrTraceItem *> addresses;
 
-  PmemAddrPool(PmemAddrTraceItem *pool) : pool_addr(pool) {}
+  PmemAddrPool(PmemAddrTraceItem *pool)
+      : pool_addr(pool), id(0), base(pool->addr), size(0) {}
+  PmemAddrPool(uint32_t id, uint64_t base, uint64_t size,
+               const std::string &path)
+      : pool_addr(nullptr), id(id), base(base), size(size), path(path) {}
+};
+
+class PmemAddrTrace;
+
+// A read-only mapping of a binary trace segment written by the address
+// tracker runtime, see analyzer/runtime/addr_trace_format.h
+class PmemAddrTraceSegment {
+ public:
+  PmemAddrTraceSegment() : _hdr(nullptr), _len(0), _ino(0) {}
+  ~PmemAddrTraceSegment() { close(); }
+
+  // Whether the file is a binary trace segment rather than a text trace
+  static bool isSegmentFile(const char *fileName);
+  // Path of a segment in the rotation chain of the trace at basePath
+  static std::string segmentPath(const std::string &basePath, uint64_t id);
+  // Collect the segments of the rotation chain that are still on disk,
+  // ordered by segment id. Retired segments are simply missing.
+  static void listSegments(const char *basePath,
+                           std::vector<std::string> &paths);
+
+  bool open(const char *fileName);
+  void close();
+  bool isOpen() const { return _hdr != nullptr; }
+  // Whether the file at the path is no longer the one we have mapped. A
+  // retired (deleted) segment is not considered replaced.
+  bool replaced(const char *fileName) const;
+
+  uint64_t committed() const;
+  uint64_t dropped() const;
+  bool closed() const;
+  uint64_t segmentId() const;
+  // Whether the tracker moved on to the next segment
+  bool sealed() const;
+  // Whether the segment was sealed before the checkpoint sequence number
+  // seq, so none of its records can relate to a live checkpoint version
+  bool sealedBefore(uint64_t seq) const;
+
+  // Parse the records in [from, to) into the trace and return the index of
+  // the first record not parsed. A record still being written is skipped,
+  // or ends the parsing if stopAtInFlight is set.
+  uint64_t read(uint64_t from, uint64_t to, PmemVarGuidMap *varMap,
+                PmemAddrTrace &result, bool stopAtInFlight = false);
+  // Load the per-site sampling statistics into the trace
+  void readSampleStats(PmemAddrTrace &result);
+  // Load the pools registered by the tracker into the trace
+  void readPools(PmemAddrTrace &result);
+
+ private:
+  struct arthas_trace_header *_hdr;
+  size_t _len;
+  uint64_t _ino;
 };
 
 class PmemAddrTrace {
@@ -81,16 +188,18 @@ class PmemAddrTrace {
   typedef TraceListTy::const_iterator const_iterator;
   typedef TracePoolListTy::iterator pool_iterator;
   typedef TracePoolListTy::const_iterator const_pool_iterator;
+  typedef std::map<uint64_t, PmemAddrSampleStats> SampleStatsMapTy;
 
  public:
   ~PmemAddrTrace();
 
-  void add(PmemAddrTraceItem *item) {
-    _items.push_back(item);
-    if (item->is_pool || item->is_mmap) {
-      _pool_addrs.push_back(PmemAddrPool(item));
-    }
-  }
+  void add(PmemAddrTraceItem *item);
+  // Add a pool from the tracker's pool registry, a pool already known by
+  // its id is ignored
+  void addPool(const PmemAddrPool &pool);
+  // Whether the pools and offsets were recorded by the tracker at capture
+  // time, in which case calculatePoolOffsets is not needed
+  bool hasPoolRegistry() const { return !_pool_index.empty(); }
 
   iterator begin() { return _items.begin(); }
   iterator end() { return _items.end(); }
@@ -109,22 +218,51 @@ class PmemAddrTrace {
   bool pool_empty() const { return _pool_addrs.empty(); }
   TracePoolListTy &pool_addrs() { return _pool_addrs; }
 
+  // trace header lines carry metadata rather than address entries
+  static bool isHeaderLine(const std::string &line) {
+    return !line.empty() && line[0] == PmemAddrSampleStats::HeaderChar;
+  }
+  // Parse a trace header line, unknown header records are ignored
+  bool parseHeaderLine(std::string &line);
+  void addSampleStats(const PmemAddrSampleStats &stats);
+
+  SampleStatsMapTy &sample_stats() { return _sample_stats; }
+  // Whether the tracker sampled away some events of the site
+  bool siteIncomplete(uint64_t guid) const {
+    auto si = _sample_stats.find(guid);
+    return si != _sample_stats.end() && si->second.incomplete();
+  }
+  // Range of the pool offsets recorded for a site, false if there are none
+  bool siteOffsetRange(uint64_t guid, uint64_t &low, uint64_t &high) const;
+
+  // Ticks per second of the tracker clock the items are stamped with, 0 if
+  // the trace carries no stamps
+  uint64_t clock_hz() const { return _clock_hz; }
+  void set_clock_hz(uint64_t hz) { _clock_hz = hz; }
+
   // Map all addresses in the trace to the corresponding LLVM instructions
   bool addressesToInstructions(matching::Matcher *matcher);
   // Map one address in the trace to the corresponding LLVM instruction
   bool addressToInstruction(PmemAddrTraceItem *item,
                             matching::Matcher *matcher);
 
-  // Try to calculate the pool offsets of a dynamic address
+  // Try to calculate the pool offsets of a dynamic address from the pool
+  // creation hooks, only for traces without a pool registry
   bool calculatePoolOffsets();
 
-  // Deserialize the address trace from file
+  // Deserialize the address trace from file. For a segmented trace, the
+  // segments sealed before checkpoint sequence number minSeq are skipped.
   static bool deserialize(const char *fileName, PmemVarGuidMap *varMap,
-                          PmemAddrTrace &result, bool ignoreBadLine = false);
+                          PmemAddrTrace &result, bool ignoreBadLine = false,
+                          uint64_t minSeq = 0);
 
  protected:
   TraceListTy _items;
   TracePoolListTy _pool_addrs;
+  // registry pool id to index in _pool_addrs
+  std::map<uint32_t, size_t> _pool_index;
+  SampleStatsMapTy _sample_stats;
+  uint64_t _clock_hz = 0;
 
   // Keep a map here to avoid repeated querying the matcher for the same
   // guid. Note that from modularity point of view, we should keep this
@@ -21,6 +21,8 @@
 #include <fstream>
 #include <iostream>
 
+#include "addr_trace_format.h"
+
 #define DEBUG_TYPE "pmem-addr-instrumenter"
 //#define MAX_ADDRESSES 1000005
 using namespace std;
@@ -120,6 +122,21 @@ bool PmemAddrInstrumenter::initHookFuncs(Module &M) {
     return false;
   }
 
+  _register_pool_func = cast<Function>(
+      M.getOrInsertFunction(getPoolRegisterName(), VoidTy, _I8PtrTy, _I8PtrTy,
+                            _I32Ty, nullptr));
+  if (!_register_pool_func) {
+    errs() << "could not find function " << getPoolRegisterName() << "\n";
+    return false;
+  }
+
+  _unregister_pool_func = cast<Function>(M.getOrInsertFunction(
+      getPoolUnregisterName(), VoidTy, _I8PtrTy, nullptr));
+  if (!_unregister_pool_func) {
+    errs() << "could not find function " << getPoolUnregisterName() << "\n";
+    return false;
+  }
+
   _track_addr_func = cast<Function>(M.getOrInsertFunction(
       getRuntimeHookName(), VoidTy, _I8PtrTy, _I32Ty, nullptr));
   if (!_track_addr_func) {
@@ -182,6 +199,8 @@ bool PmemAddrInstrumenter::initHookFuncs(Module &M) {
     appendToGlobalDtors(M, _tracker_finish_func, 1);
     errs() << "Instrumented call to " << getTrackHookFinishName()
            << " in main\n";
+
+    instrumentPoolCalls(M);
   }
 
   _initialized = true;
@@ -311,6 +330,42 @@ bool PmemAddrInstrumenter::instrumentInstr(Instruction *instr) {
   return true;
 }
 
+bool PmemAddrInstrumenter::instrumentPoolCalls(Module &M) {
+  unsigned pool_calls = 0;
+  for (Function &F : M) {
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      CallInst *ci = dyn_cast<CallInst>(&*I);
+      if (!ci) continue;
+      Function *callee = ci->getCalledFunction();
+      if (!callee) continue;
+      StringRef name = callee->getName();
+      unsigned kind = 0;
+      if (name == "pmemobj_create" || name == "pmemobj_open") {
+        kind = ARTHAS_TRACE_POOL_OBJ;
+      } else if (name == "pmem_map_file") {
+        kind = ARTHAS_TRACE_POOL_MAP;
+      }
+      if (kind != 0) {
+        // register the returned base with the path it was mapped from
+        IRBuilder<> builder(ci->getNextNode());
+        auto base = builder.CreateBitCast(ci, _I8PtrTy);
+        auto path = builder.CreateBitCast(ci->getArgOperand(0), _I8PtrTy);
+        builder.CreateCall(_register_pool_func,
+                           {base, path, ConstantInt::get(_I32Ty, kind)});
+        pool_calls++;
+      } else if (name == "pmemobj_close" || name == "pmem_unmap") {
+        // unregister before the mapping goes away
+        IRBuilder<> builder(ci);
+        auto base = builder.CreateBitCast(ci->getArgOperand(0), _I8PtrTy);
+        builder.CreateCall(_unregister_pool_func, {base});
+        pool_calls++;
+      }
+    }
+  }
+  errs() << "Instrumented " << pool_calls << " pool registry calls\n";
+  return pool_calls > 0;
+}
+
 bool PmemAddrInstrumenter::instrumentSlice(
     Slice *slice, map<Instruction *, set<Value *>> &useDefMap) {
   bool instrumented = false;
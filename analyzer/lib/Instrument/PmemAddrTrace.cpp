@@ -13,6 +13,15 @@
 
 #include "llvm/Support/raw_ostream.h"
 
+#include "addr_trace_format.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -35,6 +44,10 @@ using namespace llvm::matching;
 // Must be consistent with the field separator used in the address tracker lib
 const char *PmemAddrTraceItem::FieldSeparator = ",";
 
+// Must be consistent with the trace header format in the address tracker lib
+const char PmemAddrSampleStats::HeaderChar = '#';
+const char *PmemAddrSampleStats::SampleTag = "sample";
+
 // the pmemobj_create call instruction string to identify pool addresses
 static const char *PmemObjCreateCallInstrStr =
     "call %struct.pmemobjpool* @pmemobj_create";
@@ -63,6 +76,12 @@ bool PmemAddrTraceItem::parse(string &item_str, PmemAddrTraceItem &item,
     item.addr = str2fmt<uint64_t>(item.addr_str, true);
   }
   item.guid = str2fmt<uint64_t>(parts[1]);
+  resolve(item, varMap);
+  return true;
+}
+
+void PmemAddrTraceItem::resolve(PmemAddrTraceItem &item,
+                                PmemVarGuidMap *varMap) {
   if (varMap != nullptr) {
     // if the GUID map is supplied, we'll resolve the corresponding pmem
     // variable information from the map with the GUID
@@ -86,9 +105,81 @@ bool PmemAddrTraceItem::parse(string &item_str, PmemAddrTraceItem &item,
       }
     }
   }
+}
+
+bool PmemAddrSampleStats::parse(string &item_str, PmemAddrSampleStats &stats) {
+  vector<string> parts;
+  // skip the header char
+  splitList(item_str.substr(1), PmemAddrTraceItem::FieldSeparator, parts);
+  if (parts.size() != EntryFields || parts[0] != SampleTag) {
+    return false;
+  }
+  try {
+    stats.guid = str2fmt<uint64_t>(parts[1]);
+    stats.seen = str2fmt<uint64_t>(parts[2]);
+    stats.recorded = str2fmt<uint64_t>(parts[3]);
+    stats.distinct = str2fmt<uint64_t>(parts[4]);
+    stats.max_shift = str2fmt<uint32_t>(parts[5]);
+  } catch (const std::invalid_argument &) {
+    return false;
+  }
+  return true;
+}
+
+bool PmemAddrTrace::parseHeaderLine(string &line) {
+  PmemAddrSampleStats stats;
+  if (!PmemAddrSampleStats::parse(line, stats)) {
+    return false;
+  }
+  addSampleStats(stats);
   return true;
 }
 
+void PmemAddrTrace::add(PmemAddrTraceItem *item) {
+  _items.push_back(item);
+  if (item->pool_id != 0) {
+    auto pi = _pool_index.find(item->pool_id);
+    if (pi != _pool_index.end()) {
+      _pool_addrs[pi->second].addresses.push_back(item);
+    }
+  } else if ((item->is_pool || item->is_mmap) && !hasPoolRegistry()) {
+    _pool_addrs.push_back(PmemAddrPool(item));
+  }
+}
+
+void PmemAddrTrace::addPool(const PmemAddrPool &pool) {
+  if (_pool_index.count(pool.id)) return;
+  // pools inferred from the creation hooks are superseded by the registry
+  if (!hasPoolRegistry()) _pool_addrs.clear();
+  _pool_index[pool.id] = _pool_addrs.size();
+  _pool_addrs.push_back(pool);
+  errs() << "Found registered pool " << pool.id << " at "
+         << (void *)pool.base << " (" << pool.path << ")\n";
+}
+
+void PmemAddrTrace::addSampleStats(const PmemAddrSampleStats &stats) {
+  // the statistics may be reported more than once, the last one wins
+  _sample_stats[stats.guid] = stats;
+  if (stats.incomplete()) {
+    errs() << "Site " << stats.guid << " is sampled: " << stats.recorded
+           << " of " << stats.seen << " addresses recorded\n";
+  }
+}
+
+bool PmemAddrTrace::siteOffsetRange(uint64_t guid, uint64_t &low,
+                                    uint64_t &high) const {
+  bool found = false;
+  for (auto item : _items) {
+    if (item->guid != guid || item->is_pool || item->is_mmap ||
+        !item->has_pool_offset)
+      continue;
+    if (!found || item->pool_offset < low) low = item->pool_offset;
+    if (!found || item->pool_offset > high) high = item->pool_offset;
+    found = true;
+  }
+  return found;
+}
+
 PmemAddrTrace::~PmemAddrTrace() {
   for (auto item : _items) {
     delete item;
@@ -101,10 +192,214 @@ void PmemAddrTrace::clear() {
   }
   _items.clear();
   _pool_addrs.clear();
+  _pool_index.clear();
+  _sample_stats.clear();
+  _clock_hz = 0;
+}
+
+bool PmemAddrTraceSegment::isSegmentFile(const char *fileName) {
+  int fd = ::open(fileName, O_RDONLY);
+  if (fd < 0) return false;
+  uint64_t magic = 0;
+  ssize_t n = ::read(fd, &magic, sizeof(magic));
+  ::close(fd);
+  return n == sizeof(magic) && magic == ARTHAS_TRACE_MAGIC;
+}
+
+std::string PmemAddrTraceSegment::segmentPath(const std::string &basePath,
+                                              uint64_t id) {
+  if (id == 0) return basePath;
+  return basePath + "." + std::to_string(id);
+}
+
+void PmemAddrTraceSegment::listSegments(const char *basePath,
+                                        std::vector<std::string> &paths) {
+  std::string base(basePath);
+  std::vector<std::pair<uint64_t, std::string>> found;
+  if (isSegmentFile(basePath)) found.emplace_back(0, base);
+  size_t slash = base.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : base.substr(0, slash);
+  std::string prefix =
+      (slash == std::string::npos ? base : base.substr(slash + 1)) + ".";
+  DIR *dp = opendir(dir.c_str());
+  if (dp) {
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != nullptr) {
+      std::string name(ent->d_name);
+      if (name.size() <= prefix.size() ||
+          name.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      std::string suffix = name.substr(prefix.size());
+      if (suffix.find_first_not_of("0123456789") != std::string::npos)
+        continue;
+      uint64_t id = std::stoull(suffix);
+      std::string path = segmentPath(base, id);
+      if (id > 0 && isSegmentFile(path.c_str())) found.emplace_back(id, path);
+    }
+    closedir(dp);
+  }
+  std::sort(found.begin(), found.end());
+  for (auto &entry : found) paths.push_back(entry.second);
+}
+
+bool PmemAddrTraceSegment::open(const char *fileName) {
+  close();
+  int fd = ::open(fileName, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(arthas_trace_header)) {
+    ::close(fd);
+    return false;
+  }
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) return false;
+  auto hdr = (struct arthas_trace_header *)addr;
+  if (hdr->magic != ARTHAS_TRACE_MAGIC ||
+      hdr->version != ARTHAS_TRACE_VERSION ||
+      hdr->record_offset + hdr->capacity * sizeof(arthas_trace_record) >
+          (uint64_t)st.st_size) {
+    errs() << "Invalid address trace segment " << fileName << "\n";
+    munmap(addr, st.st_size);
+    return false;
+  }
+  _hdr = hdr;
+  _len = st.st_size;
+  _ino = st.st_ino;
+  return true;
+}
+
+void PmemAddrTraceSegment::close() {
+  if (_hdr) munmap(_hdr, _len);
+  _hdr = nullptr;
+  _len = 0;
+  _ino = 0;
+}
+
+bool PmemAddrTraceSegment::replaced(const char *fileName) const {
+  struct stat st;
+  if (stat(fileName, &st) != 0) return false;
+  return (uint64_t)st.st_ino != _ino;
+}
+
+uint64_t PmemAddrTraceSegment::committed() const {
+  uint64_t committed = __atomic_load_n(&_hdr->committed, __ATOMIC_ACQUIRE);
+  return committed < _hdr->capacity ? committed : _hdr->capacity;
+}
+
+uint64_t PmemAddrTraceSegment::dropped() const {
+  return __atomic_load_n(&_hdr->dropped, __ATOMIC_RELAXED);
+}
+
+bool PmemAddrTraceSegment::closed() const {
+  return __atomic_load_n(&_hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint64_t PmemAddrTraceSegment::segmentId() const { return _hdr->segment_id; }
+
+bool PmemAddrTraceSegment::sealed() const {
+  return __atomic_load_n(&_hdr->sealed, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool PmemAddrTraceSegment::sealedBefore(uint64_t seq) const {
+  return sealed() && _hdr->seq_valid && _hdr->seq_end < seq;
+}
+
+uint64_t PmemAddrTraceSegment::read(uint64_t from, uint64_t to,
+                                    PmemVarGuidMap *varMap,
+                                    PmemAddrTrace &result,
+                                    bool stopAtInFlight) {
+  struct arthas_trace_record *records = arthas_trace_records(_hdr);
+  char addr_buf[32];
+  // pools are registered before any of their addresses is recorded
+  readPools(result);
+  uint64_t i;
+  for (i = from; i < to; i++) {
+    struct arthas_trace_record *rec = &records[i];
+    if (!(__atomic_load_n(&rec->flags, __ATOMIC_ACQUIRE) &
+          ARTHAS_TRACE_RECORD_VALID)) {
+      // the record was reserved but the writer has not finished (or died)
+      if (stopAtInFlight) break;
+      continue;
+    }
+    PmemAddrTraceItem *item = new PmemAddrTraceItem();
+    item->addr = rec->addr;
+    item->guid = rec->guid;
+    item->stamp = rec->stamp;
+    item->is_page = rec->flags & ARTHAS_TRACE_RECORD_PAGE;
+    if (rec->pool != 0) {
+      item->pool_id = rec->pool;
+      item->pool_offset = rec->offset;
+      item->has_pool_offset = true;
+    }
+    // keep the same string form as the %p printed by the text tracker
+    snprintf(addr_buf, sizeof(addr_buf), "0x%lx", (unsigned long)rec->addr);
+    item->addr_str = addr_buf;
+    PmemAddrTraceItem::resolve(*item, varMap);
+    result.add(item);
+  }
+  if (_hdr->clock_hz) result.set_clock_hz(_hdr->clock_hz);
+  return i;
+}
+
+void PmemAddrTraceSegment::readSampleStats(PmemAddrTrace &result) {
+  struct arthas_trace_sample *samples = arthas_trace_samples(_hdr);
+  for (uint64_t i = 0; i < _hdr->sample_count; i++) {
+    if (samples[i].seen == 0) continue;
+    PmemAddrSampleStats stats;
+    stats.guid = i;
+    stats.seen = samples[i].seen;
+    stats.recorded = samples[i].recorded;
+    stats.distinct = samples[i].distinct;
+    stats.max_shift = samples[i].max_shift;
+    result.addSampleStats(stats);
+  }
+}
+
+void PmemAddrTraceSegment::readPools(PmemAddrTrace &result) {
+  for (int i = 0; i < ARTHAS_TRACE_MAX_POOLS; i++) {
+    struct arthas_trace_pool *pool = &_hdr->pools[i];
+    uint32_t id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+    if (id == 0) continue;
+    std::string path(pool->path, strnlen(pool->path, sizeof(pool->path)));
+    result.addPool(PmemAddrPool(id, pool->base, pool->size, path));
+  }
 }
 
 bool PmemAddrTrace::deserialize(const char *fileName, PmemVarGuidMap *varMap,
-                                PmemAddrTrace &result, bool ignoreBadLine) {
+                                PmemAddrTrace &result, bool ignoreBadLine,
+                                uint64_t minSeq) {
+  std::vector<std::string> segments;
+  PmemAddrTraceSegment::listSegments(fileName, segments);
+  if (!segments.empty()) {
+    uint64_t dropped = 0;
+    unsigned skipped = 0;
+    for (auto &path : segments) {
+      PmemAddrTraceSegment segment;
+      if (!segment.open(path.c_str())) {
+        errs() << "Failed to map " << path << " for reading address trace\n";
+        return false;
+      }
+      if (segment.sealedBefore(minSeq)) {
+        skipped++;
+        continue;
+      }
+      segment.read(0, segment.committed(), varMap, result);
+      // the statistics are cumulative, the newest segment wins
+      segment.readSampleStats(result);
+      dropped += segment.dropped();
+    }
+    if (skipped > 0) {
+      errs() << "Skipped " << skipped << " trace segments older than "
+             << "checkpoint sequence number " << minSeq << "\n";
+    }
+    if (dropped > 0) {
+      errs() << "Address tracker dropped " << dropped
+             << " records because the trace segment was full\n";
+    }
+    return true;
+  }
+  // otherwise, this is a text trace with one "<address>,<guid>" per line
   std::ifstream addrfile(fileName);
   if (!addrfile.is_open()) {
     errs() << "Failed to open " << fileName
@@ -115,6 +410,10 @@ bool PmemAddrTrace::deserialize(const char *fileName, PmemVarGuidMap *varMap,
   unsigned lineno = 0;
   while (getline(addrfile, line)) {
     lineno++;
+    if (isHeaderLine(line)) {
+      result.parseHeaderLine(line);
+      continue;
+    }
     PmemAddrTraceItem *item = new PmemAddrTraceItem();
     if (!PmemAddrTraceItem::parse(line, *item, varMap)) {
       errs() << "Unrecognized line " << lineno << ": " << line << "\n";
@@ -225,6 +524,7 @@ bool PmemAddrTrace::calculatePoolOffsets() {
     // calculate offset only if the address is larger than the last pool address
     if (item->addr >= last_pool_addr) {
       item->pool_offset = item->addr - last_pool_addr;
+      item->has_pool_offset = true;
       // assume this item belongs to this pool
       last_pool->addresses.push_back(item);
       offset_obtained = true;
@@ -0,0 +1,167 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef __ADDR_TRACE_FORMAT_H_
+#define __ADDR_TRACE_FORMAT_H_
+
+// On-media layout of the address trace segment written by the address
+// tracker runtime. The tracker maps a preallocated segment file and appends
+// fixed-size records with plain stores, so a crash loses at most the records
+// that were in flight. This header only has plain C definitions, so it can be
+// shared by the tracker and by the trace parser in the analyzer/reactor
+// without linking the tracker library.
+//
+// Segment layout:
+//
+//   +--------------------------+  0
+//   | arthas_trace_header      |  including the pool registry
+//   +--------------------------+  sample_offset (if sample_count > 0)
+//   | arthas_trace_sample[]    |  indexed by GUID
+//   +--------------------------+  record_offset
+//   | arthas_trace_record[]    |  capacity slots
+//   +--------------------------+
+//
+// The tracker rotates to a new segment once the current one is full or too
+// old. The first segment of a run is stored at the base path, e.g.
+// pmem_addr_pid_42.dat, segment N > 0 at <base>.N. Older segments are
+// deleted once the checkpoint log no longer holds a version written while
+// they were open, so readers must expect gaps at the head of the chain.
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "ARTHTRC1" in little endian
+#define ARTHAS_TRACE_MAGIC 0x3143525448545241ULL
+#define ARTHAS_TRACE_VERSION 4
+
+// a record is only valid once this flag is set, it is written last
+#define ARTHAS_TRACE_RECORD_VALID 0x1
+// the record is the first write to a page in an epoch of the page tracker,
+// addr and offset are the start of the page (see page_tracker.c)
+#define ARTHAS_TRACE_RECORD_PAGE 0x2
+// GUID of page records, no instrumented site has it
+#define ARTHAS_TRACE_PAGE_GUID 0
+
+// size of the pool registry table in the segment header
+#define ARTHAS_TRACE_MAX_POOLS 16
+#define ARTHAS_TRACE_POOL_PATH_SIZE 88
+
+// how a pool was mapped, see __arthas_register_pool
+#define ARTHAS_TRACE_POOL_OBJ 1
+#define ARTHAS_TRACE_POOL_MAP 2
+
+struct arthas_trace_record {
+  uint64_t addr;
+  // offset of addr within its pool, only valid if pool is not 0
+  uint64_t offset;
+  // arthas_trace_clock() when the access was recorded
+  uint64_t stamp;
+  uint32_t guid;
+  // id of the registered pool the address falls in, 0 if none
+  uint16_t pool;
+  uint16_t flags;
+};
+
+// A pool mapping registered by the tracker when the program creates, opens
+// or maps a pmem file. Ids are never reused within a run, so a record keeps
+// pointing at the right mapping even after the pool is closed and reopened
+// at a different base address.
+struct arthas_trace_pool {
+  uint64_t base;
+  uint64_t size;
+  // arthas_trace_clock() when the pool was mapped and unmapped (0 if open)
+  uint64_t open_stamp;
+  uint64_t close_stamp;
+  uint32_t id;
+  uint32_t kind;
+  char path[ARTHAS_TRACE_POOL_PATH_SIZE];
+};
+
+// per-site sampling statistics, see the sampling mode in addr_tracker.c
+struct arthas_trace_sample {
+  uint32_t guid;
+  // the largest sampling period (2^shift) the site reached
+  uint32_t max_shift;
+  // number of events the site generated
+  uint64_t seen;
+  // number of events written to the trace
+  uint64_t recorded;
+  // number of distinct addresses recorded before sampling kicked in
+  uint64_t distinct;
+};
+
+struct arthas_trace_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t pid;
+  // byte offset and number of slots of the sampling table, 0 if disabled
+  uint64_t sample_offset;
+  uint64_t sample_count;
+  // byte offset and number of slots of the record array
+  uint64_t record_offset;
+  uint64_t capacity;
+  // number of record slots handed out to writers
+  uint64_t reserved;
+  // records in [0, committed) are written, or still in flight if their
+  // valid flag is not set yet
+  uint64_t committed;
+  // number of records dropped because the segment was full
+  uint64_t dropped;
+  // set on a clean shutdown of the tracker
+  uint32_t closed;
+  // set once the tracker moved on to segment segment_id + 1
+  uint32_t sealed;
+  // position of the segment in the rotation chain, 0 for the first one
+  uint64_t segment_id;
+  // checkpoint sequence numbers when the segment was opened and sealed,
+  // only meaningful if seq_valid is set
+  uint64_t seq_begin;
+  uint64_t seq_end;
+  uint32_t seq_valid;
+  uint32_t padding;
+  // ticks per second of arthas_trace_clock(), 0 if unknown
+  uint64_t clock_hz;
+  // pools registered while the segment was current, plus the ones that
+  // were still open when it was created; entries with id 0 are unused
+  struct arthas_trace_pool pools[ARTHAS_TRACE_MAX_POOLS];
+};
+
+// Cheap clock shared by the address tracker and the checkpoint runtime, so
+// that trace records and checkpoint versions can be ordered against each
+// other. It is the invariant TSC on x86-64 and the monotonic clock in
+// nanoseconds elsewhere; only differences between stamps are meaningful.
+static inline uint64_t arthas_trace_clock(void) {
+#if defined(__x86_64__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline struct arthas_trace_record *arthas_trace_records(
+    struct arthas_trace_header *hdr) {
+  return (struct arthas_trace_record *)((char *)hdr + hdr->record_offset);
+}
+
+static inline struct arthas_trace_sample *arthas_trace_samples(
+    struct arthas_trace_header *hdr) {
+  if (hdr->sample_count == 0) return (struct arthas_trace_sample *)0;
+  return (struct arthas_trace_sample *)((char *)hdr + hdr->sample_offset);
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* __ADDR_TRACE_FORMAT_H_ */
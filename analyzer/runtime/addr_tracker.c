@@ -8,47 +8,460 @@
 
 #include "addr_tracker.h"
 
-FILE *__arthas_tracker_file;
-#define MAX_ADDRESSES 2000000001
-#define FLUSH_LIMIT 100000
 #define MAX_FILE_NAME_SIZE 128
 
-// void *addresses[MAX_ADDRESSES];
-// unsigned guids[MAX_ADDRESSES];
-void **addresses;
-unsigned *guids;
-int address_count = 0;
-// int guid_count = 0;
-pthread_mutex_t lock;
-
-void *myThreadFun(void *vargp) {
-  printf("start background thread\n");
-  while (1) {
-    while (address_count < FLUSH_LIMIT) {
-      // printf("stuck in here\n");
-      // spinlock here
+// The trace is written into a preallocated, memory-mapped segment file (see
+// addr_trace_format.h). On DAX pmem the records are durable as soon as they
+// are stored; otherwise the MAP_SHARED page cache keeps them when the process
+// dies, even under SIGKILL. Either way there is no stdio buffering and
+// nothing needs to be flushed from a signal handler.
+#define TRACE_DEFAULT_SEGMENT_SIZE (256UL << 20)
+#define TRACE_HEADER_SIZE 4096
+
+_Static_assert(sizeof(struct arthas_trace_header) <= TRACE_HEADER_SIZE,
+               "trace header does not fit in its page");
+
+// Segments are rotated when full or older than trace_rotate_secs. The oldest
+// rotated segments are retired when more than trace_max_segments are kept.
+// A segment is only unmapped once no writer is inside it (see trace_enter),
+// as writers that reserved a slot just before a rotation may still be
+// storing into it. The previous segment is always kept.
+#define TRACE_DEFAULT_MAX_SEGMENTS 8
+// how often (in records) a writer checks the age of the segment
+#define TRACE_ROTATE_CHECK_MASK 4095
+// after a failed rotation, records are dropped for a backoff that doubles
+// on every failure, from 1ms up to 1s, before the next attempt
+#define TRACE_ROTATE_MIN_BACKOFF_NS 1000000ULL
+#define TRACE_ROTATE_MAX_BACKOFF_NS 1000000000ULL
+
+struct trace_segment {
+  struct arthas_trace_header *hdr;
+  struct arthas_trace_record *records;
+  size_t mapped_len;
+  int is_pmem;
+  uint64_t create_ns;
+  // writers currently storing into the segment, see trace_enter
+  unsigned long writers;
+  // next retired segment in trace_free_segments
+  struct trace_segment *next_free;
+  char path[MAX_FILE_NAME_SIZE];
+};
+
+// the segment writers append to
+struct trace_segment *__arthas_trace_cur;
+// segments still on disk, oldest first, protected by trace_lock
+struct trace_segment **trace_segments;
+// Retired segments, reused by trace_segment_create and never freed: a writer
+// that loaded __arthas_trace_cur just before a rotation may still bump the
+// writer count of a retired segment. Protected by trace_lock.
+struct trace_segment *trace_free_segments;
+unsigned long trace_segment_count;
+unsigned long trace_max_segments = TRACE_DEFAULT_MAX_SEGMENTS;
+unsigned long trace_rotate_secs;
+size_t trace_segment_size = TRACE_DEFAULT_SEGMENT_SIZE;
+char trace_base_path[MAX_FILE_NAME_SIZE];
+// earliest time of the next rotation attempt after a failure, and the
+// current backoff, 0 while rotations succeed
+uint64_t trace_rotate_retry_ns;
+uint64_t trace_rotate_backoff_ns;
+// ticks per second of arthas_trace_clock(), recorded in each segment
+uint64_t trace_clock_hz;
+
+// Registry of the pools the program has mapped, looked up on every record
+// to store the pool-relative offset of the address. A slot is free when its
+// size is 0, and the size is published last. Each registration is copied
+// into the pool table of the current segment header.
+struct arthas_trace_pool trace_pools[ARTHAS_TRACE_MAX_POOLS];
+// high-water mark of the used slots, bounds the lookup
+unsigned int trace_pool_slots;
+uint32_t trace_pool_next_id = 1;
+// protects segment rotation and the pool registry
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Provided by the checkpoint runtime (see checkpoint_hashmap.h) when it is
+// linked in, stamps the segments with the sequence numbers they cover
+uint64_t checkpoint_sequence_number(void) __attribute__((weak));
+
+// Adaptive per-site sampling. Each site (GUID) always records the first
+// sample_first_n distinct addresses it sees. After that, it records one out
+// of every 2^shift events, where the shift is raised whenever the site's
+// event rate over the last window exceeds sample_rate and lowered again
+// once the rate drops well below it.
+#define SAMPLE_MAX_SITES 65536
+#define SAMPLE_MAX_FIRST_N 4096
+#define SAMPLE_DEFAULT_FIRST_N 64
+#define SAMPLE_DEFAULT_WINDOW 10000
+#define SAMPLE_DEFAULT_RATE 100000
+#define SAMPLE_DEFAULT_MAX_SHIFT 10
+
+struct sample_site {
+  // the statistics live in the sampling table of the trace segment so that
+  // they survive a crash
+  struct arthas_trace_sample *stats;
+  // current sampling period is 2^shift
+  unsigned int shift;
+  uint64_t window_start_ns;
+  // open addressing set of the first distinct addresses, 2 * first_n slots
+  char *first_addrs[];
+};
+
+bool sample_enabled = false;
+unsigned int sample_first_n = SAMPLE_DEFAULT_FIRST_N;
+unsigned long sample_window = SAMPLE_DEFAULT_WINDOW;
+unsigned long sample_rate = SAMPLE_DEFAULT_RATE;
+unsigned int sample_max_shift = SAMPLE_DEFAULT_MAX_SHIFT;
+struct sample_site **sample_sites;
+
+static unsigned long tracker_env(const char *name, unsigned long def) {
+  const char *val = getenv(name);
+  if (!val || *val == '\0') return def;
+  char *end;
+  unsigned long ret = strtoul(val, &end, 10);
+  if (end == val || *end != '\0') {
+    fprintf(stderr, "ignoring invalid value %s for %s\n", val, name);
+    return def;
+  }
+  return ret;
+}
+
+static uint64_t sample_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sample_init() {
+  sample_enabled = tracker_env(ARTHAS_SAMPLE_ENV, 0) != 0;
+  if (!sample_enabled) return;
+  sample_first_n = tracker_env(ARTHAS_SAMPLE_FIRST_N_ENV, SAMPLE_DEFAULT_FIRST_N);
+  if (sample_first_n > SAMPLE_MAX_FIRST_N) sample_first_n = SAMPLE_MAX_FIRST_N;
+  sample_window = tracker_env(ARTHAS_SAMPLE_WINDOW_ENV, SAMPLE_DEFAULT_WINDOW);
+  if (sample_window == 0) sample_window = SAMPLE_DEFAULT_WINDOW;
+  sample_rate = tracker_env(ARTHAS_SAMPLE_RATE_ENV, SAMPLE_DEFAULT_RATE);
+  sample_max_shift =
+      tracker_env(ARTHAS_SAMPLE_MAX_SHIFT_ENV, SAMPLE_DEFAULT_MAX_SHIFT);
+  if (sample_max_shift > 30) sample_max_shift = 30;
+  sample_sites = calloc(SAMPLE_MAX_SITES, sizeof(struct sample_site *));
+  // the per-site statistics table in the segment is indexed by GUID
+  if (!sample_sites) {
+    fprintf(stderr, "failed to allocate sampling sites, sampling disabled\n");
+    sample_enabled = false;
+    return;
+  }
+  fprintf(stderr,
+          "address tracker sampling: first %u addresses, window %lu, "
+          "rate %lu/s, max shift %u\n",
+          sample_first_n, sample_window, sample_rate, sample_max_shift);
+}
+
+static struct sample_site *sample_get_site(unsigned int guid,
+                                           struct trace_segment *seg) {
+  struct sample_site *site = sample_sites[guid];
+  if (site) return site;
+  size_t slots = 2 * (size_t)sample_first_n;
+  site = calloc(1, sizeof(struct sample_site) + slots * sizeof(char *));
+  if (!site) return NULL;
+  site->stats = &arthas_trace_samples(seg->hdr)[guid];
+  site->window_start_ns = sample_now_ns();
+  // another thread may have installed the site in the meantime
+  if (!__sync_bool_compare_and_swap(&sample_sites[guid], NULL, site)) {
+    free(site);
+    site = sample_sites[guid];
+  } else {
+    site->stats->guid = guid;
+  }
+  return site;
+}
+
+// Returns true if addr is one of the first distinct addresses of the site
+// (either already known or newly added)
+static bool sample_first_addr(struct sample_site *site, char *addr) {
+  size_t slots = 2 * (size_t)sample_first_n;
+  size_t pos = (((uintptr_t)addr >> 3) * 0x9E3779B97F4A7C15ULL) % slots;
+  for (size_t i = 0; i < slots; i++) {
+    char *cur = site->first_addrs[pos];
+    if (cur == addr) return true;
+    if (cur == NULL) {
+      if (site->stats->distinct >= sample_first_n) return false;
+      if (__sync_bool_compare_and_swap(&site->first_addrs[pos], NULL, addr)) {
+        __sync_add_and_fetch(&site->stats->distinct, 1);
+        return true;
+      }
+      if (site->first_addrs[pos] == addr) return true;
     }
-    // printf("outside\n");
-    // pthread_mutex_lock(&lock);
-    for (int i = 0; i < address_count; i++)
-      fprintf(__arthas_tracker_file, "%p,%u\n", addresses[i], guids[i]);
-    address_count = 0;
-    // pthread_mutex_unlock(&lock);
-    // printf("address count is %d\n", address_count);
+    pos = (pos + 1) % slots;
   }
+  return false;
+}
+
+// Adjust the sampling period at the end of each window of events. Only
+// the thread whose event closes a window gets here, but others read the
+// shift concurrently, so every access is atomic. Two windows closing at
+// once may both adjust, which only makes the period approximate.
+static void sample_adjust(struct sample_site *site) {
+  uint64_t now = sample_now_ns();
+  uint64_t elapsed =
+      now - __atomic_load_n(&site->window_start_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&site->window_start_ns, now, __ATOMIC_RELAXED);
+  // coarse clock may not tick within a short window: treat as very hot
+  uint64_t rate = elapsed ? sample_window * 1000000000ULL / elapsed : ~0ULL;
+  unsigned int shift = __atomic_load_n(&site->shift, __ATOMIC_RELAXED);
+  if (rate > sample_rate && shift < sample_max_shift) {
+    shift++;
+    __atomic_store_n(&site->shift, shift, __ATOMIC_RELAXED);
+    if (shift > __atomic_load_n(&site->stats->max_shift, __ATOMIC_RELAXED))
+      __atomic_store_n(&site->stats->max_shift, shift, __ATOMIC_RELAXED);
+  } else if (rate < sample_rate / 4 && shift > 0) {
+    __atomic_store_n(&site->shift, shift - 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Decide whether an event at a site should be written to the trace. The
+// caller keeps seg entered, which also keeps the newer segments that the
+// statistics may already point to mapped.
+static bool sample_should_record(char *addr, unsigned int guid,
+                                 struct trace_segment *seg) {
+  if (guid >= SAMPLE_MAX_SITES) return true;
+  struct sample_site *site = sample_get_site(guid, seg);
+  if (!site) return true;
+  uint64_t seen = __sync_add_and_fetch(&site->stats->seen, 1);
+  if (seen % sample_window == 0) sample_adjust(site);
+  unsigned int shift = __atomic_load_n(&site->shift, __ATOMIC_RELAXED);
+  bool record;
+  if (sample_first_addr(site, addr))
+    record = true;
+  else
+    record = (seen & ((1ULL << shift) - 1)) == 0;
+  if (record) __sync_add_and_fetch(&site->stats->recorded, 1);
+  return record;
 }
 
 char *__arthas_tracker_file_name(char *buf) {
-  snprintf(buf, 128, "pmem_addr_pid_%d.dat", getpid());
+  const char *dir = getenv(ARTHAS_TRACE_DIR_ENV);
+  if (dir && *dir != '\0')
+    snprintf(buf, MAX_FILE_NAME_SIZE, "%s/pmem_addr_pid_%d.dat", dir,
+             getpid());
+  else
+    snprintf(buf, MAX_FILE_NAME_SIZE, "pmem_addr_pid_%d.dat", getpid());
   return buf;
 }
 
-void termination_handler(int signum) {
-  /*for(int i = 0; i < address_count; i++){
-    fprintf(__arthas_tracker_file, "%p,%u\n", addresses[i], guids[i]);
-  }*/
-  fclose(__arthas_tracker_file);
-  exit(-1);
+// Measure the rate of arthas_trace_clock() against the monotonic clock, so
+// that the reactor can turn stamp differences into time
+static uint64_t trace_clock_calibrate() {
+  struct timespec ts_start, ts_end, delay = {0, 10000000};  // 10ms
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  uint64_t start = arthas_trace_clock();
+  nanosleep(&delay, NULL);
+  uint64_t end = arthas_trace_clock();
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  uint64_t ns = (ts_end.tv_sec - ts_start.tv_sec) * 1000000000ULL +
+                ts_end.tv_nsec - ts_start.tv_nsec;
+  if (ns == 0) return 0;
+  return (uint64_t)((double)(end - start) * 1e9 / ns);
+}
+
+// Find the registered pool that addr falls in, returns its id or 0
+static inline uint16_t trace_pool_lookup(uint64_t addr, uint64_t *offset) {
+  unsigned int slots = __atomic_load_n(&trace_pool_slots, __ATOMIC_ACQUIRE);
+  for (unsigned int i = 0; i < slots; i++) {
+    struct arthas_trace_pool *pool = &trace_pools[i];
+    uint64_t size = __atomic_load_n(&pool->size, __ATOMIC_ACQUIRE);
+    if (size && addr - pool->base < size) {
+      *offset = addr - pool->base;
+      return pool->id;
+    }
+  }
+  return 0;
+}
+
+// Add a pool to the registry table of a segment header, the id goes in
+// last so that a reader never sees a half-written entry
+static void trace_header_add_pool(struct arthas_trace_header *hdr,
+                                  const struct arthas_trace_pool *pool) {
+  for (int i = 0; i < ARTHAS_TRACE_MAX_POOLS; i++) {
+    struct arthas_trace_pool *slot = &hdr->pools[i];
+    if (slot->id != 0) continue;
+    slot->base = pool->base;
+    slot->size = pool->size;
+    slot->open_stamp = pool->open_stamp;
+    slot->close_stamp = pool->close_stamp;
+    slot->kind = pool->kind;
+    memcpy(slot->path, pool->path, sizeof(slot->path));
+    __atomic_store_n(&slot->id, pool->id, __ATOMIC_RELEASE);
+    pmem_persist(slot, sizeof(*slot));
+    return;
+  }
+  fprintf(stderr, "pool table of trace segment %lu is full, pool %u at %s "
+          "is not recorded\n", hdr->segment_id, pool->id, pool->path);
+}
+
+// Take a segment from the free list or allocate one, under trace_lock
+static struct trace_segment *trace_segment_alloc() {
+  struct trace_segment *seg = trace_free_segments;
+  if (!seg) return calloc(1, sizeof(struct trace_segment));
+  trace_free_segments = seg->next_free;
+  // writers is left alone, a late trace_enter may still be backing out
+  seg->hdr = NULL;
+  seg->records = NULL;
+  seg->next_free = NULL;
+  return seg;
+}
+
+static void trace_segment_release(struct trace_segment *seg) {
+  seg->next_free = trace_free_segments;
+  trace_free_segments = seg;
+}
+
+static void trace_segment_path(char *buf, uint64_t id) {
+  if (id == 0)
+    snprintf(buf, MAX_FILE_NAME_SIZE, "%s", trace_base_path);
+  else
+    snprintf(buf, MAX_FILE_NAME_SIZE, "%s.%lu", trace_base_path, id);
+}
+
+// Create and map a preallocated trace segment, returns NULL on failure
+static struct trace_segment *trace_segment_create(uint64_t id) {
+  uint64_t sample_count = sample_enabled ? SAMPLE_MAX_SITES : 0;
+  uint64_t record_offset =
+      TRACE_HEADER_SIZE + sample_count * sizeof(struct arthas_trace_sample);
+  if (trace_segment_size < record_offset + sizeof(struct arthas_trace_record)) {
+    fprintf(stderr, "trace segment size %lu is too small\n",
+            trace_segment_size);
+    return NULL;
+  }
+  struct trace_segment *seg = trace_segment_alloc();
+  if (!seg) return NULL;
+  trace_segment_path(seg->path, id);
+  // start from a fresh file so that no stale record from a previous process
+  // with the same pid could be mistaken for a valid one
+  unlink(seg->path);
+  // without PMEM_FILE_SPARSE, the file space is preallocated up-front
+  void *addr = pmem_map_file(seg->path, trace_segment_size, PMEM_FILE_CREATE,
+                             0666, &seg->mapped_len, &seg->is_pmem);
+  if (addr == NULL) {
+    fprintf(stderr, "failed to map trace segment %s: %s\n", seg->path,
+            pmem_errormsg());
+    trace_segment_release(seg);
+    return NULL;
+  }
+  struct arthas_trace_header *hdr = (struct arthas_trace_header *)addr;
+  seg->hdr = hdr;
+  memset(hdr, 0, TRACE_HEADER_SIZE);
+  hdr->version = ARTHAS_TRACE_VERSION;
+  hdr->pid = getpid();
+  hdr->sample_offset = sample_count ? TRACE_HEADER_SIZE : 0;
+  hdr->sample_count = sample_count;
+  hdr->record_offset = record_offset;
+  hdr->capacity =
+      (seg->mapped_len - record_offset) / sizeof(struct arthas_trace_record);
+  hdr->segment_id = id;
+  hdr->clock_hz = trace_clock_hz;
+  // the pools that are still open carry over to the new segment
+  for (unsigned int i = 0; i < trace_pool_slots; i++)
+    if (trace_pools[i].size) trace_header_add_pool(hdr, &trace_pools[i]);
+  if (checkpoint_sequence_number) {
+    hdr->seq_begin = checkpoint_sequence_number();
+    hdr->seq_valid = 1;
+  }
+  if (sample_count) {
+    // the statistics are cumulative, carry them over from the previous
+    // segment so that the newest segment always has the full picture
+    struct trace_segment *prev = __arthas_trace_cur;
+    if (prev && prev->hdr->sample_count == sample_count)
+      memcpy(arthas_trace_samples(hdr), arthas_trace_samples(prev->hdr),
+             sample_count * sizeof(struct arthas_trace_sample));
+    else
+      memset(arthas_trace_samples(hdr), 0,
+             sample_count * sizeof(struct arthas_trace_sample));
+  }
+  // the magic goes in last so that a reader never sees a half-built header
+  pmem_persist(hdr, record_offset);
+  hdr->magic = ARTHAS_TRACE_MAGIC;
+  pmem_persist(&hdr->magic, sizeof(hdr->magic));
+  seg->records = arthas_trace_records(hdr);
+  seg->create_ns = sample_now_ns();
+  return seg;
+}
+
+static void trace_segment_sync(struct trace_segment *seg) {
+  // only needed for durability against power failures, a process crash
+  // does not lose any committed record
+  if (seg->is_pmem)
+    pmem_persist(seg->hdr, seg->mapped_len);
+  else
+    pmem_msync(seg->hdr, seg->mapped_len);
+}
+
+// Delete the oldest segments over the budget, called with trace_lock held.
+// The current and the previous segment are kept. A segment that still has
+// writers inside is left for a later rotation, and so are the newer ones.
+static void trace_retire_segments() {
+  unsigned long retired = 0;
+  while (trace_segment_count - retired > 2 &&
+         trace_segment_count - retired > trace_max_segments) {
+    struct trace_segment *seg = trace_segments[retired];
+    // pairs with the fetch-and-add in trace_enter: either the writer sees
+    // that the segment is no longer current, or this sees the writer
+    if (__atomic_load_n(&seg->writers, __ATOMIC_SEQ_CST) != 0) break;
+    fprintf(stderr, "retiring trace segment %s\n", seg->path);
+    unlink(seg->path);
+    pmem_unmap(seg->hdr, seg->mapped_len);
+    trace_segment_release(seg);
+    retired++;
+  }
+  if (retired == 0) return;
+  trace_segment_count -= retired;
+  memmove(trace_segments, trace_segments + retired,
+          trace_segment_count * sizeof(struct trace_segment *));
+}
+
+// Seal full_seg and switch writers to a new segment, returns false if no
+// new segment could be created
+static bool trace_rotate(struct trace_segment *full_seg) {
+  // do not retry on every record while creating a segment fails
+  if (__atomic_load_n(&trace_rotate_retry_ns, __ATOMIC_RELAXED) >
+      sample_now_ns())
+    return false;
+  pthread_mutex_lock(&trace_lock);
+  // somebody else already rotated the segment
+  if (__arthas_trace_cur != full_seg) {
+    pthread_mutex_unlock(&trace_lock);
+    return true;
+  }
+  struct arthas_trace_header *full = full_seg->hdr;
+  struct trace_segment *seg = NULL;
+  // segments that had writers inside at the last rotation may be gone now
+  if (trace_segment_count >= trace_max_segments + 2) trace_retire_segments();
+  if (trace_segment_count < trace_max_segments + 2)
+    seg = trace_segment_create(full->segment_id + 1);
+  if (!seg) {
+    if (trace_rotate_backoff_ns == 0)
+      trace_rotate_backoff_ns = TRACE_ROTATE_MIN_BACKOFF_NS;
+    else if (trace_rotate_backoff_ns < TRACE_ROTATE_MAX_BACKOFF_NS)
+      trace_rotate_backoff_ns *= 2;
+    __atomic_store_n(&trace_rotate_retry_ns,
+                     sample_now_ns() + trace_rotate_backoff_ns,
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+    return false;
+  }
+  trace_rotate_backoff_ns = 0;
+  if (checkpoint_sequence_number) full->seq_end = checkpoint_sequence_number();
+  __atomic_store_n(&full->sealed, 1, __ATOMIC_RELEASE);
+  // repoint the sampling statistics to the new segment, increments racing
+  // with the switch may be lost, which only makes the stats approximate
+  if (seg->hdr->sample_count) {
+    struct arthas_trace_sample *samples = arthas_trace_samples(seg->hdr);
+    for (unsigned int guid = 0; guid < SAMPLE_MAX_SITES; guid++)
+      if (sample_sites[guid]) sample_sites[guid]->stats = &samples[guid];
+  }
+  trace_segments[trace_segment_count++] = seg;
+  __atomic_store_n(&__arthas_trace_cur, seg, __ATOMIC_SEQ_CST);
+  trace_segment_sync(full_seg);
+  trace_retire_segments();
+  pthread_mutex_unlock(&trace_lock);
+  return true;
 }
 
 void __arthas_low_level_init() {
@@ -74,60 +487,193 @@ void __arthas_save_file(void *address) {
 }
 
 void __arthas_addr_tracker_init() {
-  if (pthread_mutex_init(&lock, NULL) != 0) {
-    printf("\n mutex init has failed\n");
+  __arthas_tracker_file_name(trace_base_path);
+  fprintf(stderr, "openning address tracker output file %s\n",
+          trace_base_path);
+  // sampling decides the size of the statistics table in the segment
+  sample_init();
+  trace_clock_hz = trace_clock_calibrate();
+  trace_segment_size =
+      tracker_env(ARTHAS_TRACE_SEGMENT_SIZE_ENV, TRACE_DEFAULT_SEGMENT_SIZE);
+  trace_rotate_secs = tracker_env(ARTHAS_TRACE_ROTATE_SECS_ENV, 0);
+  trace_max_segments =
+      tracker_env(ARTHAS_TRACE_MAX_SEGMENTS_ENV, TRACE_DEFAULT_MAX_SEGMENTS);
+  // the current and the previous segment are always kept
+  if (trace_max_segments > 0 && trace_max_segments < 2) trace_max_segments = 2;
+  // 0 asks for no budget, the array still needs a bound
+  unsigned long slots = trace_max_segments ? trace_max_segments + 2 : 4096;
+  if (!trace_max_segments) trace_max_segments = slots - 2;
+  trace_segments = calloc(slots, sizeof(struct trace_segment *));
+  struct trace_segment *seg = trace_segments ? trace_segment_create(0) : NULL;
+  if (!seg) {
+    fprintf(stderr, "address tracking is disabled\n");
+    sample_enabled = false;
     return;
   }
-  pthread_t thread_id;
-  pthread_create(&thread_id, NULL, myThreadFun, NULL);
-  char filename_buf[MAX_FILE_NAME_SIZE];
-  char *filename = __arthas_tracker_file_name(filename_buf);
-  fprintf(stderr, "openning address tracker output file %s\n", filename);
-  __arthas_tracker_file = fopen(filename, "w");
-  addresses = malloc(sizeof(void *) * MAX_ADDRESSES);
-  guids = malloc(sizeof(unsigned int) * MAX_ADDRESSES);
-
-  struct sigaction new_action, old_action;
-  new_action.sa_handler = termination_handler;
-  sigemptyset(&new_action.sa_mask);
-  new_action.sa_flags = 0;
-  new_action.sa_sigaction = &termination_handler;
-
-  sigaction(SIGINT, &new_action, NULL);
-  sigaction(SIGFPE, &new_action, NULL);
-  sigaction(SIGTERM, &new_action, NULL);
-  sigaction(SIGSEGV, &new_action, NULL);
-  sigaction(SIGILL, &new_action, NULL);
-  sigaction(SIGABRT, &new_action, NULL);
-  sigaction(SIGBUS, &new_action, NULL);
-  sigaction(SIGSTKFLT, &new_action, NULL);
+  trace_segments[trace_segment_count++] = seg;
+  __atomic_store_n(&__arthas_trace_cur, seg, __ATOMIC_RELEASE);
+}
+
+// Enter the current segment so that it is not unmapped while the caller
+// stores into it, returns NULL if tracking is finished. The count is only
+// taken while the segment is still current, so a retired segment whose
+// count drops to zero is never entered again.
+static struct trace_segment *trace_enter() {
+  for (;;) {
+    struct trace_segment *seg =
+        __atomic_load_n(&__arthas_trace_cur, __ATOMIC_SEQ_CST);
+    if (!seg) return NULL;
+    __atomic_fetch_add(&seg->writers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&__arthas_trace_cur, __ATOMIC_SEQ_CST) == seg)
+      return seg;
+    __atomic_fetch_sub(&seg->writers, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void trace_exit(struct trace_segment *seg) {
+  __atomic_fetch_sub(&seg->writers, 1, __ATOMIC_RELEASE);
+}
+
+// Reserve a record slot, rotating to a new segment if the current one is
+// full or sealed. Returns the entered segment, which the caller exits once
+// the record is committed, or NULL if the record has to be dropped.
+static struct trace_segment *trace_reserve(uint64_t *idx) {
+  for (;;) {
+    struct trace_segment *seg = trace_enter();
+    if (!seg) return NULL;
+    struct arthas_trace_header *hdr = seg->hdr;
+    if (!__atomic_load_n(&hdr->sealed, __ATOMIC_ACQUIRE)) {
+      *idx = __sync_fetch_and_add(&hdr->reserved, 1);
+      if (*idx < hdr->capacity) return seg;
+    }
+    bool rotated = trace_rotate(seg);
+    if (!rotated) __sync_fetch_and_add(&hdr->dropped, 1);
+    trace_exit(seg);
+    if (!rotated) return NULL;
+  }
+}
+
+static void trace_append(char *addr, unsigned int guid, uint16_t flags) {
+  uint64_t idx;
+  struct trace_segment *seg = trace_reserve(&idx);
+  if (!seg) return;
+  struct arthas_trace_header *hdr = seg->hdr;
+  struct arthas_trace_record *rec = &seg->records[idx];
+  rec->addr = (uint64_t)addr;
+  rec->offset = 0;
+  rec->pool = trace_pool_lookup((uint64_t)addr, &rec->offset);
+  rec->stamp = arthas_trace_clock();
+  rec->guid = guid;
+  // publish the record, then advance the committed length past it
+  __atomic_store_n(&rec->flags, ARTHAS_TRACE_RECORD_VALID | flags,
+                   __ATOMIC_RELEASE);
+  uint64_t committed = __atomic_load_n(&hdr->committed, __ATOMIC_RELAXED);
+  while (committed < idx + 1 &&
+         !__atomic_compare_exchange_n(&hdr->committed, &committed, idx + 1,
+                                      true, __ATOMIC_RELEASE,
+                                      __ATOMIC_RELAXED)) {
+  }
+  if (trace_rotate_secs && (idx & TRACE_ROTATE_CHECK_MASK) == 0 &&
+      sample_now_ns() - seg->create_ns > trace_rotate_secs * 1000000000ULL)
+    trace_rotate(seg);
+  trace_exit(seg);
 }
 
 inline void __arthas_track_addr(char *addr, unsigned int guid) {
-  // TODO: replace the fprintf with buffering and async write
-   fprintf(__arthas_tracker_file, "%p,%u\n", addr, guid);
-  // pthread_mutex_lock(&lock);
-  /*if (address_count > MAX_ADDRESSES) {
-    printf("too large %d\n", address_count);
-    pthread_mutex_lock(&lock);
-    pthread_mutex_unlock(&lock);
+  if (!__arthas_trace_cur) return;
+  if (sample_enabled) {
+    // the sampling statistics live in the segments too
+    struct trace_segment *seg = trace_enter();
+    if (!seg) return;
+    bool record = sample_should_record(addr, guid, seg);
+    trace_exit(seg);
+    if (!record) return;
   }
-  addresses[address_count] = addr;
-  guids[address_count] = guid;
-  address_count++;*/
+  trace_append(addr, guid, 0);
+}
+
+// pages are never sampled, each one is only recorded once per epoch
+void __arthas_track_page(char *addr) {
+  if (!__arthas_trace_cur) return;
+  trace_append(addr, ARTHAS_TRACE_PAGE_GUID, ARTHAS_TRACE_RECORD_PAGE);
+}
+
+void __arthas_register_pool(char *base, const char *path, unsigned int kind) {
+  // the create or open call failed
+  if (!base) return;
+  struct stat st;
+  if (!path || stat(path, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "cannot tell the size of pool %s, not registered\n",
+            path ? path : "(null)");
+    return;
+  }
+  pthread_mutex_lock(&trace_lock);
+  int free_slot = -1;
+  for (int i = 0; i < ARTHAS_TRACE_MAX_POOLS; i++) {
+    if (trace_pools[i].size == 0) {
+      free_slot = i;
+      break;
+    }
+  }
+  if (free_slot < 0 || trace_pool_next_id > UINT16_MAX) {
+    fprintf(stderr, "pool registry is full, pool %s is not registered\n",
+            path);
+    pthread_mutex_unlock(&trace_lock);
+    return;
+  }
+  struct arthas_trace_pool *pool = &trace_pools[free_slot];
+  pool->base = (uint64_t)base;
+  pool->id = trace_pool_next_id++;
+  pool->kind = kind;
+  pool->open_stamp = arthas_trace_clock();
+  pool->close_stamp = 0;
+  snprintf(pool->path, sizeof(pool->path), "%s", path);
+  __atomic_store_n(&pool->size, (uint64_t)st.st_size, __ATOMIC_RELEASE);
+  if ((unsigned int)free_slot >= trace_pool_slots)
+    __atomic_store_n(&trace_pool_slots, free_slot + 1, __ATOMIC_RELEASE);
+  if (__arthas_trace_cur) trace_header_add_pool(__arthas_trace_cur->hdr, pool);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void __arthas_unregister_pool(char *base) {
+  pthread_mutex_lock(&trace_lock);
+  for (unsigned int i = 0; i < trace_pool_slots; i++) {
+    struct arthas_trace_pool *pool = &trace_pools[i];
+    if (pool->size == 0 || pool->base != (uint64_t)base) continue;
+    __atomic_store_n(&pool->size, 0, __ATOMIC_RELEASE);
+    if (!__arthas_trace_cur) break;
+    struct arthas_trace_header *hdr = __arthas_trace_cur->hdr;
+    for (int j = 0; j < ARTHAS_TRACE_MAX_POOLS; j++) {
+      if (hdr->pools[j].id != pool->id) continue;
+      hdr->pools[j].close_stamp = arthas_trace_clock();
+      pmem_persist(&hdr->pools[j].close_stamp, sizeof(uint64_t));
+    }
+    break;
+  }
+  pthread_mutex_unlock(&trace_lock);
 }
 
 bool __arthas_addr_tracker_dump() {
-  fflush(__arthas_tracker_file);
+  struct trace_segment *seg = __arthas_trace_cur;
+  if (!seg) return false;
+  trace_segment_sync(seg);
   return true;
 }
 
+// Seal and sync the trace. The segments stay mapped, other threads may still
+// be writing a record into the current one, and are unmapped at exit.
 void __arthas_addr_tracker_finish() {
-  // close the tracker file
-  for (int i = 0; i < address_count; i++)
-    fprintf(__arthas_tracker_file, "%p,%u\n", addresses[i], guids[i]);
-  address_count = 0;
-  fflush(__arthas_tracker_file);
-  fclose(__arthas_tracker_file);
-
+  pthread_mutex_lock(&trace_lock);
+  struct trace_segment *cur = __arthas_trace_cur;
+  if (!cur) {
+    pthread_mutex_unlock(&trace_lock);
+    return;
+  }
+  if (checkpoint_sequence_number)
+    cur->hdr->seq_end = checkpoint_sequence_number();
+  cur->hdr->closed = 1;
+  __atomic_store_n(&__arthas_trace_cur, NULL, __ATOMIC_RELEASE);
+  for (unsigned long i = 0; i < trace_segment_count; i++)
+    trace_segment_sync(trace_segments[i]);
+  pthread_mutex_unlock(&trace_lock);
 }
@@ -10,24 +10,53 @@
 #define __ADDR_TRACKER_H_
 
 #include <pthread.h>
-#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 //#include "checkpoint.h"
+#include "addr_trace_format.h"
 #include "libpmem.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Directory to create the trace segments in, e.g., a DAX pmem mount, and the
+// size in bytes of each preallocated segment
+#define ARTHAS_TRACE_DIR_ENV "ARTHAS_TRACE_DIR"
+#define ARTHAS_TRACE_SEGMENT_SIZE_ENV "ARTHAS_TRACE_SEGMENT_SIZE"
+// Rotate to a new segment after this many seconds (0: only when full), and
+// keep at most this many segments on disk
+#define ARTHAS_TRACE_ROTATE_SECS_ENV "ARTHAS_TRACE_ROTATE_SECS"
+#define ARTHAS_TRACE_MAX_SEGMENTS_ENV "ARTHAS_TRACE_MAX_SEGMENTS"
+
+// Environment variables to configure the adaptive per-site sampling,
+// read once at __arthas_addr_tracker_init
+#define ARTHAS_SAMPLE_ENV "ARTHAS_SAMPLE"
+#define ARTHAS_SAMPLE_FIRST_N_ENV "ARTHAS_SAMPLE_FIRST_N"
+#define ARTHAS_SAMPLE_WINDOW_ENV "ARTHAS_SAMPLE_WINDOW"
+#define ARTHAS_SAMPLE_RATE_ENV "ARTHAS_SAMPLE_RATE"
+#define ARTHAS_SAMPLE_MAX_SHIFT_ENV "ARTHAS_SAMPLE_MAX_SHIFT"
+
 extern inline char *__arthas_tracker_file_name(char *buf);
 extern inline void __arthas_track_addr(char *addr, unsigned int guid);
 // extern inline void __arthas_track_addr(char **addresses, unsigned int *guids,
 //                                        int address_count);
 
+// Record the first write to the page at addr in an epoch of the page
+// tracker, see page_tracker.c
+void __arthas_track_page(char *addr);
+
+// Pool registry hooks, called right after a pool is created, opened or
+// mapped (kind is ARTHAS_TRACE_POOL_*) and right before it is closed
+void __arthas_register_pool(char *base, const char *path, unsigned int kind);
+void __arthas_unregister_pool(char *base);
+
 void __arthas_addr_tracker_init();
 bool __arthas_addr_tracker_dump();
 void __arthas_addr_tracker_finish();
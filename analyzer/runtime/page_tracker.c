@@ -0,0 +1,595 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#define _GNU_SOURCE
+#include "page_tracker.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "addr_trace_format.h"
+#include "checkpoint_log_format.h"
+#include "libpmemobj.h"
+
+// Address tracker entry points the shim drives, see addr_tracker.h. That
+// header also declares the inline hooks of instrumented code, which are not
+// defined here.
+void __arthas_addr_tracker_init();
+void __arthas_addr_tracker_finish();
+void __arthas_track_page(char *addr);
+void __arthas_register_pool(char *base, const char *path, unsigned int kind);
+void __arthas_unregister_pool(char *base);
+
+// data type of page versions, see checkpoint_hashmap.h in the reactor
+#define PAGE_CHECKPOINT 4
+#define PAGE_DEFAULT_LOG_SIZE (256UL << 20)
+#define PAGE_DEFAULT_EPOCH_US 1000
+#define PAGE_DEFAULT_STAGING_PAGES 1024
+// payload bytes per entry the log segments are laid out for, most epochs
+// only change a few cache lines of a page
+#define PAGE_LOG_BYTES_PER_ENTRY 512
+
+// Pages first written in an epoch, filled by the fault handler without
+// locking. The region has two of them: the end of an epoch switches the
+// handler to the other one and drains this one.
+struct page_epoch {
+  // indices of the dirty pages, room for every page so that the fault
+  // handler never allocates
+  size_t *dirty_list;
+  size_t dirty_count;
+  // content of pages before their first write of the run, copied by the
+  // fault handler into page_staging_pages preallocated slots
+  char *staged;
+  size_t *staged_page;
+  size_t staged_count;
+};
+
+// The write-protected pool mapping. Page versions are logged at offsets
+// relative to it and the reactor reverts a single pool, so one pool is
+// tracked per run.
+struct page_region {
+  char *base;
+  size_t size;
+  size_t pages;
+  // per page: written in the current epoch, and logged at least once
+  unsigned char *dirty;
+  unsigned char *logged;
+  struct page_epoch epochs[2];
+};
+
+static struct page_region page_pool;
+static char page_pool_path[PATH_MAX];
+// epoch the fault handler adds pages to, and number of running handlers
+static int page_cur_epoch;
+static int page_in_handler;
+static size_t page_staging_pages = PAGE_DEFAULT_STAGING_PAGES;
+static int page_staging_overflow;
+static size_t page_size;
+static unsigned long page_epoch_us = PAGE_DEFAULT_EPOCH_US;
+static uint64_t page_epoch_start_ns;
+static bool page_enabled = false;
+// protects the region outside the fault handler and the checkpoint log
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction page_prev_segv;
+
+// Set while the calling thread is inside the tracker, whose own
+// pmem_map_file and pmem_persist calls must reach libpmem directly
+static __thread int page_busy;
+
+// Checkpoint log segment the page versions are appended to, and the next
+// one, created ahead so that moving on to it does not wait for the file
+static char page_log_base[PATH_MAX];
+static size_t page_log_size = PAGE_DEFAULT_LOG_SIZE;
+static struct arthas_ckpt_header *page_log;
+static size_t page_log_mapped_len;
+static struct arthas_ckpt_header *page_log_next;
+static size_t page_log_next_len;
+static int page_log_is_pmem;
+static uint32_t page_log_slot;
+static struct arthas_ckpt_seq_counter page_seq;
+static char *page_scratch;
+
+static void *(*real_pmem_map_file)(const char *, size_t, int, mode_t, size_t *,
+                                   int *);
+static int (*real_pmem_unmap)(void *, size_t);
+static void (*real_pmem_persist)(const void *, size_t);
+static int (*real_pmem_msync)(const void *, size_t);
+static PMEMobjpool *(*real_pmemobj_create)(const char *, const char *, size_t,
+                                           mode_t);
+static PMEMobjpool *(*real_pmemobj_open)(const char *, const char *);
+static void (*real_pmemobj_close)(PMEMobjpool *);
+static void (*real_pmemobj_persist)(PMEMobjpool *, const void *, size_t);
+static void (*real_pmemobj_tx_commit)(void);
+
+static unsigned long page_env(const char *name, unsigned long def) {
+  const char *val = getenv(name);
+  if (!val || *val == '\0') return def;
+  char *end;
+  unsigned long ret = strtoul(val, &end, 10);
+  if (end == val || *end != '\0') {
+    fprintf(stderr, "ignoring invalid value %s for %s\n", val, name);
+    return def;
+  }
+  return ret;
+}
+
+static uint64_t page_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void page_log_sync(void *addr, size_t len) {
+  if (page_log_is_pmem)
+    real_pmem_persist(addr, len);
+  else
+    real_pmem_msync(addr, len);
+}
+
+// Create segment <base>.<slot>
+static struct arthas_ckpt_header *page_log_create(uint32_t slot,
+                                                  size_t *mapped_lenp) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.%u", page_log_base, slot);
+  uint64_t entries = page_log_size / PAGE_LOG_BYTES_PER_ENTRY;
+  uint64_t slots = 1;
+  while (slots < entries) slots <<= 1;
+  uint64_t index_offset, entry_offset, payload_offset;
+  arthas_ckpt_layout(slots, entries, 0, &index_offset, &entry_offset,
+                     &payload_offset);
+  if (page_log_size < payload_offset + page_size) {
+    fprintf(stderr, "page checkpoint log size %lu is too small\n",
+            page_log_size);
+    return NULL;
+  }
+  size_t mapped_len;
+  int is_pmem;
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)
+      real_pmem_map_file(path, page_log_size, PMEM_FILE_CREATE | PMEM_FILE_EXCL,
+                         0666, &mapped_len, &is_pmem);
+  if (!hdr) {
+    fprintf(stderr, "failed to create page checkpoint log %s: %s\n", path,
+            pmem_errormsg());
+    return NULL;
+  }
+  arthas_ckpt_init(hdr, slot, slots, entries, mapped_len - payload_offset);
+  page_log_is_pmem = is_pmem;
+  page_log_sync(hdr, payload_offset);
+  // the magic goes in last so that a reader never sees a half-built header
+  hdr->magic = ARTHAS_CKPT_MAGIC;
+  page_log_sync(&hdr->magic, sizeof(hdr->magic));
+  *mapped_lenp = mapped_len;
+  return hdr;
+}
+
+static void page_log_seal() {
+  if (!page_log) return;
+  page_log->sealed = 1;
+  page_log_sync(&page_log->sealed, sizeof(page_log->sealed));
+  real_pmem_unmap(page_log, page_log_mapped_len);
+  page_log = NULL;
+}
+
+// Make the next segment the current one and create the one after it.
+// Returns false if there is no segment to move on to.
+static bool page_log_switch() {
+  uint32_t slot = page_log_slot + 1;
+  page_log_seal();
+  if (!page_log_next)
+    page_log_next = page_log_create(slot, &page_log_next_len);
+  if (!page_log_next) return false;
+  page_log = page_log_next;
+  page_log_mapped_len = page_log_next_len;
+  page_log_slot = slot;
+  page_log_next = page_log_create(slot + 1, &page_log_next_len);
+  return true;
+}
+
+// Remove the next segment, which nothing was written to, at exit
+static void page_log_drop_next() {
+  if (!page_log_next) return;
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.%u", page_log_base, page_log_slot + 1);
+  real_pmem_unmap(page_log_next, page_log_next_len);
+  unlink(path);
+  page_log_next = NULL;
+}
+
+// Open the checkpoint log after the segments of earlier runs, whose
+// sequence numbers this run continues
+static void page_log_init() {
+  const char *file = getenv(ARTHAS_PAGE_CHECKPOINT_ENV);
+  if (!file || *file == '\0') return;
+  snprintf(page_log_base, sizeof(page_log_base), "%s%s", file,
+           ARTHAS_CKPT_LOG_SUFFIX);
+  page_log_size = page_env(ARTHAS_PAGE_LOG_SIZE_ENV, PAGE_DEFAULT_LOG_SIZE);
+  page_staging_pages =
+      page_env(ARTHAS_PAGE_STAGING_PAGES_ENV, PAGE_DEFAULT_STAGING_PAGES);
+  uint32_t slot = 0;
+  uint64_t next_seq = 0;
+  for (;; slot++) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.%u", page_log_base, slot);
+    size_t mapped_len;
+    int is_pmem;
+    struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)
+        real_pmem_map_file(path, 0, 0, 0, &mapped_len, &is_pmem);
+    if (!hdr) break;
+    if (mapped_len >= sizeof(*hdr) && hdr->magic == ARTHAS_CKPT_MAGIC &&
+        hdr->committed && hdr->last_seq >= next_seq)
+      next_seq = hdr->last_seq + 1;
+    real_pmem_unmap(hdr, mapped_len);
+  }
+  page_seq.next = next_seq;
+  page_scratch = (char *)malloc(page_size);
+  if (page_scratch) page_log = page_log_create(slot, &page_log_mapped_len);
+  if (!page_log) {
+    fprintf(stderr, "page checkpoints are disabled\n");
+    return;
+  }
+  page_log_slot = slot;
+  page_log_next = page_log_create(slot + 1, &page_log_next_len);
+}
+
+// Append data, the content of a page at some point, as the newest version
+// of the page. Called with page_lock held.
+static void page_log_version(struct page_region *r, size_t page,
+                             const char *data) {
+  if (!page_log) return;
+  uint64_t offset = page * page_size;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    uint64_t n = arthas_ckpt_append(
+        page_log, arthas_ckpt_seq_next(&page_seq), offset, data, page_size,
+        -1, PAGE_CHECKPOINT, arthas_trace_clock(), page_scratch);
+    if (n != ARTHAS_CKPT_NO_ENTRY) {
+      struct arthas_ckpt_entry *e = &arthas_ckpt_entries(page_log)[n];
+      page_log_sync(arthas_ckpt_payload(page_log) + e->payload, e->stored);
+      page_log_sync(e, sizeof(*e));
+      arthas_ckpt_commit(page_log, n);
+      page_log_sync(&page_log->committed, 4 * sizeof(uint64_t));
+      struct arthas_ckpt_index_slot *slot =
+          arthas_ckpt_index_update(page_log, offset, n);
+      if (slot) page_log_sync(slot, sizeof(*slot));
+      r->logged[page] = 1;
+      return;
+    }
+    if (!page_log_switch()) return;
+  }
+}
+
+// Checkpoint the pages first written in the current epoch, protecting them
+// again if protect is set, and start a new one. Called with page_lock held,
+// never from the fault handler.
+static void page_region_flush(struct page_region *r, int protect) {
+  int cur = page_cur_epoch;
+  struct page_epoch *ep = &r->epochs[cur];
+  __atomic_store_n(&page_cur_epoch, cur ^ 1, __ATOMIC_SEQ_CST);
+  // a handler that picked the drained epoch is done once none is running
+  while (__atomic_load_n(&page_in_handler, __ATOMIC_SEQ_CST)) sched_yield();
+  size_t staged = ep->staged_count < page_staging_pages ? ep->staged_count
+                                                        : page_staging_pages;
+  // the content before the first write of the run is the oldest version
+  for (size_t i = 0; i < staged && ep->staged; i++)
+    page_log_version(r, ep->staged_page[i], ep->staged + i * page_size);
+  for (size_t i = 0; i < ep->dirty_count; i++) {
+    size_t page = ep->dirty_list[i];
+    char *page_addr = r->base + page * page_size;
+    // writes after this fault into the next epoch
+    if (protect) mprotect(page_addr, page_size, PROT_READ);
+    page_log_version(r, page, page_addr);
+    __arthas_track_page(page_addr);
+    __atomic_store_n(&r->dirty[page], 0, __ATOMIC_RELEASE);
+  }
+  ep->dirty_count = 0;
+  ep->staged_count = 0;
+  if (page_staging_overflow == 1) {
+    fprintf(stderr,
+            "more than %lu pages first written in an epoch, raise %s to "
+            "checkpoint their content before the write\n",
+            page_staging_pages, ARTHAS_PAGE_STAGING_PAGES_ENV);
+    page_staging_overflow = 2;
+  }
+}
+
+// Copy a page about to be written for the first time into a staging slot
+static void page_stage(struct page_epoch *ep, size_t page, const char *addr) {
+  size_t slot = __atomic_fetch_add(&ep->staged_count, 1, __ATOMIC_ACQ_REL);
+  if (slot >= page_staging_pages) {
+    int expected = 0;
+    __atomic_compare_exchange_n(&page_staging_overflow, &expected, 1, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return;
+  }
+  memcpy(ep->staged + slot * page_size, addr, page_size);
+  ep->staged_page[slot] = page;
+}
+
+// Only marks the page dirty and makes it writable: no locks, allocation or
+// stdio, the logging waits for the end of the epoch
+static void page_segv_handler(int sig, siginfo_t *info, void *ctx) {
+  char *addr = (char *)info->si_addr;
+  struct page_region *r = &page_pool;
+  __atomic_add_fetch(&page_in_handler, 1, __ATOMIC_SEQ_CST);
+  size_t size = __atomic_load_n(&r->size, __ATOMIC_ACQUIRE);
+  bool tracked = size && (size_t)(addr - r->base) < size;
+  if (tracked) {
+    size_t page = (size_t)(addr - r->base) / page_size;
+    // another thread may have faulted on the same page first, the write is
+    // retried until that thread made the page writable
+    if (!__atomic_exchange_n(&r->dirty[page], 1, __ATOMIC_ACQ_REL)) {
+      int saved_errno = errno;
+      char *page_addr = r->base + page * page_size;
+      struct page_epoch *ep =
+          &r->epochs[__atomic_load_n(&page_cur_epoch, __ATOMIC_SEQ_CST)];
+      if (ep->staged && !r->logged[page]) page_stage(ep, page, page_addr);
+      size_t i = __atomic_fetch_add(&ep->dirty_count, 1, __ATOMIC_ACQ_REL);
+      ep->dirty_list[i] = page;
+      mprotect(page_addr, page_size, PROT_READ | PROT_WRITE);
+      errno = saved_errno;
+    }
+  }
+  __atomic_sub_fetch(&page_in_handler, 1, __ATOMIC_SEQ_CST);
+  if (tracked) return;
+  // not a tracked page, a real crash of the program
+  if (page_prev_segv.sa_flags & SA_SIGINFO) {
+    page_prev_segv.sa_sigaction(sig, info, ctx);
+  } else if (page_prev_segv.sa_handler != SIG_IGN &&
+             page_prev_segv.sa_handler != SIG_DFL) {
+    page_prev_segv.sa_handler(sig);
+  } else {
+    // returning re-executes the faulting instruction with the default action
+    sigaction(SIGSEGV, &page_prev_segv, NULL);
+  }
+}
+
+static void page_region_free(struct page_region *r) {
+  free(r->dirty);
+  free(r->logged);
+  for (int i = 0; i < 2; i++) {
+    free(r->epochs[i].dirty_list);
+    free(r->epochs[i].staged);
+    free(r->epochs[i].staged_page);
+  }
+  memset(r, 0, sizeof(*r));
+}
+
+static void page_track_region(char *base, size_t size, const char *path) {
+  if (!page_enabled || !base || !size || !path) return;
+  size_t pages = (size + page_size - 1) / page_size;
+  pthread_mutex_lock(&page_lock);
+  struct page_region *r = &page_pool;
+  if (r->size || (page_pool_path[0] && strcmp(page_pool_path, path) != 0)) {
+    fprintf(stderr,
+            "already tracking pool %s, writes to %s at %p are not tracked\n",
+            page_pool_path, path, base);
+    pthread_mutex_unlock(&page_lock);
+    return;
+  }
+  r->dirty = (unsigned char *)calloc(pages, 1);
+  r->logged = (unsigned char *)calloc(pages, 1);
+  bool ok = r->dirty && r->logged;
+  for (int i = 0; i < 2; i++) {
+    struct page_epoch *ep = &r->epochs[i];
+    ep->dirty_list = (size_t *)malloc(pages * sizeof(size_t));
+    ok = ok && ep->dirty_list;
+    if (!page_log) continue;
+    ep->staged = (char *)malloc(page_staging_pages * page_size);
+    ep->staged_page = (size_t *)malloc(page_staging_pages * sizeof(size_t));
+    ok = ok && ep->staged && ep->staged_page;
+  }
+  if (!ok || mprotect(base, pages * page_size, PROT_READ) != 0) {
+    fprintf(stderr, "failed to write-protect %p, writes are not tracked\n",
+            base);
+    page_region_free(r);
+    pthread_mutex_unlock(&page_lock);
+    return;
+  }
+  snprintf(page_pool_path, sizeof(page_pool_path), "%s", path);
+  r->base = base;
+  r->pages = pages;
+  __atomic_store_n(&r->size, size, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&page_lock);
+}
+
+// Checkpoint what both epochs hold and stop tracking the region, whose
+// pages are made writable first. Called with page_lock held.
+static void page_region_release(struct page_region *r) {
+  mprotect(r->base, r->pages * page_size, PROT_READ | PROT_WRITE);
+  page_region_flush(r, 0);
+  page_region_flush(r, 0);
+  __atomic_store_n(&r->size, 0, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&page_in_handler, __ATOMIC_SEQ_CST)) sched_yield();
+  page_region_free(r);
+}
+
+static void page_untrack_region(char *base) {
+  if (!page_enabled) return;
+  page_busy++;
+  pthread_mutex_lock(&page_lock);
+  if (page_pool.size && page_pool.base == base) page_region_release(&page_pool);
+  pthread_mutex_unlock(&page_lock);
+  page_busy--;
+}
+
+static void page_epoch_end_locked() {
+  if (page_pool.size) page_region_flush(&page_pool, 1);
+  page_epoch_start_ns = page_now_ns();
+}
+
+void __arthas_page_epoch_end(void) {
+  if (!page_enabled) return;
+  page_busy++;
+  pthread_mutex_lock(&page_lock);
+  page_epoch_end_locked();
+  pthread_mutex_unlock(&page_lock);
+  page_busy--;
+}
+
+// End the epoch at a persistence call once it is old enough, or once half
+// of the staging slots are used
+static void page_maybe_epoch_end() {
+  if (!page_enabled || page_busy) return;
+  struct page_epoch *ep =
+      &page_pool.epochs[__atomic_load_n(&page_cur_epoch, __ATOMIC_RELAXED)];
+  if (page_now_ns() - page_epoch_start_ns < page_epoch_us * 1000ULL &&
+      __atomic_load_n(&ep->staged_count, __ATOMIC_RELAXED) <
+          page_staging_pages / 2)
+    return;
+  __arthas_page_epoch_end();
+}
+
+#define PAGE_REAL(name) \
+  real_##name = (__typeof__(real_##name))dlsym(RTLD_NEXT, #name)
+
+__attribute__((constructor)) static void page_tracker_init() {
+  PAGE_REAL(pmem_map_file);
+  PAGE_REAL(pmem_unmap);
+  PAGE_REAL(pmem_persist);
+  PAGE_REAL(pmem_msync);
+  PAGE_REAL(pmemobj_create);
+  PAGE_REAL(pmemobj_open);
+  PAGE_REAL(pmemobj_close);
+  PAGE_REAL(pmemobj_persist);
+  PAGE_REAL(pmemobj_tx_commit);
+  if (!real_pmem_map_file || !real_pmem_unmap || !real_pmem_persist ||
+      !real_pmem_msync) {
+    fprintf(stderr, "libpmem is not loaded, page tracking is disabled\n");
+    return;
+  }
+  page_size = sysconf(_SC_PAGESIZE);
+  page_epoch_us = page_env(ARTHAS_PAGE_EPOCH_US_ENV, PAGE_DEFAULT_EPOCH_US);
+  page_busy++;
+  __arthas_addr_tracker_init();
+  page_log_init();
+  page_busy--;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = page_segv_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGSEGV, &sa, &page_prev_segv) != 0) {
+    perror("sigaction");
+    return;
+  }
+  page_epoch_start_ns = page_now_ns();
+  page_enabled = true;
+}
+
+__attribute__((destructor)) static void page_tracker_finish() {
+  if (!page_enabled) return;
+  page_busy++;
+  pthread_mutex_lock(&page_lock);
+  // later destructors of the program may still write to the pool
+  if (page_pool.size) page_region_release(&page_pool);
+  page_log_seal();
+  page_log_drop_next();
+  page_enabled = false;
+  pthread_mutex_unlock(&page_lock);
+  __arthas_addr_tracker_finish();
+  page_busy--;
+}
+
+// Read by the address tracker to stamp its segments with the checkpoint
+// sequence numbers they cover. Weak, so that a checkpoint runtime linked
+// into the same program keeps its own.
+__attribute__((weak)) uint64_t checkpoint_sequence_number(void) {
+  return arthas_ckpt_seq_peek(&page_seq);
+}
+
+// Register a new mapping with the tracker's pool registry and protect it
+static void page_register(char *base, size_t size, const char *path,
+                          unsigned int kind) {
+  page_busy++;
+  __arthas_register_pool(base, path, kind);
+  page_busy--;
+  page_track_region(base, size, path);
+}
+
+static void page_unregister(char *base) {
+  page_untrack_region(base);
+  page_busy++;
+  __arthas_unregister_pool(base);
+  page_busy--;
+}
+
+void *pmem_map_file(const char *path, size_t len, int flags, mode_t mode,
+                    size_t *mapped_lenp, int *is_pmemp) {
+  size_t mapped_len;
+  void *addr =
+      real_pmem_map_file(path, len, flags, mode, &mapped_len, is_pmemp);
+  if (mapped_lenp) *mapped_lenp = mapped_len;
+  if (addr && !page_busy)
+    page_register((char *)addr, mapped_len, path, ARTHAS_TRACE_POOL_MAP);
+  return addr;
+}
+
+int pmem_unmap(void *addr, size_t len) {
+  if (!page_busy) page_unregister((char *)addr);
+  return real_pmem_unmap(addr, len);
+}
+
+void pmem_persist(const void *addr, size_t len) {
+  real_pmem_persist(addr, len);
+  page_maybe_epoch_end();
+}
+
+int pmem_msync(const void *addr, size_t len) {
+  int ret = real_pmem_msync(addr, len);
+  page_maybe_epoch_end();
+  return ret;
+}
+
+// the size of a pool is the size of its file, like the tracker assumes
+static size_t page_pool_size(const char *path) {
+  struct stat st;
+  if (!path || stat(path, &st) != 0) return 0;
+  return st.st_size;
+}
+
+PMEMobjpool *pmemobj_create(const char *path, const char *layout,
+                            size_t poolsize, mode_t mode) {
+  PMEMobjpool *pop = real_pmemobj_create(path, layout, poolsize, mode);
+  if (pop && !page_busy)
+    page_register((char *)pop, page_pool_size(path), path,
+                  ARTHAS_TRACE_POOL_OBJ);
+  return pop;
+}
+
+PMEMobjpool *pmemobj_open(const char *path, const char *layout) {
+  PMEMobjpool *pop = real_pmemobj_open(path, layout);
+  if (pop && !page_busy)
+    page_register((char *)pop, page_pool_size(path), path,
+                  ARTHAS_TRACE_POOL_OBJ);
+  return pop;
+}
+
+void pmemobj_close(PMEMobjpool *pop) {
+  if (!page_busy) page_unregister((char *)pop);
+  real_pmemobj_close(pop);
+}
+
+void pmemobj_persist(PMEMobjpool *pop, const void *addr, size_t len) {
+  real_pmemobj_persist(pop, addr, len);
+  page_maybe_epoch_end();
+}
+
+void pmemobj_tx_commit(void) {
+  real_pmemobj_tx_commit();
+  page_maybe_epoch_end();
+}
@@ -0,0 +1,63 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef __PAGE_TRACKER_H_
+#define __PAGE_TRACKER_H_
+
+// Instrumentation-free mode for targets that cannot be rebuilt with the
+// instrumenter. Preloading libArthasPageTracker.so interposes on the libpmem
+// and libpmemobj calls that map a pool, write-protects the mapping and
+// records the first write to every page in each epoch:
+//
+//  - in the address trace, as a record flagged ARTHAS_TRACE_RECORD_PAGE,
+//  - in the checkpoint log (checkpoint_log_format.h in the reactor), as a
+//    version of the whole page with data type PAGE_CHECKPOINT. The first
+//    version of a page is its content before the first write; each epoch
+//    that dirtied it adds the content at the end of the epoch, which the
+//    delta encoding stores as the bytes that changed.
+//
+// An epoch ends at a persistence call (pmem_persist, pmem_msync,
+// pmemobj_persist, pmemobj_tx_commit) once it is at least
+// ARTHAS_PAGE_EPOCH_US old, and when the program exits. The dirty pages are
+// then checkpointed and protected again, so the steady-state cost is one
+// fault per page written per epoch. The fault handler only marks the page
+// and copies it if it was never logged; the records are written at the end
+// of the epoch. An epoch also ends early once half of the
+// ARTHAS_PAGE_STAGING_PAGES copies are used.
+//
+// Page versions are logged at offsets within the pool, so only one pool is
+// tracked per run, the first one mapped. It may be closed and opened again.
+//
+// Write protection uses mprotect and SIGSEGV. A program that installs its own
+// SIGSEGV handler after the tracker still works as long as it chains to the
+// previous handler.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Checkpoint file the page versions are logged for, the segments are
+// written at <file>.log.<N>. Without it only the trace is written.
+#define ARTHAS_PAGE_CHECKPOINT_ENV "ARTHAS_PAGE_CHECKPOINT"
+// Size in bytes of each checkpoint log segment
+#define ARTHAS_PAGE_LOG_SIZE_ENV "ARTHAS_PAGE_LOG_SIZE"
+// Minimum length of an epoch in microseconds
+#define ARTHAS_PAGE_EPOCH_US_ENV "ARTHAS_PAGE_EPOCH_US"
+// Number of pages per epoch whose content before their first write can be
+// copied
+#define ARTHAS_PAGE_STAGING_PAGES_ENV "ARTHAS_PAGE_STAGING_PAGES"
+
+// End the current epoch now, e.g., from a program that never calls one of
+// the interposed persistence functions
+void __arthas_page_epoch_end(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* __PAGE_TRACKER_H_ */
@@ -82,7 +82,7 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  if (!addrTrace.calculatePoolOffsets()) {
+  if (!addrTrace.hasPoolRegistry() && !addrTrace.calculatePoolOffsets()) {
     errs() << "Failed to calculate the address offsets w.r.t the pool address "
               "in the address trace file, abort\n";
     return 1;
@@ -11,6 +11,7 @@
 
 #include <libpmem.h>
 #include <libpmemobj.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +29,8 @@ extern "C" {
 #define DOUBLE_CHECKPOINT 1
 #define STRING_CHECKPOINT 2
 #define BOOL_CHECKPOINT 3
+// a whole page, logged by the page tracker of the address tracker runtime
+#define PAGE_CHECKPOINT 4
 
 #define ITEM_CAS 2
 #define ITEM_key(item)         \
@@ -66,15 +69,15 @@ typedef struct single_data {
   uint64_t offset;
   void *data;
   size_t size;
-  int sequence_number;
+  int64_t sequence_number;
   int version;
   int data_type;
   void *old_data[MAX_VERSIONS];
   size_t old_size[MAX_VERSIONS];
   uint64_t old_checkpoint_entry;
   uint64_t new_checkpoint_entry;
-  void *sorted_pmem_address;
   int tx_id;
+  uint64_t timestamp;
 } single_data;
 
 // checkpoint log entry by address/offset
@@ -85,13 +88,47 @@ typedef struct checkpoint_data {
   size_t size[MAX_VERSIONS];
   int version;
   int data_type;
-  int sequence_number[MAX_VERSIONS];
+  // low 32 bits of each version's sequence number, and the high 32 bits of
+  // the newest one, see checkpoint_data_seq
+  uint32_t sequence_number[MAX_VERSIONS];
+  uint32_t seq_epoch;
   uint64_t old_checkpoint_entry;
   uint64_t new_checkpoint_entry;
   int free_flag;
   int tx_id[MAX_VERSIONS];
 } checkpoint_data;
 
+// Sequence numbers are 64-bit and never wrap. The checkpoint pool only
+// stores the low 32 bits of each version plus the epoch (high 32 bits) of
+// the newest version, which fits in the padding after the version slots.
+// The versions of a variable are in sequence order, so walking down from
+// the newest one, a low half that goes up means the epoch before. This
+// holds as long as consecutive versions of a variable are less than 2^32
+// checkpoints apart. Writers of the slots check checkpoint_data_new_chain
+// before adding a version and drop the older ones if it is set.
+static inline int64_t checkpoint_data_seq(const checkpoint_data *c_data,
+                                          int v) {
+  uint64_t epoch = c_data->seq_epoch;
+  for (int j = c_data->version; j > v; j--)
+    if (c_data->sequence_number[j - 1] > c_data->sequence_number[j]) epoch--;
+  return (int64_t)(epoch << 32 | c_data->sequence_number[v]);
+}
+
+// A version with sequence number seq is too far from the newest one for the
+// epochs of the older slots to be decoded, it has to start a new chain
+static inline int checkpoint_data_new_chain(const checkpoint_data *c_data,
+                                            int64_t seq) {
+  int64_t newest = checkpoint_data_seq(c_data, c_data->version);
+  return (uint64_t)(seq - newest) >= (1ULL << 32);
+}
+
+// Set the sequence number of the newest version v
+static inline void checkpoint_data_set_seq(checkpoint_data *c_data, int v,
+                                           int64_t seq) {
+  c_data->sequence_number[v] = (uint32_t)seq;
+  c_data->seq_epoch = (uint32_t)((uint64_t)seq >> 32);
+}
+
 struct node {
   uint64_t offset;
   struct checkpoint_data c_data;
@@ -104,19 +141,84 @@ typedef struct checkpoint_log {
   struct node **list;
 } checkpoint_log;
 
-struct tx_node {
+// entries with a tx_id at or below this were not written in a transaction
+#define CHECKPOINT_NO_TX 0
+
+struct tx_entry {
   int tx_id;
-  struct single_data ordered_data;
-  struct tx_node *next;
+  int64_t sequence_number;
+};
+
+// Checkpoint entries grouped by transaction, built in the same pass as the
+// sequence number index. The entries of the d-th transaction (in tx_id
+// order) are entries[begin[d], begin[d + 1]).
+typedef struct tx_index {
+  // sorted by tx_id, then sequence number once tx_index_finish ran
+  struct tx_entry *entries;
+  size_t total;
+  size_t capacity;
+  int *tx_ids;
+  size_t *begin;
+  size_t count;
+} tx_index;
+
+// Sequence numbers of the checkpointed versions by pool offset, which the
+// pool offsets of traced accesses are matched against. Pool offsets are the
+// same in every run, unlike the addresses the pool was mapped at.
+struct offset_seq {
+  uint64_t offset;
+  int64_t sequence_number;
 };
 
-typedef struct tx_log {
+typedef struct offset_seq_index {
+  // sorted by offset, then sequence number
+  struct offset_seq *entries;
+  size_t count;
+} offset_seq_index;
+
+// default number of versions the reactor keeps per variable
+#define CHECKPOINT_DEFAULT_DEPTH 16
+
+// A version of a variable in the reactor's version history
+struct version_ref {
+  const void *data;
   size_t size;
-  struct tx_node **list;
-} tx_log;
+  int64_t sequence_number;
+  int tx_id;
+  uint64_t timestamp;
+  // data was allocated for the version (a rebuilt delta) and is freed when
+  // the version is evicted, otherwise it points into a mapping
+  int owned;
+};
+
+// Versions of one variable, oldest first, in a ring of capacity slots that
+// starts at head
+struct version_chain {
+  struct version_ref *ring;
+  uint32_t head;
+  uint32_t count;
+  uint32_t capacity;
+  // bytes held by the versions in the ring
+  size_t bytes;
+};
+
+static inline struct version_ref *version_chain_at(struct version_chain *chain,
+                                                   uint32_t i) {
+  return &chain->ring[(chain->head + i) % chain->capacity];
+}
+
+struct checkpoint_compact_stats {
+  // sealed segments and their entries
+  uint64_t segments;
+  uint64_t entries;
+  // entries still needed after the stable point
+  uint64_t kept;
+  uint64_t bytes_before;
+  uint64_t bytes_after;
+};
 
 struct seq_node {
-  int sequence_number;
+  int64_t sequence_number;
   struct single_data ordered_data;
   struct seq_node *next;
 };
@@ -133,24 +235,45 @@ typedef struct rev_log {
 
 struct checkpoint_log *reconstruct_checkpoint(const char *file_path,
                                               const char *pmem_library);
+struct checkpoint_log *reconstruct_checkpoint_segments(const char *base);
+int compact_checkpoint_log(const char *base, uint64_t stable_seq,
+                           struct checkpoint_compact_stats *stats);
+int64_t checkpoint_log_last_seq(const char *base);
+struct node *checkpoint_find_node(struct checkpoint_log *c_log,
+                                  uint64_t offset);
+void set_checkpoint_history(size_t depth, size_t budget);
+struct version_chain *checkpoint_version_chain(struct checkpoint_log *c_log,
+                                               uint64_t offset);
+const struct version_ref *checkpoint_previous_version(
+    struct checkpoint_log *c_log, uint64_t offset, int64_t seq_num);
 void order_by_sequence_num(seq_log *s_log, size_t *total_size,
                            struct checkpoint_log *c_log);
-void order_by_tx_id(tx_log *t_log, struct checkpoint_log *c_log);
+void order_by_sequence_num_tx(seq_log *s_log, size_t *total_size,
+                              struct checkpoint_log *c_log,
+                              tx_index *t_index);
+void tx_index_init(tx_index *t_index);
+void tx_index_finish(tx_index *t_index);
+long tx_index_find(tx_index *t_index, int tx_id);
+void tx_index_free(tx_index *t_index);
+int offset_seq_index_build(offset_seq_index *o_index, seq_log *s_log);
+void offset_seq_index_range(const offset_seq_index *o_index, uint64_t low,
+                            uint64_t high, size_t *first, size_t *last);
+void offset_seq_index_free(offset_seq_index *o_index);
 int sequence_comparator(const void *v1, const void *v2);
 void print_checkpoint_log(checkpoint_log *c_log);
-int hashCode(seq_log *s_log, int key);
-int txhashCode(tx_log *t_log, int key);
-void tx_insert(tx_log *t_log, int key, single_data ordered_data);
-void insert(seq_log *s_log, int key, single_data ordered_data);
-single_data tx_lookup(tx_log *t_log, int key);
-single_data lookup(seq_log *s_log, int key);
-int find_highest_seq_num(seq_log *s_log);
-int *address_lookup(seq_log *s_log, uint64_t address, int *seq_count,
-                    int *sequences);
-int rev_lookup(seq_log *s_log, int key);
-void lookup_modify(seq_log *s_log, int key, void *addr);
-void lookup_undo_save(seq_log *s_log, int key, void *addr, size_t size);
-int count_higher(seq_log *s_log, int seq_num);
+int hashCode(seq_log *s_log, int64_t key);
+void insert(seq_log *s_log, int64_t key, single_data ordered_data);
+void seq_log_free(seq_log *s_log);
+single_data lookup(seq_log *s_log, int64_t key);
+int64_t find_highest_seq_num(seq_log *s_log);
+int64_t find_lowest_seq_num(struct checkpoint_log *c_log);
+int64_t *address_lookup(seq_log *s_log, uint64_t address, int *seq_count,
+                        int64_t *sequences);
+int rev_lookup(seq_log *s_log, int64_t key);
+void set_pool_base(void *base);
+void *entry_pmem_address(const single_data *data);
+void lookup_undo_save(seq_log *s_log, int64_t key, void *addr, size_t size);
+int count_higher(seq_log *s_log, int64_t seq_num);
 #ifdef __cplusplus
 }
 #endif
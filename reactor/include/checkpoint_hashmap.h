@@ -19,6 +19,8 @@
 #define DOUBLE_CHECKPOINT 1
 #define STRING_CHECKPOINT 2
 #define BOOL_CHECKPOINT 3
+// a whole page, logged by the page tracker of the address tracker runtime
+#define PAGE_CHECKPOINT 4
 
 struct pool_info {
   PMEMobjpool *pm_pool;
@@ -29,10 +31,11 @@ struct single_data {
   uint64_t offset;
   void *data;
   size_t size;
-  int sequence_number;
+  uint64_t sequence_number;
   int version;
   int data_type;
   int tx_id;
+  uint64_t timestamp;
 };
 
 struct checkpoint_data {
@@ -42,7 +45,10 @@ struct checkpoint_data {
   size_t size[MAX_VERSIONS];
   int version;
   int data_type;
-  int sequence_number[MAX_VERSIONS];
+  // low 32 bits of each version's sequence number, and the high 32 bits of
+  // the newest one, see checkpoint_data_set_seq
+  uint32_t sequence_number[MAX_VERSIONS];
+  uint32_t seq_epoch;
   uint64_t old_checkpoint_entry;
   uint64_t new_checkpoint_entry;
   int free_flag;
@@ -51,6 +57,15 @@ struct checkpoint_data {
   // int old_checkpoint_counter;
 };
 
+// Set the sequence number of the newest version v. When the previous
+// version is 2^32 or more checkpoints older, the slots cannot tell the
+// epochs apart anymore, so the caller starts a new chain at version 0.
+static inline void checkpoint_data_set_seq(struct checkpoint_data *c_data,
+                                           int v, uint64_t seq) {
+  c_data->sequence_number[v] = (uint32_t)seq;
+  c_data->seq_epoch = (uint32_t)(seq >> 32);
+}
+
 /*struct checkpoint_log{
   struct checkpoint_data c_data[MAX_VARIABLES];
   int variable_count;
@@ -88,6 +103,9 @@ void shift_to_left(struct node *found_node);
 void insert_value(const void *address, size_t size, const void *data_address,
                   uint64_t offset);
 void print_checkpoint_log(void);
+// Sequence number bookkeeping, read by the address tracker to stamp trace
+// segments with the sequence numbers they cover.
+uint64_t checkpoint_sequence_number(void);
 // void revert_by_address(const void *address, int variable_index, int version,
 // int type, size_t size);
 // int check_offset(uint64_t offset, size_t size);
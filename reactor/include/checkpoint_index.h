@@ -0,0 +1,120 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_CHECKPOINT_INDEX_H_
+#define _REACTOR_CHECKPOINT_INDEX_H_
+
+// Open-addressing index from pool offsets to checkpoint entries. Pmem
+// offsets are 8- or 64-byte aligned, so they are mixed with a real integer
+// hash instead of taken modulo the table size. Each bucket is one cache line
+// holding a few offsets and compact 32-bit entry references, and collisions
+// probe the next bucket, so a lookup touches one or two cache lines however
+// full the table is. The layout has no pointers and can be placed in a pmem
+// pool by the checkpoint runtime as well as built in DRAM by the reactor.
+//
+// Entries are never removed, an offset that is checkpointed again only gets
+// its reference updated.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHECKPOINT_INDEX_WAYS 5
+#define CHECKPOINT_INDEX_NONE UINT32_MAX
+
+struct checkpoint_index_bucket {
+  uint64_t offset[CHECKPOINT_INDEX_WAYS];
+  uint32_t ref[CHECKPOINT_INDEX_WAYS];
+  uint32_t used;
+} __attribute__((aligned(64)));
+
+struct checkpoint_index {
+  // a power of two
+  uint64_t bucket_count;
+  uint64_t count;
+  struct checkpoint_index_bucket buckets[];
+};
+
+// finalizer of MurmurHash3
+static inline uint64_t checkpoint_index_hash(uint64_t offset) {
+  offset ^= offset >> 33;
+  offset *= 0xff51afd7ed558ccdULL;
+  offset ^= offset >> 33;
+  offset *= 0xc4ceb9fe1a85ec53ULL;
+  offset ^= offset >> 33;
+  return offset;
+}
+
+// Number of buckets to hold count offsets at most 70% full
+static inline uint64_t checkpoint_index_buckets_for(uint64_t count) {
+  uint64_t needed = count * 10 / (7 * CHECKPOINT_INDEX_WAYS) + 1;
+  uint64_t buckets = 1;
+  while (buckets < needed) buckets <<= 1;
+  return buckets;
+}
+
+static inline size_t checkpoint_index_size(uint64_t bucket_count) {
+  return sizeof(struct checkpoint_index) +
+         bucket_count * sizeof(struct checkpoint_index_bucket);
+}
+
+static inline void checkpoint_index_init(struct checkpoint_index *idx,
+                                         uint64_t bucket_count) {
+  memset(idx, 0, checkpoint_index_size(bucket_count));
+  idx->bucket_count = bucket_count;
+}
+
+// Reference of offset, CHECKPOINT_INDEX_NONE if it is not indexed
+static inline uint32_t checkpoint_index_find(struct checkpoint_index *idx,
+                                             uint64_t offset) {
+  uint64_t mask = idx->bucket_count - 1;
+  uint64_t pos = checkpoint_index_hash(offset) & mask;
+  for (uint64_t probe = 0; probe < idx->bucket_count; probe++) {
+    struct checkpoint_index_bucket *b = &idx->buckets[(pos + probe) & mask];
+    for (uint32_t i = 0; i < b->used; i++)
+      if (b->offset[i] == offset) return b->ref[i];
+    // offsets only move on to the next bucket once this one is full
+    if (b->used < CHECKPOINT_INDEX_WAYS) break;
+  }
+  return CHECKPOINT_INDEX_NONE;
+}
+
+// Index offset or update its reference, returns -1 if the table is full
+static inline int checkpoint_index_insert(struct checkpoint_index *idx,
+                                          uint64_t offset, uint32_t ref) {
+  uint64_t mask = idx->bucket_count - 1;
+  uint64_t pos = checkpoint_index_hash(offset) & mask;
+  for (uint64_t probe = 0; probe < idx->bucket_count; probe++) {
+    struct checkpoint_index_bucket *b = &idx->buckets[(pos + probe) & mask];
+    for (uint32_t i = 0; i < b->used; i++) {
+      if (b->offset[i] == offset) {
+        b->ref[i] = ref;
+        return 0;
+      }
+    }
+    if (b->used < CHECKPOINT_INDEX_WAYS) {
+      b->offset[b->used] = offset;
+      b->ref[b->used] = ref;
+      // publish the slot last
+      b->used++;
+      idx->count++;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* _REACTOR_CHECKPOINT_INDEX_H_ */
@@ -0,0 +1,431 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_CHECKPOINT_LOG_FORMAT_H_
+#define _REACTOR_CHECKPOINT_LOG_FORMAT_H_
+
+// On-media layout of the append-only checkpoint log. Instead of updating
+// hash chains of fixed version slots, a writer appends to a segment file that
+// no other writer touches, so the entries of a segment are in sequence number
+// order and a version is never rewritten. A log may have any number of
+// segments; readers merge them by sequence number. Like addr_trace_format.h, this header only
+// has plain C definitions so that it can be shared by the runtime and the
+// reactor.
+//
+// Segment layout:
+//
+//   +--------------------------+  0
+//   | arthas_ckpt_header       |
+//   +--------------------------+  index_offset
+//   | arthas_ckpt_index_slot[] |  index_slots, sparse offset index
+//   +--------------------------+  entry_offset
+//   | arthas_ckpt_entry[]      |  entry_capacity slots
+//   +--------------------------+  payload_offset
+//   | payload bytes            |  payload_capacity bytes
+//   +--------------------------+
+//
+// Segment slot N is stored at <checkpoint file>.log.N.
+//
+// Most updates change a few bytes of an object (a refcount, a timestamp, a
+// next pointer), so a version whose previous version is in the same segment
+// and has the same size is stored as the byte ranges that differ from it.
+// Every ARTHAS_CKPT_FULL_INTERVAL versions of an offset, or whenever the
+// delta would not be smaller, the version is stored in full, which bounds
+// the work to rebuild a version.
+//
+// Freeing an object appends a tombstone for its offset. Once a segment is
+// full, its writer seals it and moves on to the next free slot number.
+// Sealed segments are never written again, so a compactor may replace them
+// with a copy that only holds the entries still needed, see
+// compact_checkpoint_log.
+//
+// Appending writes the payload and the entry, persists both and then
+// publishes the entry by storing committed (a single 8-byte store), so
+// readers only trust entries below committed.
+//
+// The only state the writers of a log share is the sequence counter, a
+// single word on its own cache line that is bumped with one atomic
+// fetch-and-add per checkpoint, see arthas_ckpt_seq_next. Everything else
+// (segment, index, delta scratch) is owned by one writer. The counter line
+// still moves between the cores of concurrent writers on every checkpoint;
+// it is kept global because the sequence order has to agree with
+// happens-before across threads.
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "ARTHCKP1" in little endian
+#define ARTHAS_CKPT_MAGIC 0x31504b4348545241ULL
+#define ARTHAS_CKPT_VERSION 3
+#define ARTHAS_CKPT_LOG_SUFFIX ".log"
+
+#define ARTHAS_CKPT_NO_ENTRY UINT64_MAX
+// probes before the sparse index gives up on an offset
+#define ARTHAS_CKPT_INDEX_PROBES 8
+
+// how the payload of an entry is stored
+#define ARTHAS_CKPT_FULL 0
+#define ARTHAS_CKPT_DELTA 1
+// the object at offset was freed, the entry has no payload
+#define ARTHAS_CKPT_TOMBSTONE 2
+// at most this many versions in a row are deltas
+#define ARTHAS_CKPT_FULL_INTERVAL 8
+// equal bytes that end a delta run, shorter gaps are cheaper to copy than a
+// new run header
+#define ARTHAS_CKPT_DELTA_GAP 8
+
+// A delta payload is a sequence of runs, each a run header followed by the
+// len bytes at [off, off + len) of the new version
+struct arthas_ckpt_delta_run {
+  uint32_t off;
+  uint32_t len;
+};
+
+struct arthas_ckpt_entry {
+  uint64_t seq;
+  // pool offset of the checkpointed object
+  uint64_t offset;
+  // byte offset of the version's data in the payload area, the size of the
+  // version, and the number of payload bytes it is stored in
+  uint64_t payload;
+  uint64_t size;
+  uint64_t stored;
+  // arthas_trace_clock() when the version was checkpointed, 0 if unknown
+  uint64_t timestamp;
+  // entry number of the previous version of offset in this segment, or
+  // ARTHAS_CKPT_NO_ENTRY if it is not in the index
+  uint64_t prev;
+  int32_t tx_id;
+  int32_t data_type;
+  // ARTHAS_CKPT_FULL, ARTHAS_CKPT_DELTA against the prev entry, or
+  // ARTHAS_CKPT_TOMBSTONE
+  uint32_t encoding;
+  // number of deltas since the last full version, 0 for a full one
+  uint32_t chain;
+};
+
+// Latest entry of a pool offset. The index is sparse: an offset that does
+// not find a free slot within ARTHAS_CKPT_INDEX_PROBES is not indexed and
+// its next version has no prev link.
+struct arthas_ckpt_index_slot {
+  uint64_t offset;
+  // entry number + 1, 0 if the slot is free
+  uint64_t entry;
+};
+
+struct arthas_ckpt_header {
+  uint64_t magic;
+  uint32_t version;
+  // slot number of the segment, N in <checkpoint file>.log.N
+  uint32_t thread;
+  uint64_t index_offset;
+  // number of index slots, a power of two
+  uint64_t index_slots;
+  uint64_t entry_offset;
+  uint64_t entry_capacity;
+  uint64_t payload_offset;
+  uint64_t payload_capacity;
+  // entries in [0, committed) are durable, the payload is allocated
+  // sequentially up to payload_used
+  uint64_t committed;
+  uint64_t payload_used;
+  // sequence numbers of the first and last committed entries
+  uint64_t first_seq;
+  uint64_t last_seq;
+  // set once the runtime stopped appending to the segment
+  uint32_t sealed;
+  // set if the segment was written by the compactor
+  uint32_t compacted;
+};
+
+static inline struct arthas_ckpt_index_slot *arthas_ckpt_index(
+    struct arthas_ckpt_header *hdr) {
+  return (struct arthas_ckpt_index_slot *)((char *)hdr + hdr->index_offset);
+}
+
+static inline struct arthas_ckpt_entry *arthas_ckpt_entries(
+    struct arthas_ckpt_header *hdr) {
+  return (struct arthas_ckpt_entry *)((char *)hdr + hdr->entry_offset);
+}
+
+static inline char *arthas_ckpt_payload(struct arthas_ckpt_header *hdr) {
+  return (char *)hdr + hdr->payload_offset;
+}
+
+// Sequence numbers shared by the writers of a log. Padded to a cache
+// line so that bumping it does not invalidate the neighbouring data.
+struct arthas_ckpt_seq_counter {
+  uint64_t next;
+  char padding[56];
+} __attribute__((aligned(64)));
+
+// Draw the next sequence number. Relaxed is enough: read-modify-writes of
+// one location are totally ordered, so a checkpoint that happens after
+// another one, through any synchronization of the program, gets a larger
+// number, and racing checkpoints have no order to preserve anyway.
+static inline uint64_t arthas_ckpt_seq_next(
+    struct arthas_ckpt_seq_counter *counter) {
+  return __atomic_fetch_add(&counter->next, 1, __ATOMIC_RELAXED);
+}
+
+// The next number that would be drawn, every number below it is taken
+static inline uint64_t arthas_ckpt_seq_peek(
+    struct arthas_ckpt_seq_counter *counter) {
+  return __atomic_load_n(&counter->next, __ATOMIC_RELAXED);
+}
+
+// Offsets of the areas of a segment with the given capacities, each area
+// starts on a cache line. Returns the size of the segment.
+static inline uint64_t arthas_ckpt_layout(uint64_t index_slots,
+                                          uint64_t entry_capacity,
+                                          uint64_t payload_capacity,
+                                          uint64_t *index_offset,
+                                          uint64_t *entry_offset,
+                                          uint64_t *payload_offset) {
+  *index_offset = (sizeof(struct arthas_ckpt_header) + 63) & ~63ULL;
+  *entry_offset =
+      (*index_offset + index_slots * sizeof(struct arthas_ckpt_index_slot) +
+       63) & ~63ULL;
+  *payload_offset =
+      (*entry_offset + entry_capacity * sizeof(struct arthas_ckpt_entry) +
+       63) & ~63ULL;
+  return *payload_offset + payload_capacity;
+}
+
+// Write the header of an empty segment with the given capacities, except
+// for the magic, which the caller stores once the header is durable
+static inline void arthas_ckpt_init(struct arthas_ckpt_header *hdr,
+                                    uint32_t thread, uint64_t index_slots,
+                                    uint64_t entry_capacity,
+                                    uint64_t payload_capacity) {
+  uint64_t index_offset, entry_offset, payload_offset;
+  arthas_ckpt_layout(index_slots, entry_capacity, payload_capacity,
+                     &index_offset, &entry_offset, &payload_offset);
+  memset(hdr, 0, payload_offset);
+  hdr->version = ARTHAS_CKPT_VERSION;
+  hdr->thread = thread;
+  hdr->index_offset = index_offset;
+  hdr->index_slots = index_slots;
+  hdr->entry_offset = entry_offset;
+  hdr->entry_capacity = entry_capacity;
+  hdr->payload_offset = payload_offset;
+  hdr->payload_capacity = payload_capacity;
+}
+
+static inline uint64_t arthas_ckpt_index_hash(struct arthas_ckpt_header *hdr,
+                                              uint64_t offset) {
+  return ((offset * 0x9e3779b97f4a7c15ULL) >> 32) & (hdr->index_slots - 1);
+}
+
+// Latest entry of offset in the segment, ARTHAS_CKPT_NO_ENTRY if unknown
+static inline uint64_t arthas_ckpt_index_find(struct arthas_ckpt_header *hdr,
+                                              uint64_t offset) {
+  struct arthas_ckpt_index_slot *slots = arthas_ckpt_index(hdr);
+  uint64_t pos = arthas_ckpt_index_hash(hdr, offset);
+  for (int i = 0; i < ARTHAS_CKPT_INDEX_PROBES; i++) {
+    struct arthas_ckpt_index_slot *slot =
+        &slots[(pos + i) & (hdr->index_slots - 1)];
+    if (slot->entry == 0) break;
+    if (slot->offset == offset) return slot->entry - 1;
+  }
+  return ARTHAS_CKPT_NO_ENTRY;
+}
+
+// Point the index at the latest entry of offset, returns the slot to
+// persist or 0 if the offset could not be indexed
+static inline struct arthas_ckpt_index_slot *arthas_ckpt_index_update(
+    struct arthas_ckpt_header *hdr, uint64_t offset, uint64_t entry) {
+  struct arthas_ckpt_index_slot *slots = arthas_ckpt_index(hdr);
+  uint64_t pos = arthas_ckpt_index_hash(hdr, offset);
+  for (int i = 0; i < ARTHAS_CKPT_INDEX_PROBES; i++) {
+    struct arthas_ckpt_index_slot *slot =
+        &slots[(pos + i) & (hdr->index_slots - 1)];
+    if (slot->entry == 0 || slot->offset == offset) {
+      slot->offset = offset;
+      slot->entry = entry + 1;
+      return slot;
+    }
+  }
+  return (struct arthas_ckpt_index_slot *)0;
+}
+
+// Encode cur as the byte ranges that differ from prev into out. Returns the
+// encoded size, or 0 if it would not be smaller than cap.
+static inline uint64_t arthas_ckpt_delta_encode(const void *prev,
+                                                const void *cur,
+                                                uint64_t size, void *out,
+                                                uint64_t cap) {
+  const unsigned char *p = (const unsigned char *)prev;
+  const unsigned char *c = (const unsigned char *)cur;
+  unsigned char *o = (unsigned char *)out;
+  uint64_t used = 0, i = 0;
+  if (size > UINT32_MAX) return 0;
+  while (i < size) {
+    if (p[i] == c[i]) {
+      i++;
+      continue;
+    }
+    uint64_t begin = i, end = i + 1, same = 0;
+    for (uint64_t k = end; k < size && same < ARTHAS_CKPT_DELTA_GAP; k++) {
+      if (p[k] == c[k]) {
+        same++;
+      } else {
+        same = 0;
+        end = k + 1;
+      }
+    }
+    struct arthas_ckpt_delta_run run;
+    run.off = (uint32_t)begin;
+    run.len = (uint32_t)(end - begin);
+    if (used + sizeof(run) + run.len >= cap) return 0;
+    memcpy(o + used, &run, sizeof(run));
+    memcpy(o + used + sizeof(run), c + begin, run.len);
+    used += sizeof(run) + run.len;
+    i = end;
+  }
+  // an unchanged version still needs a non-empty payload
+  if (used == 0) {
+    struct arthas_ckpt_delta_run run = {0, 0};
+    if (sizeof(run) >= cap) return 0;
+    memcpy(o, &run, sizeof(run));
+    used = sizeof(run);
+  }
+  return used;
+}
+
+// Apply a delta payload of stored bytes to dst, which holds the previous
+// version
+static inline void arthas_ckpt_delta_apply(void *dst, uint64_t size,
+                                           const void *delta,
+                                           uint64_t stored) {
+  const unsigned char *d = (const unsigned char *)delta;
+  uint64_t used = 0;
+  while (used + sizeof(struct arthas_ckpt_delta_run) <= stored) {
+    struct arthas_ckpt_delta_run run;
+    memcpy(&run, d + used, sizeof(run));
+    used += sizeof(run);
+    if (used + run.len > stored || (uint64_t)run.off + run.len > size) return;
+    memcpy((unsigned char *)dst + run.off, d + used, run.len);
+    used += run.len;
+  }
+}
+
+// Rebuild the version of entry n into out, which has room for its size.
+// Walks back to the last full version, at most ARTHAS_CKPT_FULL_INTERVAL
+// entries.
+static inline void arthas_ckpt_materialize(struct arthas_ckpt_header *hdr,
+                                           uint64_t n, void *out) {
+  struct arthas_ckpt_entry *entries = arthas_ckpt_entries(hdr);
+  uint64_t chain[ARTHAS_CKPT_FULL_INTERVAL];
+  int depth = 0;
+  while (entries[n].encoding == ARTHAS_CKPT_DELTA &&
+         depth < ARTHAS_CKPT_FULL_INTERVAL) {
+    chain[depth++] = n;
+    n = entries[n].prev;
+  }
+  memcpy(out, arthas_ckpt_payload(hdr) + entries[n].payload, entries[n].size);
+  while (depth > 0) {
+    struct arthas_ckpt_entry *e = &entries[chain[--depth]];
+    arthas_ckpt_delta_apply(out, e->size, arthas_ckpt_payload(hdr) + e->payload,
+                            e->stored);
+  }
+}
+
+// Write a new version of offset to the segment without publishing it.
+// Returns the entry number, or ARTHAS_CKPT_NO_ENTRY if the segment is full.
+// The caller persists the entry and its payload, publishes it with
+// arthas_ckpt_commit, and then updates the index.
+//
+// If scratch is not NULL it has room for size bytes, and the version is
+// stored as a delta against the previous one when that pays off.
+static inline uint64_t arthas_ckpt_append(struct arthas_ckpt_header *hdr,
+                                          uint64_t seq, uint64_t offset,
+                                          const void *data, uint64_t size,
+                                          int32_t tx_id, int32_t data_type,
+                                          uint64_t timestamp, void *scratch) {
+  uint64_t n = hdr->committed;
+  uint64_t payload = (hdr->payload_used + 7) & ~7ULL;
+  if (n >= hdr->entry_capacity || payload > hdr->payload_capacity)
+    return ARTHAS_CKPT_NO_ENTRY;
+  uint64_t room = hdr->payload_capacity - payload;
+  struct arthas_ckpt_entry *e = &arthas_ckpt_entries(hdr)[n];
+  e->prev = arthas_ckpt_index_find(hdr, offset);
+  e->encoding = ARTHAS_CKPT_FULL;
+  e->chain = 0;
+  e->stored = size;
+  if (scratch && e->prev != ARTHAS_CKPT_NO_ENTRY) {
+    struct arthas_ckpt_entry *prev = &arthas_ckpt_entries(hdr)[e->prev];
+    if (prev->encoding != ARTHAS_CKPT_TOMBSTONE && prev->size == size &&
+        prev->chain + 1 < ARTHAS_CKPT_FULL_INTERVAL) {
+      arthas_ckpt_materialize(hdr, e->prev, scratch);
+      uint64_t cap = size < room ? size : room;
+      uint64_t stored = arthas_ckpt_delta_encode(
+          scratch, data, size, arthas_ckpt_payload(hdr) + payload, cap);
+      if (stored) {
+        e->encoding = ARTHAS_CKPT_DELTA;
+        e->chain = prev->chain + 1;
+        e->stored = stored;
+      }
+    }
+  }
+  if (e->encoding == ARTHAS_CKPT_FULL) {
+    if (size > room) return ARTHAS_CKPT_NO_ENTRY;
+    memcpy(arthas_ckpt_payload(hdr) + payload, data, size);
+  }
+  e->seq = seq;
+  e->offset = offset;
+  e->payload = payload;
+  e->size = size;
+  e->timestamp = timestamp;
+  e->tx_id = tx_id;
+  e->data_type = data_type;
+  hdr->payload_used = payload + e->stored;
+  return n;
+}
+
+// Write a tombstone for offset without publishing it, like
+// arthas_ckpt_append
+static inline uint64_t arthas_ckpt_append_tombstone(
+    struct arthas_ckpt_header *hdr, uint64_t seq, uint64_t offset,
+    int32_t tx_id, uint64_t timestamp) {
+  uint64_t n = hdr->committed;
+  if (n >= hdr->entry_capacity) return ARTHAS_CKPT_NO_ENTRY;
+  struct arthas_ckpt_entry *e = &arthas_ckpt_entries(hdr)[n];
+  e->seq = seq;
+  e->offset = offset;
+  e->payload = 0;
+  e->size = 0;
+  e->stored = 0;
+  e->timestamp = timestamp;
+  e->prev = arthas_ckpt_index_find(hdr, offset);
+  e->tx_id = tx_id;
+  e->data_type = 0;
+  e->encoding = ARTHAS_CKPT_TOMBSTONE;
+  e->chain = 0;
+  return n;
+}
+
+// Publish the entries up to and including entry n, the caller persists the
+// header fields afterwards
+static inline void arthas_ckpt_commit(struct arthas_ckpt_header *hdr,
+                                      uint64_t n) {
+  struct arthas_ckpt_entry *e = &arthas_ckpt_entries(hdr)[n];
+  if (hdr->committed == 0) hdr->first_seq = e->seq;
+  hdr->last_seq = e->seq;
+  hdr->committed = n + 1;
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* _REACTOR_CHECKPOINT_LOG_FORMAT_H_ */
@@ -32,8 +32,11 @@
 #include "Utils/LLVM.h"
 #include "Utils/String.h"
 #include "checkpoint.h"
+#include "overlay.h"
 #include "reactor-opts.h"
 #include "rollback.h"
+#include "snapshot.h"
+#include "validator.h"
 
 #include "llvm/Support/FileSystem.h"
 
@@ -52,7 +55,7 @@ class ReactorState {
       : mode(ReactorMode::STANDALONE), ready(false), sys_module(nullptr),
         llvm_context(std::move(ctx)), dependency_computed(false),
         computing_dependency(false), trace_ready(false), trace_processed(false),
-        processing_trace(false) {}
+        processing_trace(false), c_log(nullptr) {}
 
   ~ReactorState() {
     if (sys_module) delete sys_module.release();
@@ -74,6 +77,8 @@ class ReactorState {
   bool trace_ready;
   bool trace_processed;
   bool processing_trace;
+  // checkpoint log reconstructed ahead of time in standalone mode
+  struct checkpoint_log *c_log;
 };
 
 class Reactor {
@@ -86,14 +91,13 @@ class Reactor {
   llvm::Instruction *locate_fault_instr(std::string &fault_loc,
                                         std::string &inst_str);
   bool monitor_address_trace();
+  bool monitor_trace_segment();
   bool wait_address_trace_ready();
 
   bool prepare(int argc, char *argv[], bool server);
   void seq_log_creation(seq_log * &s_log, size_t * &total_size,
-                        seq_log * &r_log, struct checkpoint_log *c_log);
-  void tx_log_creation(tx_log *t_log, struct checkpoint_log *c_log);
-  void offset_seq_creation(std::multimap<uint64_t, int> &offset_seq_map,
-                struct checkpoint_log *c_log, seq_log * &s_log);
+                        seq_log * &r_log, struct checkpoint_log *c_log,
+                        tx_index *t_index = NULL);
   bool react(std::string fault_loc, std::string inst_str,
              reaction_result *result);
   ReactorState *get_state() { return _state.get(); }
@@ -121,9 +125,6 @@ class PmemAddrOffsetList {
   uint64_t *offsets;
   void **addresses;
   void **pmem_addresses;
-
-  void **sorted_addresses;
-  void **sorted_pmem_addresses;
 };
 
 }  // namespace arthas
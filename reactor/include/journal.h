@@ -0,0 +1,92 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_JOURNAL_H_
+#define _REACTOR_JOURNAL_H_
+
+// Persistent reversion journal. Every reversion trial records the
+// before-image (pool offset and bytes) of each location it is about to
+// overwrite, and the images are durable before the pool is written. This
+// gives the reactor:
+//
+//  - O(k) undo of the innermost trial by restoring its k images in reverse,
+//  - nested trials, e.g., for bisection: committing a trial merges its
+//    images into the enclosing one, so undoing the parent still restores
+//    everything,
+//  - crash safety: trials still open when the reactor died are undone by
+//    journal_recover. Undo only truncates the journal after the restored
+//    bytes are durable, so replaying it after another crash is idempotent.
+//
+// Images are stored by pool offset, so the pool may be closed and reopened
+// at a different base between recording and undo.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "ARTHJRN1" in little endian
+#define JOURNAL_MAGIC 0x314e524a48545241ULL
+#define JOURNAL_VERSION 1
+#define JOURNAL_DEFAULT_SIZE (64UL << 20)
+#define JOURNAL_SUFFIX ".journal"
+
+#define JOURNAL_TRIAL 1
+#define JOURNAL_MERGED 2
+#define JOURNAL_IMAGE 3
+
+struct journal_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t padding;
+  uint64_t capacity;
+  // offset of the last published entry, 0 if the journal is empty. Entries
+  // past it are ignored, which makes publishing a single 8-byte store.
+  uint64_t last;
+};
+
+struct journal_entry {
+  uint32_t type;
+  uint32_t padding;
+  // offset of the previous entry, 0 for the first one
+  uint64_t prev;
+  // pool offset and size of the before-image that follows the entry
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct reversion_journal {
+  struct journal_header *hdr;
+  size_t mapped_len;
+  int is_pmem;
+  // offset of the last appended entry and the end of the appended entries,
+  // published or not
+  uint64_t appended;
+  uint64_t tail;
+  // number of open trials
+  int depth;
+};
+
+struct reversion_journal *journal_open(const char *path, size_t size);
+void journal_close(struct reversion_journal *j);
+
+int journal_begin_trial(struct reversion_journal *j);
+int journal_record(struct reversion_journal *j, void *pool_base,
+                   void *pmem_address, size_t size);
+void journal_publish(struct reversion_journal *j);
+int journal_undo_trial(struct reversion_journal *j, void *pool_base);
+int journal_commit_trial(struct reversion_journal *j);
+int journal_recover(struct reversion_journal *j, void *pool_base);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REACTOR_JOURNAL_H_ */
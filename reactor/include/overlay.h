@@ -0,0 +1,79 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_OVERLAY_H_
+#define _REACTOR_OVERLAY_H_
+
+// Read-only view of a pool as of a sequence number, without touching the
+// pool file. The file is mapped privately and every offset written after
+// the sequence number is overlaid with its version at that point, the same
+// bytes a reversion of the newer sequence numbers would write.
+//
+// Pages are built on first access. The pages that have versions to overlay
+// are mapped PROT_NONE until then, and a SIGSEGV handler (chained to the
+// previous one) builds a page when it is read, so the view can be walked
+// through pointers like the live pool. pool_overlay_read builds the pages of
+// a range up front instead. Pages without versions to overlay read through
+// to the file. Writes to the view stay private to it.
+//
+// A view is used from one thread at a time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "checkpoint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A range of the view overlaid with a checkpoint version
+struct overlay_patch {
+  uint64_t offset;
+  size_t size;
+  const void *data;
+};
+
+// A patch overlapping a page, sorted by page
+struct overlay_page_ref {
+  uint64_t page;
+  uint32_t patch;
+};
+
+typedef struct pool_overlay {
+  char *base;
+  size_t size;
+  int64_t seq;
+  struct overlay_patch *patches;
+  size_t patch_count;
+  struct overlay_page_ref *refs;
+  size_t ref_count;
+  // pages with refs, and the pages built so far
+  size_t overlaid_pages;
+  uint8_t *built;
+  size_t built_count;
+  size_t page_count;
+  struct pool_overlay *next;
+} pool_overlay;
+
+// View of the pool file as of seq, from the versions in s_log and c_log.
+// NULL on failure.
+pool_overlay *pool_overlay_open(const char *pool_path, seq_log *s_log,
+                                struct checkpoint_log *c_log, int64_t seq);
+// Pointer to [offset, offset + len) of the view with its pages built, NULL
+// if the range is outside the pool
+const void *pool_overlay_read(pool_overlay *ov, uint64_t offset, size_t len);
+// Number of patches whose bytes differ from the pool mapped at live_base,
+// i.e., the writes a reversion to the view's sequence number would make
+size_t pool_overlay_changes(const pool_overlay *ov, const void *live_base);
+void pool_overlay_close(pool_overlay *ov);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REACTOR_OVERLAY_H_ */
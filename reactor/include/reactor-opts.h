@@ -10,6 +10,7 @@
 #define _REACTOR_OPTS_H_
 
 #include <string>
+#include "reexec.h"
 
 typedef struct dg_options {
   // only analyzing the function that a fault instruction belongs to.
@@ -30,6 +31,14 @@ typedef struct dg_options {
   bool inter_procedural;
 } dg_options_t;
 
+// arckpt modes: revert the newest sequence numbers one, batch_threshold or
+// an exponentially growing number at a time
+#define ARCKPT_NONE 0
+#define ARCKPT_LINEAR 1
+#define ARCKPT_BATCH 2
+#define ARCKPT_GALLOP 3
+#define ARCKPT_DEFAULT_BATCH 100000
+
 typedef struct reactor_options {
   /* argument options */
   const char *address_file;
@@ -39,9 +48,30 @@ typedef struct reactor_options {
   const char *pmem_library;
   const char *hook_guid_file;
   const char *reexecute_cmd;
-  bool arckpt;
+  // ARCKPT_* search over the newest sequence numbers, see --arckpt
+  int arckpt;
   int batch_threshold;
+  // revert the whole transactions of the candidates
+  bool tx_reversion;
+  // versions kept per variable (0 for the default), and bytes of version
+  // history to keep in total (0 for no limit)
+  size_t history_depth;
+  size_t history_budget;
   int version_num;
+  // only consider candidates checkpointed within this many milliseconds
+  // before the fault, 0 to consider all of them
+  unsigned long candidate_window_ms;
+  // directory of the pool snapshots arckpt restores bulk reversions from,
+  // NULL to always revert backwards
+  const char *snapshot_dir;
+  // plugin that validates trials on the pool state, and its argument
+  const char *validator_plugin;
+  const char *validator_arg;
+  // output that marks a failed re-execution, besides the fault location
+  const char *fail_signatures[REEXEC_MAX_SIGNATURES];
+  int fail_signature_count;
+  // kill re-executions after this many milliseconds, 0 for no deadline
+  unsigned long deadline_ms;
 
   // string representation of the fault instruction
   std::string fault_instr;
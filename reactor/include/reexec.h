@@ -0,0 +1,56 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_REEXEC_H_
+#define _REACTOR_REEXEC_H_
+
+// Re-execution driver. The command runs under /bin/sh in its own process
+// group with stdout and stderr captured. The output is passed through to
+// the reactor's stdout and matched line by line against the failure
+// signatures, e.g., the fault location the detector reported or a log
+// message. The whole group is killed as soon as a signature shows up or the
+// deadline passes. A failing trial usually shows its failure long before a
+// passing one finishes its workload, so most trials of a bisection end
+// early.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REEXEC_MAX_SIGNATURES 16
+// longest output line that is matched as a whole, longer ones are matched
+// in pieces
+#define REEXEC_LINE_MAX 4096
+
+// outcomes of reexec_run
+#define REEXEC_PASSED 0
+// exited with a non-zero status or died of a signal
+#define REEXEC_FAILED 1
+#define REEXEC_SIGNATURE 2
+#define REEXEC_DEADLINE 3
+
+struct reexec_config {
+  const char *signatures[REEXEC_MAX_SIGNATURES];
+  int signature_count;
+  // kill the trial after this many milliseconds, 0 for no deadline
+  unsigned long deadline_ms;
+};
+
+// Configuration of the re-executions run by re_execute
+void reexec_configure(const struct reexec_config *config);
+// Run cmd to completion, a signature match or the deadline
+int reexec_run(const char *cmd, const struct reexec_config *config);
+const struct reexec_config *reexec_current_config(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REACTOR_REEXEC_H_ */
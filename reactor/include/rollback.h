@@ -11,6 +11,8 @@
 
 #include <unistd.h>
 #include "checkpoint.h"
+#include "journal.h"
+#include "reexec.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,6 +28,34 @@ extern "C" {
 extern int coarse_grained_tries;
 extern int fine_grained_tries;
 
+// A single write of a reversion batch
+struct revert_write {
+  // destination in the live pool and the target version's bytes
+  void *pmem_address;
+  const void *data;
+  size_t size;
+  // sequence number of the reverted entry, among writes to the same
+  // address the one with the lowest sequence number (the oldest target
+  // version) wins
+  int64_t sequence_number;
+};
+
+// Reversion writes collected for one trial, applied at once by
+// revert_batch_apply
+typedef struct revert_batch {
+  struct revert_write *writes;
+  size_t count;
+  size_t capacity;
+} revert_batch;
+
+void revert_batch_init(revert_batch *batch);
+void revert_batch_add(revert_batch *batch, void *pmem_address,
+                      const void *data, size_t size, int64_t seq_num);
+size_t revert_batch_merge(revert_batch *batch);
+size_t revert_batch_drop_noops(revert_batch *batch);
+size_t revert_batch_apply(revert_batch *batch);
+void revert_batch_free(revert_batch *batch);
+
 void coarse_grain_reversion(void **addresses, struct checkpoint_log *c_log,
                             void **pmem_addresses, int version_num,
                             int num_data, uint64_t *offsets);
@@ -36,8 +66,7 @@ PMEMobjpool *redo_pmem_addresses(const char *path, const char *layout,
 int re_execute(const char *rexecution_cmd, int version_num,
                struct checkpoint_log *c_log, int num_data,
                const char *path, const char *layout,
-               int reversion_type, int seq_num,
-               void *old_pop, seq_log *s_log);
+               int reversion_type, int64_t seq_num, seq_log *s_log);
 
 void revert_by_address(const void *search_address, const void *address,
                        int variable_index, int version, int type, size_t size,
@@ -46,7 +75,7 @@ void revert_by_address(const void *search_address, const void *address,
 int search_for_address(const void *address, size_t size,
                        struct checkpoint_log *c_log);
 
-void revert_by_sequence_number(single_data search_data, int seq_num,
+void revert_by_sequence_number(single_data search_data, int64_t seq_num,
                                int rollback_version, seq_log *s_log);
 
 void revert_by_offset(uint64_t search_offset, const void *address,
@@ -61,30 +90,39 @@ void revert_by_sequence_number_checkpoint(checkpoint_data old_check_data,
                                           int rollback_version,
                                           single_data search_data);
 
-void sort_by_sequence_number(void **addresses, size_t total_size, int num_data,
-                             void **pmem_addresses,
-                             void **sorted_pmem_addresses, uint64_t *offsets,
-                             seq_log *s_log);
-
-void seq_coarse_grain_reversion(int seq_num, void *pop, void *old_pop,
-                                struct checkpoint_log *c_log, seq_log *s_log);
+const void *revert_target_version(const single_data *entry,
+                                  struct checkpoint_log *c_log, size_t *size);
 
-void revert_by_sequence_number_array(seq_log *s_log, int *seq_numbers,
-                                     int total_seq_num,
+void revert_by_sequence_number_batch(revert_batch *batch, seq_log *s_log,
+                                     int64_t *seq_numbers, int total_seq_num,
                                      struct checkpoint_log *c_log);
 
+void seq_coarse_grain_reversion(int64_t seq_num, struct checkpoint_log *c_log,
+                                seq_log *s_log);
+
+size_t revert_by_sequence_number_array(seq_log *s_log, int64_t *seq_numbers,
+                                       int total_seq_num,
+                                       struct checkpoint_log *c_log);
+
+int revert_by_sequence_number_journaled(struct reversion_journal *j,
+                                        void *pool_base, seq_log *s_log,
+                                        int64_t *seq_numbers, int total_seq_num,
+                                        struct checkpoint_log *c_log);
+
 int reverse_cmpfunc(const void *a, const void *b);
 
-void decision_func_sequence_array(int *old_seq_numbers, int old_total,
-                                  int *new_seq_numbers, int *new_total);
+void decision_func_sequence_array(int64_t *old_seq_numbers, int old_total,
+                                  int64_t *new_seq_numbers, int *new_total);
 
-void revert_by_sequence_number_nonslice(void *old_pop, single_data ordered_data,
-                                        int seq_num, int rollback_version,
-                                        void *pop);
+void revert_by_sequence_number_nonslice(single_data ordered_data,
+                                        int64_t seq_num, int rollback_version);
 
-void undo_by_sequence_number(single_data search_data, int seq_num);
-void revert_by_transaction(void **sorted_pmem_addresses, struct tx_log *t_log,
-                           int *seq_numbers, int total_seq_num, seq_log *s_log);
+void undo_by_sequence_number(single_data search_data, int64_t seq_num);
+int tx_closure(tx_index *t_index, seq_log *s_log, int64_t *seq_numbers,
+               int total_seq_num, int64_t **closure);
+size_t revert_by_transaction(tx_index *t_index, seq_log *s_log,
+                             int64_t *seq_numbers, int total_seq_num,
+                             struct checkpoint_log *c_log);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,80 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_SNAPSHOT_H_
+#define _REACTOR_SNAPSHOT_H_
+
+// Pool snapshots for bulk reversions. A snapshot is a copy of the pmem file,
+// taken with a reflink (FICLONE) where the file system supports it and as a
+// sparse copy of the data extents otherwise. It is tagged with the newest
+// checkpoint sequence number before and after the copy:
+//
+//   <dir>/<pool file name>.snap.<begin>.<end>
+//
+// The copy holds every write up to begin, and writes in (begin, end] may or
+// may not have made it. Restoring the pool as of sequence S >= begin clones
+// the snapshot over the pool and then replays, for every offset with a
+// version in (begin, max(S, end)], its newest version at or before S. The
+// cost is the distance from the snapshot, however many sequence numbers
+// the reversion covers.
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "checkpoint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SNAPSHOT_SUFFIX ".snap"
+// snapshot of the pool right before a restore, to undo it
+#define SNAPSHOT_UNDO_SUFFIX ".snap.undo"
+// bytes of the pool copied in about the time it takes to revert a version
+#define SNAPSHOT_BYTES_PER_VERSION 4096
+
+struct pool_snapshot {
+  char path[PATH_MAX];
+  int64_t begin;
+  int64_t end;
+};
+
+// Copy src to dst, by reflink if possible. dst is written in place, so an
+// open mapping of it sees the new content.
+int snapshot_clone_file(const char *src, const char *dst);
+
+// Snapshot the pool into dir (the pool's directory if NULL). The checkpoint
+// log at log_base is read before and after the copy to tag it, -1 if there
+// is no checkpoint log.
+int snapshot_take(const char *pool_path, const char *dir,
+                  const char *log_base, struct pool_snapshot *snap);
+// The snapshot with the newest begin at or before seq, -1 if there is none
+int snapshot_find(const char *pool_path, const char *dir, int64_t seq,
+                  struct pool_snapshot *snap);
+// Delete all but the keep newest snapshots of the pool, returns the number
+// deleted
+int snapshot_prune(const char *pool_path, const char *dir, int keep);
+
+// Cost of restoring the pool as of seq from the snapshot, in reverted
+// versions: the replayed range plus cloning the pool twice, once to undo
+// the restore and once from the snapshot. INT64_MAX if it cannot be used.
+int64_t snapshot_restore_cost(const struct pool_snapshot *snap,
+                              const char *pool_path, int64_t seq);
+
+// Replay the versions up to seq onto the pool after the snapshot was
+// cloned over it. The clone has to be made while the pool is not mapped;
+// the replay writes through the mapping at the base set by set_pool_base.
+// Returns the number of replayed versions, -1 on failure.
+long snapshot_restore(const struct pool_snapshot *snap, seq_log *s_log,
+                      struct checkpoint_log *c_log, int64_t seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REACTOR_SNAPSHOT_H_ */
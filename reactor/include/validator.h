@@ -0,0 +1,83 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _REACTOR_VALIDATOR_H_
+#define _REACTOR_VALIDATOR_H_
+
+// In-process validation of reversion trials. A validator is a shared object
+// that checks the fault directly on the pool state, e.g., that hash chains
+// are consistent or reference counts match, instead of restarting the target
+// and replaying a workload. The reactor loads it with --validator and calls
+// it on every trial before re-executing; only an inconclusive verdict falls
+// back to re-execution.
+//
+// A plugin exports
+//
+//   int arthas_validate(const struct arthas_validation *v);
+//
+// returning one of the ARTHAS_VALIDATION_* verdicts, and optionally
+//
+//   int arthas_validator_init(const char *arg);  // non-zero to refuse
+//   void arthas_validator_fini(void);
+//
+// The pool is only readable for the duration of the call and may be a view
+// (overlay.h) rather than the live pool, so the plugin must not keep
+// pointers into it or write to it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARTHAS_VALIDATION_FAIL 0
+#define ARTHAS_VALIDATION_PASS 1
+// the plugin cannot tell, re-execute the target
+#define ARTHAS_VALIDATION_INCONCLUSIVE 2
+
+#define ARTHAS_VALIDATOR_INIT "arthas_validator_init"
+#define ARTHAS_VALIDATOR_VALIDATE "arthas_validate"
+#define ARTHAS_VALIDATOR_FINI "arthas_validator_fini"
+
+struct arthas_validation {
+  // the pool mapping, offsets in the checkpoint log are relative to it
+  const void *pool_base;
+  size_t pool_size;
+  const char *pool_path;
+  // layout of a libpmemobj pool, NULL for libpmem
+  const char *layout;
+  // sequence number the pool is reverted to, -1 if the trial is not a
+  // suffix of the sequence numbers
+  int64_t seq;
+};
+
+typedef int (*arthas_validator_init_fn)(const char *arg);
+typedef int (*arthas_validate_fn)(const struct arthas_validation *v);
+typedef void (*arthas_validator_fini_fn)(void);
+
+struct validator {
+  void *handle;
+  arthas_validate_fn validate;
+  arthas_validator_fini_fn fini;
+  // verdicts so far, by ARTHAS_VALIDATION_*
+  unsigned long verdicts[3];
+};
+
+// Load the plugin at path and initialize it with arg, NULL on failure
+struct validator *validator_load(const char *path, const char *arg);
+// Verdict of the plugin on the pool, ARTHAS_VALIDATION_INCONCLUSIVE if it
+// returns anything else
+int validator_run(struct validator *v, const struct arthas_validation *args);
+void validator_unload(struct validator *v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REACTOR_VALIDATOR_H_ */
@@ -8,10 +8,751 @@
 
 #include "checkpoint.h"
 
+#include <dirent.h>
+#include <unistd.h>
+#include "checkpoint_index.h"
+#include "checkpoint_log_format.h"
+
+// A mapped segment of the append-only checkpoint log
+struct ckpt_segment {
+  char *path;
+  struct arthas_ckpt_header *hdr;
+  size_t mapped_len;
+  // next entry to merge
+  uint64_t next;
+  // the data of every merged entry, rebuilt for delta entries
+  void **versions;
+};
+
+// Data of entry n of the segment, NULL if it cannot be rebuilt. Entries are
+// merged in order and a delta is always against an earlier entry of its
+// segment, so the previous version is already rebuilt and a delta costs one
+// copy.
+static void *checkpoint_segment_version(struct ckpt_segment *seg, uint64_t n) {
+  struct arthas_ckpt_entry *e = &arthas_ckpt_entries(seg->hdr)[n];
+  char *payload = arthas_ckpt_payload(seg->hdr) + e->payload;
+  if (e->encoding != ARTHAS_CKPT_DELTA) {
+    // the payload stays mapped for as long as the reactor runs
+    seg->versions[n] = payload;
+    return payload;
+  }
+  // a delta against a later entry is corrupted
+  if (e->prev >= n || !seg->versions[e->prev]) return NULL;
+  void *data = malloc(e->size);
+  if (!data) return NULL;
+  memcpy(data, seg->versions[e->prev], e->size);
+  arthas_ckpt_delta_apply(data, e->size, payload, e->stored);
+  seg->versions[n] = data;
+  return data;
+}
+
+static struct ckpt_segment *open_checkpoint_segments(const char *base,
+                                                     int *count) {
+  char dir_path[PATH_MAX];
+  const char *name = strrchr(base, '/');
+  if (name) {
+    snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(name - base), base);
+    name++;
+  } else {
+    strcpy(dir_path, ".");
+    name = base;
+  }
+  *count = 0;
+  DIR *dir = opendir(dir_path[0] ? dir_path : "/");
+  if (!dir) return NULL;
+  struct ckpt_segment *segments = NULL;
+  size_t name_len = strlen(name);
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    // <base>.<segment slot>
+    if (strncmp(ent->d_name, name, name_len) != 0 ||
+        ent->d_name[name_len] != '.')
+      continue;
+    char *end;
+    strtoul(ent->d_name + name_len + 1, &end, 10);
+    if (end == ent->d_name + name_len + 1 || *end != '\0') continue;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir_path[0] ? dir_path : "",
+             ent->d_name);
+    size_t mapped_len;
+    int is_pmem;
+    struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)
+        pmem_map_file(path, 0, 0, 0, &mapped_len, &is_pmem);
+    if (!hdr) continue;
+    if (mapped_len < sizeof(struct arthas_ckpt_header) ||
+        hdr->magic != ARTHAS_CKPT_MAGIC ||
+        hdr->version != ARTHAS_CKPT_VERSION ||
+        hdr->entry_offset + hdr->entry_capacity *
+                                sizeof(struct arthas_ckpt_entry) >
+            mapped_len ||
+        hdr->payload_offset + hdr->payload_capacity > mapped_len ||
+        hdr->committed > hdr->entry_capacity) {
+      fprintf(stderr, "%s is not a valid checkpoint log segment\n", path);
+      pmem_unmap(hdr, mapped_len);
+      continue;
+    }
+    segments = (struct ckpt_segment *)realloc(
+        segments, sizeof(struct ckpt_segment) * (*count + 1));
+    segments[*count].path = strdup(path);
+    segments[*count].hdr = hdr;
+    segments[*count].mapped_len = mapped_len;
+    segments[*count].next = 0;
+    segments[*count].versions =
+        (void **)calloc(hdr->committed + 1, sizeof(void *));
+    (*count)++;
+  }
+  closedir(dir);
+  return segments;
+}
+
+// Add the entry as the newest version of its offset, dropping the oldest
+// version once all MAX_VERSIONS slots are used like the runtime does, and
+// all of them if the entry is 2^32 or more sequence numbers newer. The
+// version history still has the dropped versions.
+static void checkpoint_log_add_version(struct checkpoint_log *c_log,
+                                       struct arthas_ckpt_entry *e,
+                                       void *data) {
+  int pos = (int)(e->offset % c_log->size);
+  struct node *temp = c_log->list[pos];
+  while (temp && temp->offset != e->offset) temp = temp->next;
+  int v;
+  if (!temp) {
+    temp = (struct node *)calloc(1, sizeof(struct node));
+    temp->offset = e->offset;
+    temp->c_data.offset = e->offset;
+    temp->next = c_log->list[pos];
+    c_log->list[pos] = temp;
+    c_log->variable_count++;
+    v = 0;
+  } else if (checkpoint_data_new_chain(&temp->c_data, (int64_t)e->seq)) {
+    v = 0;
+  } else if (temp->c_data.version == MAX_VERSIONS - 1) {
+    checkpoint_data *c_data = &temp->c_data;
+    for (int j = 0; j < MAX_VERSIONS - 1; j++) {
+      c_data->data[j] = c_data->data[j + 1];
+      c_data->size[j] = c_data->size[j + 1];
+      c_data->sequence_number[j] = c_data->sequence_number[j + 1];
+      c_data->tx_id[j] = c_data->tx_id[j + 1];
+    }
+    v = MAX_VERSIONS - 1;
+  } else {
+    v = temp->c_data.version + 1;
+  }
+  checkpoint_data *c_data = &temp->c_data;
+  c_data->version = v;
+  c_data->data_type = e->data_type;
+  c_data->data[v] = data;
+  // the offset was allocated again
+  c_data->free_flag = 0;
+  c_data->size[v] = e->size;
+  checkpoint_data_set_seq(c_data, v, (int64_t)e->seq);
+  c_data->tx_id[v] = e->tx_id;
+}
+
+// Mark the object of a tombstone as freed, its versions stay revertible
+static void checkpoint_log_free(struct checkpoint_log *c_log,
+                                struct arthas_ckpt_entry *e) {
+  struct node *temp = c_log->list[e->offset % c_log->size];
+  while (temp && temp->offset != e->offset) temp = temp->next;
+  if (temp) temp->c_data.free_flag = 1;
+}
+
+// Offset index of the most recently reconstructed checkpoint log, the
+// references are positions in offset_index_nodes
+static struct checkpoint_log *offset_index_log = NULL;
+static struct checkpoint_index *offset_index = NULL;
+static struct node **offset_index_nodes = NULL;
+
+static void build_offset_index(struct checkpoint_log *c_log) {
+  size_t count = 0;
+  for (size_t i = 0; i < c_log->size; i++)
+    for (struct node *temp = c_log->list[i]; temp; temp = temp->next) count++;
+  free(offset_index);
+  free(offset_index_nodes);
+  uint64_t buckets = checkpoint_index_buckets_for(count);
+  // the buckets are cache-line aligned
+  if (posix_memalign((void **)&offset_index, 64,
+                     checkpoint_index_size(buckets)) != 0)
+    offset_index = NULL;
+  offset_index_nodes = (struct node **)malloc(sizeof(struct node *) *
+                                              (count + 1));
+  if (!offset_index || !offset_index_nodes) {
+    fprintf(stderr, "failed to allocate the checkpoint offset index\n");
+    free(offset_index);
+    free(offset_index_nodes);
+    offset_index = NULL;
+    offset_index_nodes = NULL;
+    offset_index_log = NULL;
+    return;
+  }
+  checkpoint_index_init(offset_index, buckets);
+  uint32_t ref = 0;
+  for (size_t i = 0; i < c_log->size; i++) {
+    for (struct node *temp = c_log->list[i]; temp; temp = temp->next) {
+      offset_index_nodes[ref] = temp;
+      checkpoint_index_insert(offset_index, temp->offset, ref);
+      ref++;
+    }
+  }
+  offset_index_log = c_log;
+}
+
+// Node of the offset in the checkpoint log, NULL if it was not checkpointed
+struct node *checkpoint_find_node(struct checkpoint_log *c_log,
+                                  uint64_t offset) {
+  if (c_log == offset_index_log) {
+    uint32_t ref = checkpoint_index_find(offset_index, offset);
+    return ref == CHECKPOINT_INDEX_NONE ? NULL : offset_index_nodes[ref];
+  }
+  // not indexed, walk the hash chain the runtime built
+  struct node *temp = c_log->list[offset % c_log->size];
+  while (temp && temp->offset != offset) temp = temp->next;
+  return temp;
+}
+
+// Per-variable version history, parallel to offset_index_nodes. Each chain
+// is a ring of the variable's versions in sequence order: a new version goes
+// after the newest one and, once the chain is at history_depth, replaces the
+// oldest one in place. When the versions of all chains exceed
+// history_budget bytes, the oldest versions of the variables holding the
+// most bytes are evicted first, always keeping the newest version of a
+// chain.
+static struct version_chain *version_chains = NULL;
+static size_t version_chain_count = 0;
+static size_t history_depth = CHECKPOINT_DEFAULT_DEPTH;
+static size_t history_budget = 0;
+static size_t history_bytes = 0;
+// max-heap of chain references by bytes held, for eviction
+static uint32_t *history_heap = NULL;
+static uint32_t *history_heap_pos = NULL;
+static size_t history_heap_size = 0;
+
+#define HEAP_NONE UINT32_MAX
+
+void set_checkpoint_history(size_t depth, size_t budget) {
+  history_depth = depth > 0 ? depth : CHECKPOINT_DEFAULT_DEPTH;
+  history_budget = budget;
+}
+
+static void history_heap_swap(size_t i, size_t j) {
+  uint32_t ref = history_heap[i];
+  history_heap[i] = history_heap[j];
+  history_heap[j] = ref;
+  history_heap_pos[history_heap[i]] = i;
+  history_heap_pos[history_heap[j]] = j;
+}
+
+static int history_heap_less(size_t i, size_t j) {
+  return version_chains[history_heap[i]].bytes <
+         version_chains[history_heap[j]].bytes;
+}
+
+static void history_heap_up(size_t i) {
+  while (i > 0 && history_heap_less((i - 1) / 2, i)) {
+    history_heap_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void history_heap_down(size_t i) {
+  for (;;) {
+    size_t largest = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < history_heap_size && history_heap_less(largest, l)) largest = l;
+    if (r < history_heap_size && history_heap_less(largest, r)) largest = r;
+    if (largest == i) return;
+    history_heap_swap(i, largest);
+    i = largest;
+  }
+}
+
+// Free the data of an evicted version. A rebuilt version may also be the
+// oldest one in the node's slots, which then drops it as well so that it
+// never points to freed data.
+static void history_release(uint32_t ref, struct version_ref *v) {
+  if (!v->owned) return;
+  checkpoint_data *c_data = &offset_index_nodes[ref]->c_data;
+  if (c_data->data[0] == v->data) {
+    // the newest version is never evicted, so the node has a later one
+    if (c_data->version == 0) return;
+    for (int j = 0; j < c_data->version; j++) {
+      c_data->data[j] = c_data->data[j + 1];
+      c_data->size[j] = c_data->size[j + 1];
+      c_data->sequence_number[j] = c_data->sequence_number[j + 1];
+      c_data->tx_id[j] = c_data->tx_id[j + 1];
+    }
+    c_data->version--;
+  }
+  free((void *)v->data);
+  v->data = NULL;
+}
+
+// Drop the oldest version of the chain
+static void history_evict_oldest(uint32_t ref) {
+  struct version_chain *chain = &version_chains[ref];
+  struct version_ref *v = &chain->ring[chain->head];
+  history_bytes -= v->size;
+  chain->bytes -= v->size;
+  history_release(ref, v);
+  chain->head = (chain->head + 1) % chain->capacity;
+  chain->count--;
+}
+
+// Evict from the chains holding the most bytes until the history fits the
+// budget
+static void history_enforce_budget(void) {
+  while (history_budget && history_bytes > history_budget &&
+         history_heap_size > 0) {
+    uint32_t ref = history_heap[0];
+    struct version_chain *chain = &version_chains[ref];
+    if (chain->count > 1) {
+      history_evict_oldest(ref);
+      // a single version cannot be reverted to anything, so the chain is
+      // not a candidate anymore until it gets written again; otherwise it
+      // holds fewer bytes now and may not be the largest anymore
+      if (chain->count > 1) {
+        history_heap_down(0);
+        continue;
+      }
+    }
+    history_heap_swap(0, history_heap_size - 1);
+    history_heap_size--;
+    history_heap_pos[ref] = HEAP_NONE;
+    history_heap_down(0);
+  }
+}
+
+static void history_push(uint32_t ref, const void *data, size_t size,
+                         int64_t seq_num, int tx_id, uint64_t timestamp,
+                         int owned) {
+  struct version_chain *chain = &version_chains[ref];
+  if (chain->count == chain->capacity) {
+    struct version_ref *ring = NULL;
+    uint32_t capacity = chain->capacity ? chain->capacity * 2 : 4;
+    if (capacity > history_depth) capacity = history_depth;
+    if (chain->capacity < capacity)
+      ring =
+          (struct version_ref *)malloc(sizeof(struct version_ref) * capacity);
+    if (ring) {
+      // grow the ring, unrolling it so that the oldest version is first
+      for (uint32_t i = 0; i < chain->count; i++)
+        ring[i] = chain->ring[(chain->head + i) % chain->capacity];
+      free(chain->ring);
+      chain->ring = ring;
+      chain->head = 0;
+      chain->capacity = capacity;
+    } else if (chain->count > 0) {
+      // at the depth, or out of memory to grow
+      history_evict_oldest(ref);
+    } else {
+      // not even one slot, the version is only kept in the node's slots
+      return;
+    }
+  }
+  struct version_ref *v =
+      &chain->ring[(chain->head + chain->count) % chain->capacity];
+  v->data = data;
+  v->size = size;
+  v->sequence_number = seq_num;
+  v->tx_id = tx_id;
+  v->timestamp = timestamp;
+  v->owned = owned;
+  chain->count++;
+  chain->bytes += size;
+  history_bytes += size;
+  if (chain->count > 1) {
+    if (history_heap_pos[ref] == HEAP_NONE) {
+      history_heap[history_heap_size] = ref;
+      history_heap_pos[ref] = history_heap_size;
+      history_heap_size++;
+    }
+    history_heap_up(history_heap_pos[ref]);
+  }
+  history_enforce_budget();
+}
+
+static void history_reset(size_t count) {
+  for (size_t i = 0; i < version_chain_count; i++) free(version_chains[i].ring);
+  free(version_chains);
+  free(history_heap);
+  free(history_heap_pos);
+  version_chains =
+      (struct version_chain *)calloc(count + 1, sizeof(struct version_chain));
+  history_heap = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+  history_heap_pos = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+  for (size_t i = 0; i <= count; i++) history_heap_pos[i] = HEAP_NONE;
+  version_chain_count = count;
+  history_heap_size = 0;
+  history_bytes = 0;
+}
+
+// Version chain of the offset in the indexed checkpoint log, NULL if none
+struct version_chain *checkpoint_version_chain(struct checkpoint_log *c_log,
+                                               uint64_t offset) {
+  if (c_log != offset_index_log || !version_chains) return NULL;
+  uint32_t ref = checkpoint_index_find(offset_index, offset);
+  if (ref == CHECKPOINT_INDEX_NONE) return NULL;
+  return &version_chains[ref];
+}
+
+// The version the offset had before sequence number seq_num was written,
+// NULL if seq_num is the oldest version or not in the history anymore
+const struct version_ref *checkpoint_previous_version(
+    struct checkpoint_log *c_log, uint64_t offset, int64_t seq_num) {
+  struct version_chain *chain = checkpoint_version_chain(c_log, offset);
+  if (!chain || chain->count < 2) return NULL;
+  // the ring is in sequence order, binary search for seq_num
+  uint32_t lo = 0, hi = chain->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (version_chain_at(chain, mid)->sequence_number < seq_num)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0 || lo == chain->count ||
+      version_chain_at(chain, lo)->sequence_number != seq_num)
+    return NULL;
+  return version_chain_at(chain, lo - 1);
+}
+
+// Min-heap of the segments that still have entries to merge, keyed by the
+// sequence number of their next entry. A long run seals segment after
+// segment, so a log may have dozens of them.
+struct segment_heap {
+  struct ckpt_segment **segs;
+  int count;
+};
+
+static uint64_t segment_next_seq(struct ckpt_segment *seg) {
+  return arthas_ckpt_entries(seg->hdr)[seg->next].seq;
+}
+
+static void segment_heap_down(struct segment_heap *heap, int i) {
+  for (;;) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < heap->count &&
+        segment_next_seq(heap->segs[l]) < segment_next_seq(heap->segs[min]))
+      min = l;
+    if (r < heap->count &&
+        segment_next_seq(heap->segs[r]) < segment_next_seq(heap->segs[min]))
+      min = r;
+    if (min == i) return;
+    struct ckpt_segment *tmp = heap->segs[i];
+    heap->segs[i] = heap->segs[min];
+    heap->segs[min] = tmp;
+    i = min;
+  }
+}
+
+static void segment_heap_init(struct segment_heap *heap,
+                              struct ckpt_segment *segments, int count) {
+  heap->segs =
+      (struct ckpt_segment **)malloc(sizeof(struct ckpt_segment *) * count);
+  heap->count = 0;
+  for (int i = 0; i < count; i++)
+    if (segments[i].next < segments[i].hdr->committed)
+      heap->segs[heap->count++] = &segments[i];
+  for (int i = heap->count / 2 - 1; i >= 0; i--) segment_heap_down(heap, i);
+}
+
+// Segment holding the entry with the smallest sequence number, NULL once
+// every segment is merged
+static struct ckpt_segment *segment_heap_min(struct segment_heap *heap) {
+  return heap->count ? heap->segs[0] : NULL;
+}
+
+// Restore the heap after the next entry of the minimum segment was merged
+static void segment_heap_advance(struct segment_heap *heap) {
+  struct ckpt_segment *seg = heap->segs[0];
+  if (seg->next >= seg->hdr->committed)
+    heap->segs[0] = heap->segs[--heap->count];
+  segment_heap_down(heap, 0);
+}
+
+// Build the checkpoint log from the append-only segments at <base>.<N> by
+// merging them in sequence number order, NULL if there are no segments
+struct checkpoint_log *reconstruct_checkpoint_segments(const char *base) {
+  int count;
+  struct ckpt_segment *segments = open_checkpoint_segments(base, &count);
+  if (count == 0) return NULL;
+  struct checkpoint_log *c_log =
+      (struct checkpoint_log *)malloc(sizeof(struct checkpoint_log));
+  c_log->size = MAX_VARIABLES;
+  c_log->variable_count = 0;
+  c_log->list = (struct node **)calloc(c_log->size, sizeof(struct node *));
+  size_t total = 0;
+  for (int i = 0; i < count; i++) total += segments[i].hdr->committed;
+  // the entries in sequence order, to build the version history once the
+  // nodes are indexed
+  struct arthas_ckpt_entry **merged = (struct arthas_ckpt_entry **)malloc(
+      sizeof(struct arthas_ckpt_entry *) * (total + 1));
+  void **merged_data = (void **)malloc(sizeof(void *) * (total + 1));
+  size_t n = 0, pages = 0;
+  struct segment_heap heap;
+  segment_heap_init(&heap, segments, count);
+  for (;;) {
+    struct ckpt_segment *min = segment_heap_min(&heap);
+    if (!min) break;
+    merged[n] = &arthas_ckpt_entries(min->hdr)[min->next];
+    merged_data[n] = NULL;
+    if (merged[n]->encoding == ARTHAS_CKPT_TOMBSTONE) {
+      checkpoint_log_free(c_log, merged[n]);
+    } else if ((merged_data[n] = checkpoint_segment_version(min, min->next))) {
+      checkpoint_log_add_version(c_log, merged[n], merged_data[n]);
+      if (merged[n]->data_type == PAGE_CHECKPOINT) pages++;
+    } else {
+      fprintf(stderr, "failed to rebuild checkpoint entry %lu\n",
+              (unsigned long)merged[n]->seq);
+    }
+    min->next++;
+    segment_heap_advance(&heap);
+    n++;
+  }
+  free(heap.segs);
+  printf("merged %lu entries from %d checkpoint log segments\n", n, count);
+  // written by the page tracker, reverting them restores whole pages
+  if (pages)
+    printf("%lu of them are page versions, reversion is page-granular\n",
+           pages);
+  build_offset_index(c_log);
+  if (offset_index_log == c_log) {
+    history_reset(offset_index->count);
+    for (size_t i = 0; i < n; i++) {
+      struct arthas_ckpt_entry *e = merged[i];
+      if (!merged_data[i]) continue;
+      history_push(checkpoint_index_find(offset_index, e->offset),
+                   merged_data[i], e->size, (int64_t)e->seq, e->tx_id,
+                   e->timestamp, e->encoding == ARTHAS_CKPT_DELTA);
+    }
+    printf("kept %lu bytes of version history\n", history_bytes);
+  }
+  // the segments stay mapped and the rebuilt versions stay allocated, the
+  // log and the history point into them
+  for (int i = 0; i < count; i++) {
+    free(segments[i].path);
+    free(segments[i].versions);
+  }
+  free(merged);
+  free(merged_data);
+  free(segments);
+  return c_log;
+}
+
+// Newest sequence number at or below the stable point of every offset in
+// the segments, indexed by offset
+struct stable_versions {
+  struct checkpoint_index *index;
+  uint64_t *seq;
+  uint32_t count;
+};
+
+static int stable_versions_build(struct stable_versions *sv,
+                                 struct ckpt_segment *segments, int count,
+                                 uint64_t stable_seq) {
+  uint64_t total = 0;
+  for (int i = 0; i < count; i++) total += segments[i].hdr->committed;
+  uint64_t buckets = checkpoint_index_buckets_for(total);
+  void *mem;
+  if (posix_memalign(&mem, 64, checkpoint_index_size(buckets)) != 0) return -1;
+  sv->index = (struct checkpoint_index *)mem;
+  checkpoint_index_init(sv->index, buckets);
+  sv->seq = (uint64_t *)malloc(sizeof(uint64_t) * (total + 1));
+  sv->count = 0;
+  for (int i = 0; i < count; i++) {
+    struct arthas_ckpt_header *hdr = segments[i].hdr;
+    // entries past the snapshot are appended concurrently, they are all
+    // newer than anything below
+    segments[i].next = hdr->committed;
+    struct arthas_ckpt_entry *entries = arthas_ckpt_entries(hdr);
+    for (uint64_t n = 0; n < segments[i].next; n++) {
+      if (entries[n].seq > stable_seq) break;
+      uint32_t ref = checkpoint_index_find(sv->index, entries[n].offset);
+      if (ref == CHECKPOINT_INDEX_NONE) {
+        ref = sv->count++;
+        sv->seq[ref] = entries[n].seq;
+        checkpoint_index_insert(sv->index, entries[n].offset, ref);
+      } else if (entries[n].seq > sv->seq[ref]) {
+        sv->seq[ref] = entries[n].seq;
+      }
+    }
+  }
+  return 0;
+}
+
+// An entry is still needed if it is newer than the stable point, or the
+// version of its offset at the stable point. Older versions cannot be
+// reverted to anymore, and neither can the versions before a tombstone.
+static int stable_versions_keep(struct stable_versions *sv,
+                                struct arthas_ckpt_entry *e) {
+  uint32_t ref = checkpoint_index_find(sv->index, e->offset);
+  return ref == CHECKPOINT_INDEX_NONE || e->seq >= sv->seq[ref];
+}
+
+// Write the kept entries of a sealed segment to a new segment at path
+static int compact_checkpoint_segment(struct ckpt_segment *seg,
+                                      struct stable_versions *sv,
+                                      const char *path, uint64_t kept,
+                                      uint64_t *compacted_len) {
+  struct arthas_ckpt_header *src = seg->hdr;
+  struct arthas_ckpt_entry *entries = arthas_ckpt_entries(src);
+  uint64_t payload = 0, max_size = 0;
+  for (uint64_t n = 0; n < seg->next; n++) {
+    if (!stable_versions_keep(sv, &entries[n])) continue;
+    // the worst case is every kept version stored in full
+    payload += (entries[n].size + 7) & ~7ULL;
+    if (entries[n].size > max_size) max_size = entries[n].size;
+  }
+  uint64_t slots = 1;
+  while (slots < kept * 2) slots <<= 1;
+  uint64_t index_offset, entry_offset, payload_offset;
+  size_t len = arthas_ckpt_layout(slots, kept, payload, &index_offset,
+                                  &entry_offset, &payload_offset);
+  size_t mapped_len;
+  int is_pmem;
+  struct arthas_ckpt_header *dst = (struct arthas_ckpt_header *)pmem_map_file(
+      path, len, PMEM_FILE_CREATE | PMEM_FILE_EXCL, 0666, &mapped_len,
+      &is_pmem);
+  if (!dst) {
+    perror(path);
+    return -1;
+  }
+  arthas_ckpt_init(dst, src->thread, slots, kept, payload);
+  // the copy is renamed over the segment only once it is complete
+  dst->magic = ARTHAS_CKPT_MAGIC;
+  dst->sealed = 1;
+  dst->compacted = 1;
+  char *version = (char *)malloc(max_size + 1);
+  char *scratch = (char *)malloc(max_size + 1);
+  int ret = 0;
+  for (uint64_t n = 0; n < seg->next && ret == 0; n++) {
+    struct arthas_ckpt_entry *e = &entries[n];
+    if (!stable_versions_keep(sv, e)) continue;
+    uint64_t m;
+    if (e->encoding == ARTHAS_CKPT_TOMBSTONE) {
+      m = arthas_ckpt_append_tombstone(dst, e->seq, e->offset, e->tx_id,
+                                       e->timestamp);
+    } else {
+      // deltas are encoded again, their base may be gone
+      arthas_ckpt_materialize(src, n, version);
+      m = arthas_ckpt_append(dst, e->seq, e->offset, version, e->size,
+                             e->tx_id, e->data_type, e->timestamp, scratch);
+    }
+    if (m == ARTHAS_CKPT_NO_ENTRY) {
+      ret = -1;
+      break;
+    }
+    arthas_ckpt_commit(dst, m);
+    arthas_ckpt_index_update(dst, e->offset, m);
+  }
+  free(version);
+  free(scratch);
+  if (ret == 0) {
+    // the new segment is only renamed over the old one once it is durable
+    if (is_pmem)
+      pmem_persist(dst, mapped_len);
+    else
+      pmem_msync(dst, mapped_len);
+    *compacted_len = payload_offset + dst->payload_used;
+  }
+  pmem_unmap(dst, mapped_len);
+  if (ret != 0) unlink(path);
+  return ret;
+}
+
+// Drop the entries of the sealed segments at <base>.<N> that are no longer
+// needed to revert to any point after stable_seq: versions superseded at
+// the stable point, and the versions of objects freed before it. Segments
+// the runtime still appends to are only read, so the application's
+// checkpoint writes never wait for the compactor.
+int compact_checkpoint_log(const char *base, uint64_t stable_seq,
+                           struct checkpoint_compact_stats *stats) {
+  int count;
+  struct ckpt_segment *segments = open_checkpoint_segments(base, &count);
+  memset(stats, 0, sizeof(*stats));
+  if (count == 0) return 0;
+  struct stable_versions sv = {NULL, NULL, 0};
+  int ret = stable_versions_build(&sv, segments, count, stable_seq);
+  for (int i = 0; i < count && ret == 0; i++) {
+    struct ckpt_segment *seg = &segments[i];
+    if (!seg->hdr->sealed) continue;
+    stats->segments++;
+    stats->entries += seg->next;
+    stats->bytes_before += seg->mapped_len;
+    uint64_t kept = 0;
+    struct arthas_ckpt_entry *entries = arthas_ckpt_entries(seg->hdr);
+    for (uint64_t n = 0; n < seg->next; n++)
+      kept += stable_versions_keep(&sv, &entries[n]);
+    stats->kept += kept;
+    if (kept == seg->next) {
+      stats->bytes_after += seg->mapped_len;
+      continue;
+    }
+    if (kept == 0) {
+      // readers that mapped the segment keep their mapping
+      if (unlink(seg->path) != 0) {
+        perror(seg->path);
+        stats->bytes_after += seg->mapped_len;
+      }
+      continue;
+    }
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.compact", seg->path);
+    uint64_t compacted_len;
+    if (compact_checkpoint_segment(seg, &sv, tmp_path, kept,
+                                   &compacted_len) != 0 ||
+        rename(tmp_path, seg->path) != 0) {
+      fprintf(stderr, "failed to compact %s\n", seg->path);
+      unlink(tmp_path);
+      ret = -1;
+      break;
+    }
+    stats->bytes_after += compacted_len;
+  }
+  if (sv.index) {
+    free(sv.index);
+    free(sv.seq);
+  }
+  for (int i = 0; i < count; i++) {
+    pmem_unmap(segments[i].hdr, segments[i].mapped_len);
+    free(segments[i].path);
+    free(segments[i].versions);
+  }
+  free(segments);
+  return ret;
+}
+
+// Newest committed sequence number in the segments at <base>.<N>, -1 if
+// they are empty
+int64_t checkpoint_log_last_seq(const char *base) {
+  int count;
+  struct ckpt_segment *segments = open_checkpoint_segments(base, &count);
+  int64_t last = -1;
+  for (int i = 0; i < count; i++) {
+    struct arthas_ckpt_header *hdr = segments[i].hdr;
+    if (hdr->committed && (int64_t)hdr->last_seq > last)
+      last = (int64_t)hdr->last_seq;
+    pmem_unmap(hdr, segments[i].mapped_len);
+    free(segments[i].path);
+    free(segments[i].versions);
+  }
+  free(segments);
+  return last;
+}
+
 struct checkpoint_log *reconstruct_checkpoint(const char *file_path,
                                               const char *pmem_library) {
   int variable_count;
   struct checkpoint_log *c_log;
+  // prefer the append-only log if the runtime wrote one
+  char log_base[PATH_MAX];
+  snprintf(log_base, sizeof(log_base), "%s%s", file_path,
+           ARTHAS_CKPT_LOG_SUFFIX);
+  c_log = reconstruct_checkpoint_segments(log_base);
+  if (c_log) {
+    printf("RECONSTRUCTED CHECKPOINT COMPONENT FROM LOG:\n");
+    printf("variable count is %d\n", c_log->variable_count);
+    return c_log;
+  }
   if (strcmp(pmem_library, "libpmemobj2") == 0) {
     PMEMobjpool *pop = pmemobj_open(file_path, "checkpoint");
     if (!pop) {
@@ -109,6 +850,18 @@ struct checkpoint_log *reconstruct_checkpoint(const char *file_path,
   printf("RECONSTRUCTED CHECKPOINT COMPONENT:\n");
   printf("variable count is %d\n", variable_count);
   // print_checkpoint_log(c_log);
+  build_offset_index(c_log);
+  if (offset_index_log == c_log) {
+    // the pool only has the last MAX_VERSIONS versions of each variable and
+    // no timestamps, those are only in the append-only log
+    history_reset(offset_index->count);
+    for (uint32_t ref = 0; ref < offset_index->count; ref++) {
+      checkpoint_data *c_data = &offset_index_nodes[ref]->c_data;
+      for (int j = 0; j <= c_data->version; j++)
+        history_push(ref, c_data->data[j], c_data->size[j],
+                     checkpoint_data_seq(c_data, j), c_data->tx_id[j], 0, 0);
+    }
+  }
   return c_log;
 }
 
@@ -130,7 +883,7 @@ void print_checkpoint_log(checkpoint_log *c_log) {
         printf("version is %d size is %ld value is %f or %d %s\n", j,
                temp->c_data.size[j], *((double *)temp->c_data.data[j]),
                *((int *)temp->c_data.data[j]), (char *)temp->c_data.data[j]);
-        printf("seq num is %d\n", temp->c_data.sequence_number[j]);
+        printf("seq num is %ld\n", checkpoint_data_seq(&temp->c_data, j));
       }
       temp = temp->next;
     }
@@ -148,41 +901,183 @@ int sequence_comparator(const void *v1, const void *v2) {
     return 0;
 }
 
-void order_by_tx_id(tx_log *t_log, struct checkpoint_log *c_log) {
-  struct node *list;
-  struct node *temp;
+void tx_index_init(tx_index *t_index) {
+  memset(t_index, 0, sizeof(tx_index));
+}
+
+static void tx_index_add(tx_index *t_index, int tx_id, int64_t seq_num) {
+  if (t_index->total == t_index->capacity) {
+    size_t capacity = t_index->capacity ? t_index->capacity * 2 : 1024;
+    struct tx_entry *entries = (struct tx_entry *)realloc(
+        t_index->entries, capacity * sizeof(struct tx_entry));
+    if (!entries) {
+      fprintf(stderr, "failed to grow transaction index\n");
+      return;
+    }
+    t_index->entries = entries;
+    t_index->capacity = capacity;
+  }
+  t_index->entries[t_index->total].tx_id = tx_id;
+  t_index->entries[t_index->total].sequence_number = seq_num;
+  t_index->total++;
+}
+
+static int tx_entry_cmpfunc(const void *a, const void *b) {
+  const struct tx_entry *e1 = (const struct tx_entry *)a;
+  const struct tx_entry *e2 = (const struct tx_entry *)b;
+  if (e1->tx_id != e2->tx_id) return e1->tx_id < e2->tx_id ? -1 : 1;
+  if (e1->sequence_number != e2->sequence_number)
+    return e1->sequence_number < e2->sequence_number ? -1 : 1;
+  return 0;
+}
+
+// Sort the collected entries and build the dense per-transaction ranges
+void tx_index_finish(tx_index *t_index) {
+  qsort(t_index->entries, t_index->total, sizeof(struct tx_entry),
+        tx_entry_cmpfunc);
+  size_t count = 0;
+  for (size_t i = 0; i < t_index->total; i++)
+    if (i == 0 || t_index->entries[i].tx_id != t_index->entries[i - 1].tx_id)
+      count++;
+  t_index->tx_ids = (int *)malloc(sizeof(int) * (count + 1));
+  t_index->begin = (size_t *)malloc(sizeof(size_t) * (count + 1));
+  size_t d = 0;
+  for (size_t i = 0; i < t_index->total; i++) {
+    if (i == 0 ||
+        t_index->entries[i].tx_id != t_index->entries[i - 1].tx_id) {
+      t_index->tx_ids[d] = t_index->entries[i].tx_id;
+      t_index->begin[d] = i;
+      d++;
+    }
+  }
+  t_index->begin[count] = t_index->total;
+  t_index->count = count;
+}
+
+// Dense index of the transaction, -1 if it has no entries
+long tx_index_find(tx_index *t_index, int tx_id) {
+  size_t lo = 0, hi = t_index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (t_index->tx_ids[mid] < tx_id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < t_index->count && t_index->tx_ids[lo] == tx_id) return (long)lo;
+  return -1;
+}
+
+void tx_index_free(tx_index *t_index) {
+  free(t_index->entries);
+  free(t_index->tx_ids);
+  free(t_index->begin);
+  tx_index_init(t_index);
+}
+
+static int offset_seq_comparator(const void *v1, const void *v2) {
+  const struct offset_seq *e1 = (const struct offset_seq *)v1;
+  const struct offset_seq *e2 = (const struct offset_seq *)v2;
+  if (e1->offset != e2->offset) return e1->offset < e2->offset ? -1 : 1;
+  if (e1->sequence_number != e2->sequence_number)
+    return e1->sequence_number < e2->sequence_number ? -1 : 1;
+  return 0;
+}
+
+// Index every entry of s_log by its pool offset, returns -1 if out of memory
+int offset_seq_index_build(offset_seq_index *o_index, seq_log *s_log) {
+  size_t count = 0;
+  for (size_t i = 0; i < s_log->size; i++)
+    for (struct seq_node *temp = s_log->list[i]; temp; temp = temp->next)
+      count++;
+  o_index->count = 0;
+  o_index->entries =
+      (struct offset_seq *)malloc(sizeof(struct offset_seq) * (count + 1));
+  if (!o_index->entries) return -1;
+  for (size_t i = 0; i < s_log->size; i++) {
+    for (struct seq_node *temp = s_log->list[i]; temp; temp = temp->next) {
+      struct offset_seq *e = &o_index->entries[o_index->count++];
+      e->offset = temp->ordered_data.offset;
+      e->sequence_number = temp->sequence_number;
+    }
+  }
+  qsort(o_index->entries, o_index->count, sizeof(struct offset_seq),
+        offset_seq_comparator);
+  return 0;
+}
+
+// First entry with an offset at or above offset
+static size_t offset_seq_lower_bound(const offset_seq_index *o_index,
+                                     uint64_t offset) {
+  size_t lo = 0, hi = o_index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (o_index->entries[mid].offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Entries [*first, *last) have an offset in [low, high]
+void offset_seq_index_range(const offset_seq_index *o_index, uint64_t low,
+                            uint64_t high, size_t *first, size_t *last) {
+  *first = offset_seq_lower_bound(o_index, low);
+  *last = high == UINT64_MAX ? o_index->count
+                             : offset_seq_lower_bound(o_index, high + 1);
+  if (*last < *first) *last = *first;
+}
+
+void offset_seq_index_free(offset_seq_index *o_index) {
+  free(o_index->entries);
+  o_index->entries = NULL;
+  o_index->count = 0;
+}
+
+// Insert every version in the history of a variable. The entries only carry
+// the MAX_VERSIONS - 1 versions right before them, deeper ones are reached
+// through checkpoint_previous_version.
+static void order_chain_versions(seq_log *s_log, size_t *total_size,
+                                 struct node *n, struct version_chain *chain,
+                                 tx_index *t_index) {
   single_data ordered_data;
-  for (int i = 0; i < (int)c_log->size; i++) {
-    list = c_log->list[i];
-    temp = list;
-    while (temp) {
-      int data_index = temp->c_data.version;
-      for (int j = 0; j <= data_index; j++) {
-        int seq_num = temp->c_data.sequence_number[j];
-        ordered_data.address = temp->c_data.address;
-        ordered_data.offset = temp->offset;
-        ordered_data.data = malloc(temp->c_data.size[j]);
-        memcpy(ordered_data.data, temp->c_data.data[j], temp->c_data.size[j]);
-        ordered_data.size = temp->c_data.size[j];
-        ordered_data.version = j;
-        ordered_data.sequence_number = temp->c_data.sequence_number[j];
-        ordered_data.old_checkpoint_entry = temp->c_data.old_checkpoint_entry;
-        ordered_data.tx_id = temp->c_data.tx_id[j];
-        for (int k = 0; k < j; k++) {
-          ordered_data.old_data[k] = malloc(temp->c_data.size[k]);
-          memcpy(ordered_data.old_data[k], temp->c_data.data[k],
-                 temp->c_data.size[k]);
-          ordered_data.old_size[k] = temp->c_data.size[k];
-        }
-        tx_insert(t_log, ordered_data.tx_id, ordered_data);
-      }
-      temp = temp->next;
+  for (uint32_t i = 0; i < chain->count; i++) {
+    struct version_ref *v = version_chain_at(chain, i);
+    int version = i < MAX_VERSIONS - 1 ? (int)i : MAX_VERSIONS - 1;
+    ordered_data.address = n->c_data.address;
+    ordered_data.offset = n->offset;
+    ordered_data.data = malloc(v->size);
+    memcpy(ordered_data.data, v->data, v->size);
+    ordered_data.size = v->size;
+    ordered_data.version = version;
+    ordered_data.sequence_number = v->sequence_number;
+    ordered_data.old_checkpoint_entry = n->c_data.old_checkpoint_entry;
+    ordered_data.tx_id = v->tx_id;
+    ordered_data.timestamp = v->timestamp;
+    for (int k = 0; k < version; k++) {
+      struct version_ref *old = version_chain_at(chain, i - version + k);
+      ordered_data.old_data[k] = malloc(old->size);
+      memcpy(ordered_data.old_data[k], old->data, old->size);
+      ordered_data.old_size[k] = old->size;
     }
+    *total_size = *total_size + 1;
+    insert(s_log, v->sequence_number, ordered_data);
+    if (t_index && v->tx_id > CHECKPOINT_NO_TX)
+      tx_index_add(t_index, v->tx_id, v->sequence_number);
   }
 }
 
 void order_by_sequence_num(seq_log *s_log, size_t *total_size,
                            struct checkpoint_log *c_log) {
+  order_by_sequence_num_tx(s_log, total_size, c_log, NULL);
+}
+
+// Same as order_by_sequence_num, also grouping the entries by transaction
+// into t_index if it is not NULL
+void order_by_sequence_num_tx(seq_log *s_log, size_t *total_size,
+                              struct checkpoint_log *c_log,
+                              tx_index *t_index) {
   struct node *list;
   struct node *temp;
   item *it;
@@ -191,18 +1086,26 @@ void order_by_sequence_num(seq_log *s_log, size_t *total_size,
     list = c_log->list[i];
     temp = list;
     while (temp) {
+      struct version_chain *chain =
+          checkpoint_version_chain(c_log, temp->offset);
+      if (chain) {
+        order_chain_versions(s_log, total_size, temp, chain, t_index);
+        temp = temp->next;
+        continue;
+      }
       int data_index = temp->c_data.version;
       for (int j = 0; j <= data_index; j++) {
-        int seq_num = temp->c_data.sequence_number[j];
+        int64_t seq_num = checkpoint_data_seq(&temp->c_data, j);
         ordered_data.address = temp->c_data.address;
         ordered_data.offset = temp->offset;
         ordered_data.data = malloc(temp->c_data.size[j]);
         memcpy(ordered_data.data, temp->c_data.data[j], temp->c_data.size[j]);
         ordered_data.size = temp->c_data.size[j];
         ordered_data.version = j;
-        ordered_data.sequence_number = temp->c_data.sequence_number[j];
+        ordered_data.sequence_number = seq_num;
         ordered_data.old_checkpoint_entry = temp->c_data.old_checkpoint_entry;
         ordered_data.tx_id = temp->c_data.tx_id[j];
+        ordered_data.timestamp = 0;
         for (int k = 0; k < j; k++) {
           ordered_data.old_data[k] = malloc(temp->c_data.size[k]);
           memcpy(ordered_data.old_data[k], temp->c_data.data[k],
@@ -211,58 +1114,21 @@ void order_by_sequence_num(seq_log *s_log, size_t *total_size,
         }
         *total_size = *total_size + 1;
         insert(s_log, seq_num, ordered_data);
+        if (t_index && ordered_data.tx_id > CHECKPOINT_NO_TX)
+          tx_index_add(t_index, ordered_data.tx_id, seq_num);
       }
       temp = temp->next;
     }
   }
+  if (t_index) tx_index_finish(t_index);
 }
 
-int txhashCode(tx_log *t_log, int key) {
-  if (key < 0) return -(key % t_log->size);
-  return key % t_log->size;
+// Sequence numbers are dense, so the low bits spread them evenly
+int hashCode(seq_log *s_log, int64_t key) {
+  return (int)((uint64_t)key % s_log->size);
 }
 
-void tx_insert(tx_log *t_log, int key, single_data ordered_data) {
-  int pos = txhashCode(t_log, key);
-  struct tx_node *list = t_log->list[pos];
-  struct tx_node *newNode = (struct tx_node *)malloc(sizeof(struct tx_node));
-  struct tx_node *temp = list;
-  while (temp) {
-    /*if(temp->tx_id==key){
-        temp->ordered_data = ordered_data;
-        return;
-    }*/
-    temp = temp->next;
-  }
-  newNode->tx_id = key;
-  newNode->ordered_data = ordered_data;
-  newNode->next = list;
-  // printf("insertion to position %d\n", pos);
-  t_log->list[pos] = newNode;
-}
-
-single_data tx_lookup(tx_log *t_log, int key) {
-  int pos = txhashCode(t_log, key);
-  struct tx_node *list = t_log->list[pos];
-  struct tx_node *temp = list;
-  while (temp) {
-    if (temp->tx_id == key) {
-      return temp->ordered_data;
-    }
-    temp = temp->next;
-  }
-  single_data error_data;
-  error_data.tx_id = -1;
-  return error_data;
-}
-
-int hashCode(seq_log *s_log, int key) {
-  if (key < 0) return -(key % s_log->size);
-  return key % s_log->size;
-}
-
-void insert(seq_log *s_log, int key, single_data ordered_data) {
-  struct seq_node *t = s_log->list[92];
+void insert(seq_log *s_log, int64_t key, single_data ordered_data) {
   int pos = hashCode(s_log, key);
   struct seq_node *list = s_log->list[pos];
   struct seq_node *newNode = (struct seq_node *)malloc(sizeof(struct seq_node));
@@ -281,7 +1147,25 @@ void insert(seq_log *s_log, int key, single_data ordered_data) {
   s_log->list[pos] = newNode;
 }
 
-int rev_lookup(seq_log *s_log, int key) {
+// Free a sequence log with its entries and the copies of the data they hold
+void seq_log_free(seq_log *s_log) {
+  if (!s_log) return;
+  for (size_t i = 0; i < s_log->size && s_log->list; i++) {
+    struct seq_node *temp = s_log->list[i];
+    while (temp) {
+      struct seq_node *next = temp->next;
+      free(temp->ordered_data.data);
+      for (int k = 0; k < temp->ordered_data.version; k++)
+        free(temp->ordered_data.old_data[k]);
+      free(temp);
+      temp = next;
+    }
+  }
+  free(s_log->list);
+  free(s_log);
+}
+
+int rev_lookup(seq_log *s_log, int64_t key) {
   int pos = hashCode(s_log, key);
   struct seq_node *list = s_log->list[pos];
   struct seq_node *temp = list;
@@ -292,34 +1176,31 @@ int rev_lookup(seq_log *s_log, int key) {
   return -1;
 }
 
-void lookup_modify(seq_log *s_log, int key, void *addr) {
-  int pos = hashCode(s_log, key);
-  struct seq_node *list = s_log->list[pos];
-  struct seq_node *temp = list;
-  while (temp) {
-    if (temp->sequence_number == key) {
-      temp->ordered_data.sorted_pmem_address = addr;
-      return;
-    }
-    temp = temp->next;
-  }
+// Base of the currently open pool. Entries only keep their pool offset, so
+// reopening the pool at a different address only moves the base.
+static char *current_pool_base = NULL;
+
+void set_pool_base(void *base) { current_pool_base = (char *)base; }
+
+// Address of the entry in the currently open pool
+void *entry_pmem_address(const single_data *data) {
+  return current_pool_base + data->offset;
 }
 
-void lookup_undo_save(seq_log *s_log, int key, void *addr, size_t size) {
+void lookup_undo_save(seq_log *s_log, int64_t key, void *addr, size_t size) {
   int pos = hashCode(s_log, key);
   struct seq_node *list = s_log->list[pos];
   struct seq_node *temp = list;
   while (temp) {
     if (temp->sequence_number == key) {
-      memcpy(temp->ordered_data.data, temp->ordered_data.sorted_pmem_address,
-             size);
+      memcpy(temp->ordered_data.data, addr, size);
       return;
     }
     temp = temp->next;
   }
 }
 
-single_data lookup(seq_log *s_log, int key) {
+single_data lookup(seq_log *s_log, int64_t key) {
   int pos = hashCode(s_log, key);
   struct seq_node *list = s_log->list[pos];
   struct seq_node *temp = list;
@@ -334,8 +1215,8 @@ single_data lookup(seq_log *s_log, int key) {
   return error_data;
 }
 
-int *address_lookup(seq_log *s_log, uint64_t address, int *seq_count,
-                    int *sequences) {
+int64_t *address_lookup(seq_log *s_log, uint64_t address, int *seq_count,
+                        int64_t *sequences) {
   struct seq_node *list;
   struct seq_node *temp;
   *seq_count = 0;
@@ -353,7 +1234,7 @@ int *address_lookup(seq_log *s_log, uint64_t address, int *seq_count,
   return sequences;
 }
 
-int count_higher(seq_log *s_log, int seq_num) {
+int count_higher(seq_log *s_log, int64_t seq_num) {
   struct seq_node *list;
   struct seq_node *temp;
   int return_number = 0;
@@ -370,10 +1251,10 @@ int count_higher(seq_log *s_log, int seq_num) {
   return return_number;
 }
 
-int find_highest_seq_num(seq_log *s_log) {
+int64_t find_highest_seq_num(seq_log *s_log) {
   struct seq_node *list;
   struct seq_node *temp;
-  int highest_seq_num = -1;
+  int64_t highest_seq_num = -1;
   for (int i = 0; i < (int)s_log->size; i++) {
     list = s_log->list[i];
     temp = list;
@@ -386,3 +1267,20 @@ int find_highest_seq_num(seq_log *s_log) {
   }
   return highest_seq_num;
 }
+
+// Smallest sequence number still held by any version in the checkpoint
+// log, -1 if the log is empty
+int64_t find_lowest_seq_num(struct checkpoint_log *c_log) {
+  struct node *temp;
+  int64_t lowest_seq_num = -1;
+  for (int i = 0; i < (int)c_log->size; i++) {
+    for (temp = c_log->list[i]; temp; temp = temp->next) {
+      for (int j = 0; j <= temp->c_data.version; j++) {
+        int64_t seq_num = checkpoint_data_seq(&temp->c_data, j);
+        if (lowest_seq_num < 0 || seq_num < lowest_seq_num)
+          lowest_seq_num = seq_num;
+      }
+    }
+  }
+  return lowest_seq_num;
+}
@@ -7,6 +7,7 @@
 //
 
 #include "core.h"
+#include <sys/stat.h>
 #include <unistd.h>
 #include <chrono>
 
@@ -32,6 +33,22 @@ int binary_reverted_items = 0;
 int total_reexecutions = 0;
 FILE *fp;
 //FILE *fp2;
+// journal of the binary reversion trials, NULL if it could not be opened
+static struct reversion_journal *journal = NULL;
+// checkpoint entries by transaction, only set with --tx so that trials
+// revert whole transactions
+static tx_index *tx_groups = NULL;
+// the open trial was restored from a snapshot of reactor_pool_path and is
+// undone from a clone of the pool at <pool>SNAPSHOT_UNDO_SUFFIX
+static bool snapshot_trial = false;
+static const char *reactor_pool_path = NULL;
+// mapping of the pool the snapshot trial closes and reopens around clones
+static void **snapshot_pool = NULL;
+static struct reactor_options *snapshot_options = NULL;
+// in-process validator of the trials, NULL to always re-execute
+static struct validator *validator = NULL;
+// file:line of the fault location, how the fault shows up in a backtrace
+static std::string fault_signature;
 
 // #define DUMP_SLICES 1
 #define BINARY_REVERSION_ATTEMPTS 2
@@ -212,6 +229,7 @@ bool Reactor::prepare(int argc, char *argv[], bool server) {
     options.checkpoint_file = get_checkpoint_file(options.pmem_library);
     if (!options.checkpoint_file) return false;
   }
+  set_checkpoint_history(options.history_depth, options.history_budget);
   if (!options.hook_guid_file) {
     errs() << "No hook GUID file specified, abort reaction\n";
     return false;
@@ -232,24 +250,36 @@ bool Reactor::prepare(int argc, char *argv[], bool server) {
     // If we are in standalone mode, we should parse the address trace file
     // Otherwise, the trace file needs to be continuously read and parsed.
 
-    // Step 2.a: Read dynamic address trace file
+    // Step 2.a: Read dynamic address trace file. The checkpoint log is
+    // reconstructed first so that the trace segments sealed before the
+    // oldest checkpointed version can be skipped.
+    _state->c_log =
+        reconstruct_checkpoint(options.checkpoint_file, options.pmem_library);
+    if (_state->c_log == NULL) {
+      cerr << "Failed to reconstruct checkpoint log, abort\n";
+      return false;
+    }
+    int64_t lowest_seq = find_lowest_seq_num(_state->c_log);
     if (!PmemAddrTrace::deserialize(options.address_file, &_state->var_map,
-                                    _state->addr_trace)) {
+                                    _state->addr_trace, false,
+                                    lowest_seq > 0 ? lowest_seq : 0)) {
       cerr << "Failed to parse hook GUID file " << options.hook_guid_file
            << endl;
       return false;
     }
     cout << "Successfully parsed " << _state->addr_trace.size()
          << " dynamic address trace items\n";
-    // FIXME: should support libpmem reactor, which does not have a pool
-    // address.
+    // libpmem targets get their mapping from the pool registry, the
+    // tracker hooks pmem_map_file like pmemobj_open
     if (_state->addr_trace.pool_empty()) {
       cerr << "No pool address found in the address trace file, abort\n";
       return false;
     }
-    // Step 2.b: Convert collected addresses to pointers and offsets
+    // Step 2.b: Convert collected addresses to pointers and offsets, unless
+    // the tracker recorded the offsets with its pool registry already
     // FIXME: here, we are assuming the target program only has a single pool.
-    if (!_state->addr_trace.calculatePoolOffsets()) {
+    if (!_state->addr_trace.hasPoolRegistry() &&
+        !_state->addr_trace.calculatePoolOffsets()) {
       cerr << "Failed to calculate the address offsets w.r.t the pool address "
               "in "
               "the address trace file, abort\n";
@@ -273,6 +303,16 @@ bool Reactor::prepare(int argc, char *argv[], bool server) {
 // and analzying the address trace
 bool Reactor::monitor_address_trace() {
   struct reactor_options &options = _state->options;
+  // wait until the tracker has created the trace to tell its format apart
+  while (true) {
+    std::vector<std::string> segments;
+    PmemAddrTraceSegment::listSegments(options.address_file, segments);
+    if (!segments.empty()) return monitor_trace_segment();
+    std::ifstream probe(options.address_file);
+    char c;
+    if (probe.get(c) && c != '\0') break;
+    usleep(100000);
+  }
   std::ifstream addrfile(options.address_file);
   if (!addrfile.is_open()) {
     errs() << "Failed to open " << options.address_file
@@ -322,18 +362,20 @@ bool Reactor::monitor_address_trace() {
           partial_line.append(line);
           partial = true;
         } else {
-          PmemAddrTraceItem *item = new PmemAddrTraceItem();
-          bool ok = false;
           if (partial) {
             // previous line is partial, append current line to previous line
             partial_line.append(line);
-            ok =
-                PmemAddrTraceItem::parse(partial_line, *item, &_state->var_map);
+            line.swap(partial_line);
             // clear partial line
             partial_line.erase();
-          } else {
-            ok = PmemAddrTraceItem::parse(line, *item, &_state->var_map);
+            partial = false;
+          }
+          if (PmemAddrTrace::isHeaderLine(line)) {
+            _state->addr_trace.parseHeaderLine(line);
+            continue;
           }
+          PmemAddrTraceItem *item = new PmemAddrTraceItem();
+          bool ok = PmemAddrTraceItem::parse(line, *item, &_state->var_map);
           if (ok) {
             _state->addr_trace.add(item);
           } else {
@@ -355,6 +397,81 @@ bool Reactor::monitor_address_trace() {
   return true;
 }
 
+// Used to monitor the binary trace segments written by the address tracker.
+// Unlike the text trace, a segment is preallocated, so we poll its
+// committed length instead of the file size, and follow the rotation chain
+// once the tracker seals the segment.
+bool Reactor::monitor_trace_segment() {
+  struct reactor_options &options = _state->options;
+  PmemAddrTraceSegment segment;
+  std::string seg_path;
+  uint64_t next = 0;
+  int stalled_polls = 0;
+  const int max_stalled_polls = 10;
+  useconds_t check_delay = 100000;  // 100ms
+  while (true) {
+    if (!segment.isOpen() || segment.replaced(seg_path.c_str())) {
+      if (segment.isOpen()) {
+        // the segment is recreated by a new run of the target,
+        // we have to start over...
+        segment.close();
+        stalled_polls = 0;
+        std::lock_guard<std::mutex> lk(_trace_mu);
+        _state->addr_trace.clear();
+        _state->trace_ready = false;
+      }
+      // start from the oldest segment that has not been retired yet
+      std::vector<std::string> segments;
+      PmemAddrTraceSegment::listSegments(options.address_file, segments);
+      if (segments.empty() || !segment.open(segments.front().c_str())) {
+        usleep(check_delay);
+        continue;
+      }
+      seg_path = segments.front();
+      next = 0;
+    }
+    uint64_t committed = segment.committed();
+    if (committed == next && segment.sealed()) {
+      // the tracker rotated to the next segment, which it created before
+      // sealing this one
+      std::string next_path = PmemAddrTraceSegment::segmentPath(
+          options.address_file, segment.segmentId() + 1);
+      PmemAddrTraceSegment next_segment;
+      if (next_segment.open(next_path.c_str())) {
+        segment.close();
+        segment.open(next_path.c_str());
+        seg_path = next_path;
+        next = 0;
+        stalled_polls = 0;
+        continue;
+      }
+    }
+    if (committed == next) {
+      // no new record since last time, the trace is ready for now
+      if (next > 0) {
+        std::lock_guard<std::mutex> lk(_trace_mu);
+        segment.readSampleStats(_state->addr_trace);
+        _state->trace_ready = true;
+        _trace_ready_cv.notify_all();
+      }
+    } else {
+      // stop at a record that is still being written and pick it up next time
+      uint64_t parsed = segment.read(next, committed, &_state->var_map,
+                                     _state->addr_trace, true);
+      if (parsed != next) {
+        stalled_polls = 0;
+      } else if (++stalled_polls > max_stalled_polls) {
+        // the writer of this record died before finishing it, skip it
+        parsed = next + 1;
+        stalled_polls = 0;
+      }
+      next = parsed;
+    }
+    usleep(check_delay);
+  }
+  return true;
+}
+
 // Waiting until the address trace is ready to perform some
 // misc. work on the collected data
 bool Reactor::wait_address_trace_ready() {
@@ -383,7 +500,8 @@ bool Reactor::wait_address_trace_ready() {
     cerr << "No pool address found in the address trace file, abort\n";
     return false;
   }
-  if (!_state->addr_trace.calculatePoolOffsets()) {
+  if (!_state->addr_trace.hasPoolRegistry() &&
+      !_state->addr_trace.calculatePoolOffsets()) {
     cerr << "Failed to calculate the address offsets w.r.t the pool address "
             "in "
             "the address trace file, abort\n";
@@ -416,35 +534,239 @@ bool Reactor::wait_address_trace_ready() {
 }
 
 // Undo an array of sequence numbers
-void undo_by_sequence_number_array(seq_log *s_log, std::vector<int> &seq_list) {
+void undo_by_sequence_number_array(seq_log *s_log, std::vector<int64_t> &seq_list) {
   for (int i = 0; i < (int)seq_list.size(); i++) {
     single_data search_data = lookup(s_log, seq_list[i]);
     undo_by_sequence_number(search_data, seq_list[i]);
   }
+  pmem_drain();
+}
+
+// Revert the sequence numbers as a journal trial if possible. Sets journaled
+// to whether the trial is journaled and returns the number of writes that
+// changed the pool, 0 if there is nothing to re-execute.
+size_t revert_trial(seq_log *s_log, int64_t *seq_numbers, int total,
+                    checkpoint_log *c_log, void *pool, bool &journaled) {
+  int64_t *closure = NULL;
+  if (tx_groups) {
+    total = tx_closure(tx_groups, s_log, seq_numbers, total, &closure);
+    seq_numbers = closure;
+  }
+  journaled = false;
+  size_t applied = 0;
+  if (journal && journal_begin_trial(journal) > 0) {
+    int journaled_writes = revert_by_sequence_number_journaled(
+        journal, pool, s_log, seq_numbers, total, c_log);
+    if (journaled_writes >= 0) {
+      journaled = true;
+      applied = journaled_writes;
+    } else {
+      // the journal is full and nothing was written, drop the empty trial
+      journal_undo_trial(journal, pool);
+    }
+  }
+  if (!journaled)
+    applied = revert_by_sequence_number_array(s_log, seq_numbers, total, c_log);
+  free(closure);
+  return applied;
+}
+
+static std::string snapshot_undo_path() {
+  return std::string(reactor_pool_path) + SNAPSHOT_UNDO_SUFFIX;
+}
+
+// Close the pool before its file is cloned over: a copy rewrites the pages
+// under the mapping, and libpmemobj keeps state of the open pool in DRAM
+static void snapshot_close_pool() {
+  if (strcmp(snapshot_options->pmem_library, "libpmemobj") == 0) {
+    pmemobj_close((PMEMobjpool *)*snapshot_pool);
+  } else {
+    // the file was mapped as a whole
+    struct stat st;
+    if (stat(reactor_pool_path, &st) == 0)
+      pmem_unmap(*snapshot_pool, st.st_size);
+  }
+  *snapshot_pool = NULL;
+}
+
+// Map the pool again after a clone, the entries resolve against the new
+// base
+static int snapshot_open_pool() {
+  if (strcmp(snapshot_options->pmem_library, "libpmemobj") == 0) {
+    *snapshot_pool = (void *)pmemobj_open(reactor_pool_path,
+                                          snapshot_options->pmem_layout);
+  } else {
+    size_t mapped_len;
+    int is_pmem;
+    *snapshot_pool =
+        pmem_map_file(reactor_pool_path, 0, 0, 0, &mapped_len, &is_pmem);
+  }
+  if (*snapshot_pool == NULL) {
+    fprintf(stderr, "could not reopen %s after cloning it\n",
+            reactor_pool_path);
+    return -1;
+  }
+  set_pool_base(*snapshot_pool);
+  return 0;
+}
+
+// Restore the pool as of seq from the snapshot, keeping a clone of the
+// current pool to undo the trial. The pool mapped at *pop is closed for the
+// clones and reopened, updating *pop. Returns the number of replayed
+// versions, -1 on failure with the pool unchanged.
+long snapshot_trial_restore(const struct pool_snapshot *snap, void **pop,
+                            struct reactor_options &options, seq_log *s_log,
+                            checkpoint_log *c_log, int64_t seq) {
+  reactor_pool_path = options.pmem_file;
+  snapshot_pool = pop;
+  snapshot_options = &options;
+  std::string undo = snapshot_undo_path();
+  snapshot_close_pool();
+  long replayed = -1;
+  if (snapshot_clone_file(reactor_pool_path, undo.c_str()) == 0) {
+    if (snapshot_clone_file(snap->path, reactor_pool_path) == 0 &&
+        snapshot_open_pool() == 0) {
+      replayed = snapshot_restore(snap, s_log, c_log, seq);
+      if (replayed < 0) snapshot_close_pool();
+    }
+    if (replayed < 0) {
+      snapshot_clone_file(undo.c_str(), reactor_pool_path);
+      unlink(undo.c_str());
+    }
+  }
+  if (replayed < 0) {
+    snapshot_open_pool();
+    return -1;
+  }
+  printf("restored %s as of %ld from %s, %ld versions replayed\n",
+         reactor_pool_path, seq, snap->path, replayed);
+  snapshot_trial = true;
+  return replayed;
+}
+
+void undo_snapshot_trial() {
+  std::string undo = snapshot_undo_path();
+  snapshot_close_pool();
+  if (snapshot_clone_file(undo.c_str(), reactor_pool_path) != 0)
+    fprintf(stderr, "failed to undo the snapshot restore of %s\n",
+            reactor_pool_path);
+  else
+    printf("undid snapshot trial from %s\n", undo.c_str());
+  snapshot_open_pool();
+  unlink(undo.c_str());
+  snapshot_trial = false;
+}
+
+void commit_snapshot_trial() {
+  unlink(snapshot_undo_path().c_str());
+  snapshot_trial = false;
+}
+
+// Undo a trial reverted by revert_trial
+void undo_trial(bool journaled, seq_log *s_log, std::vector<int64_t> &seq_list,
+                void *pool) {
+  if (snapshot_trial) {
+    undo_snapshot_trial();
+  } else if (journaled) {
+    int restored = journal_undo_trial(journal, pool);
+    printf("undid journaled trial, %d locations restored\n", restored);
+  } else if (tx_groups) {
+    int64_t *closure;
+    int total = tx_closure(tx_groups, s_log, seq_list.data(), seq_list.size(),
+                           &closure);
+    vector<int64_t> closure_list(closure, closure + total);
+    undo_by_sequence_number_array(s_log, closure_list);
+    free(closure);
+  } else {
+    undo_by_sequence_number_array(s_log, seq_list);
+  }
+}
+
+// Revert candidates outside of a trial, by whole transactions with --tx
+size_t revert_candidates(seq_log *s_log, int64_t *seq_numbers, int total,
+                         checkpoint_log *c_log) {
+  if (tx_groups)
+    return revert_by_transaction(tx_groups, s_log, seq_numbers, total, c_log);
+  return revert_by_sequence_number_array(s_log, seq_numbers, total, c_log);
+}
+
+// Keep the changes of a trial reverted by revert_trial
+void commit_trial(bool journaled) {
+  if (snapshot_trial) commit_snapshot_trial();
+  if (journaled) journal_commit_trial(journal);
+}
+
+// Verdict of the validator on the pool mapped at base, of size bytes or
+// the size of the pmem file if 0, reverted to seq (-1 if unknown)
+int validate_pool(const void *base, size_t size, int64_t seq,
+                  struct reactor_options &options) {
+  if (!validator) return ARTHAS_VALIDATION_INCONCLUSIVE;
+  struct stat st;
+  if (size == 0) {
+    if (stat(options.pmem_file, &st) != 0)
+      return ARTHAS_VALIDATION_INCONCLUSIVE;
+    size = st.st_size;
+  }
+  bool pmemobj = strcmp(options.pmem_library, "libpmemobj") == 0;
+  struct arthas_validation args = {base, size, options.pmem_file,
+                                   pmemobj ? options.pmem_layout : NULL, seq};
+  int verdict = validator_run(validator, &args);
+  if (verdict != ARTHAS_VALIDATION_INCONCLUSIVE)
+    printf("validator %s the trial\n",
+           verdict == ARTHAS_VALIDATION_PASS ? "passed" : "failed");
+  return verdict;
+}
+
+// Re-execute the target against the reverted pmem file and return the
+// re_execute result. A libpmemobj pool is closed for the run and reopened
+// afterwards, updating *pop. A libpmem file stays mapped: the target sees
+// the reversions through the shared mapping and *pop does not change.
+// With a validator, a conclusive verdict on the reverted pool is returned
+// instead, unless validate is false because the caller already checked the
+// same state.
+int reexecute_target(void **pop, checkpoint_log *c_log, int num_data,
+                     seq_log *s_log, struct reactor_options &options, int64_t seq = -1,
+                     bool validate = true) {
+  if (validate) {
+    int verdict = validate_pool(*pop, 0, seq, options);
+    if (verdict == ARTHAS_VALIDATION_PASS) return 1;
+    if (verdict == ARTHAS_VALIDATION_FAIL) return -1;
+  }
+  bool pmemobj = strcmp(options.pmem_library, "libpmemobj") == 0;
+  if (pmemobj) pmemobj_close((PMEMobjpool *)*pop);
+  int req_flag = re_execute(options.reexecute_cmd, options.version_num, c_log,
+                            num_data, options.pmem_file, options.pmem_layout,
+                            FINE_GRAIN, -1, s_log);
+  total_reexecutions++;
+  if (pmemobj)
+    *pop = (void *)redo_pmem_addresses(options.pmem_file, options.pmem_layout,
+                                       num_data, s_log);
+  return req_flag;
 }
 
 /* Binary Reversion Function to reduce data loss */
-int binary_reversion(std::vector<int> &seq_list, int l, int r, seq_log *s_log,
+int binary_reversion(std::vector<int64_t> &seq_list, int l, int r, seq_log *s_log,
                      PMEMobjpool **pop, checkpoint_log *c_log, int num_data,
-                     void *pool_address, struct reactor_options &options) {
+                     struct reactor_options &options) {
   int decided_total, req_flag2;
-  int *decided_slice_seq_numbers = (int *)malloc(sizeof(int) * seq_list.size());
-  int starting_seq_num = 0;
+  int64_t *decided_slice_seq_numbers =
+      (int64_t *)malloc(sizeof(int64_t) * seq_list.size());
   if (r >= l) {
     int mid = l + (r - l) / 2;
     auto first_left = seq_list.begin();
-    vector<int>::iterator last_left = seq_list.begin() + (mid + 1);
-    vector<int> left(first_left, last_left);
+    vector<int64_t>::iterator last_left = seq_list.begin() + (mid + 1);
+    vector<int64_t> left(first_left, last_left);
 
-    vector<int>::iterator first_right;
+    vector<int64_t>::iterator first_right;
     if (mid == 0 && seq_list.size() == 1)
       first_right = seq_list.begin() + (mid);
     else
       first_right = seq_list.begin() + (mid + 1);
     auto last_right = seq_list.end();
-    vector<int> right(first_right, last_right);
+    vector<int64_t> right(first_right, last_right);
 
-    int *slice_seq_numbers = (int *)malloc(sizeof(int) * right.size());
+    int64_t *slice_seq_numbers =
+        (int64_t *)malloc(sizeof(int64_t) * right.size());
     printf("slice seq numbers %p %d\n", slice_seq_numbers, (int)right.size());
     copy(right.begin(), right.end(), slice_seq_numbers);
     decided_total = 0;
@@ -453,23 +775,16 @@ int binary_reversion(std::vector<int> &seq_list, int l, int r, seq_log *s_log,
 
     printf("reverting %d\n", decided_total);
     binary_reverted_items = decided_total;
-    revert_by_sequence_number_array(s_log,
-                                    decided_slice_seq_numbers, decided_total,
-                                    c_log);
-    if (strcmp(options.pmem_library, "libpmemobj") == 0) {
-      pmemobj_close(*pop);
-    }
-    if (decided_total > 0) {
+    bool journaled;
+    size_t applied = revert_trial(s_log, decided_slice_seq_numbers,
+                                  decided_total, c_log, *pop, journaled);
+    req_flag2 = 0;
+    if (applied > 0) {
       req_flag2 =
-          re_execute(options.reexecute_cmd, options.version_num,
-                     c_log, num_data, options.pmem_file,
-                     options.pmem_layout, FINE_GRAIN, starting_seq_num,
-                     pool_address, s_log);
-      total_reexecutions++;
+          reexecute_target((void **)pop, c_log, num_data, s_log, options);
+    } else {
+      printf("reversion changes no bytes, skip re-execution\n");
     }
-    if (strcmp(options.pmem_library, "libpmemobj") == 0)
-      *pop = redo_pmem_addresses(options.pmem_file, options.pmem_layout,
-                                 num_data, s_log);
     binary_reversion_count++;
     // Check if succeeded
     if (req_flag2 == 1) {
@@ -479,26 +794,27 @@ int binary_reversion(std::vector<int> &seq_list, int l, int r, seq_log *s_log,
           right.size() == 1) {
         binary_reversion_count = 0;
         binary_success = 1;
+        commit_trial(journaled);
         return 0;
       }
       printf("begin undo\n");
-      undo_by_sequence_number_array(s_log, right);
+      undo_trial(journaled, s_log, right, *pop);
 
       free(decided_slice_seq_numbers);
       free(slice_seq_numbers);
       binary_reversion(right, 0, right.size() - 1, s_log, pop, c_log, num_data,
-                       pool_address, options);
+                       options);
     } else {
       cout << "reversion has failed\n";
       printf("begin undo\n");
 
-      undo_by_sequence_number_array(s_log, right);
+      undo_trial(journaled, s_log, right, *pop);
 
       if (binary_reversion_count > BINARY_REVERSION_ATTEMPTS ||
           left.size() == 1) {
         binary_reversion_count = 0;
         // Reversion + re-execution of left side.
-        int slice_seq_numbers[left.size()];
+        int64_t slice_seq_numbers[left.size()];
         copy(left.begin(), left.end(), slice_seq_numbers);
         decided_total = 0;
         decision_func_sequence_array(slice_seq_numbers, left.size(),
@@ -506,21 +822,16 @@ int binary_reversion(std::vector<int> &seq_list, int l, int r, seq_log *s_log,
         printf("reverting %d\n", decided_total);
         binary_reverted_items = decided_total;
 
-        revert_by_sequence_number_array(s_log,
-                                        decided_slice_seq_numbers,
-                                        decided_total, c_log);
-        if (strcmp(options.pmem_library, "libpmemobj") == 0)
-          pmemobj_close(*pop);
-        if (decided_total > 0) {
-          req_flag2 = re_execute(
-              options.reexecute_cmd, options.version_num, c_log,
-              num_data, options.pmem_file, options.pmem_layout,
-              FINE_GRAIN, starting_seq_num, pool_address, s_log);
-          total_reexecutions++;
+        applied = revert_trial(s_log, decided_slice_seq_numbers,
+                               decided_total, c_log, *pop, journaled);
+        req_flag2 = 0;
+        if (applied > 0) {
+          req_flag2 =
+              reexecute_target((void **)pop, c_log, num_data, s_log, options);
+        } else {
+          printf("reversion changes no bytes, skip re-execution\n");
         }
-        if (strcmp(options.pmem_library, "libpmemobj") == 0)
-          *pop = redo_pmem_addresses(options.pmem_file, options.pmem_layout,
-                                     num_data, s_log);
+        commit_trial(journaled);
         if (req_flag2 == 1) {
           cout << "reversion with sequence numbers array has succeeded\n";
           binary_success = 1;
@@ -530,16 +841,202 @@ int binary_reversion(std::vector<int> &seq_list, int l, int r, seq_log *s_log,
       free(decided_slice_seq_numbers);
       free(slice_seq_numbers);
       binary_reversion(left, 0, left.size() - 1, s_log, pop, c_log, num_data,
-                       pool_address, options);
+                       options);
     }
   }
   return -1;
 }
 
+// State shared by the arckpt searches
+struct arckpt_context {
+  seq_log *s_log;
+  checkpoint_log *c_log;
+  void **pop;
+  int num_data;
+  // newest sequence number, the searches revert suffixes ending at it
+  int64_t high_num;
+  struct reactor_options *options;
+};
+
+// Revert the sequence numbers in (high_num - to, high_num - from] as a
+// trial and re-execute. Returns the re-execution result, 0 if the reversion
+// changed nothing. The trial is left open for the caller to undo or commit.
+static int arckpt_probe(arckpt_context &ctx, int64_t from, int64_t to,
+                        std::vector<int64_t> &seqs, bool &journaled,
+                        bool validate = true) {
+  seqs.clear();
+  for (int64_t i = ctx.high_num - from; i > ctx.high_num - to; i--)
+    seqs.push_back(i);
+  total_reverted_items += seqs.size();
+  size_t applied = 0;
+  bool restored = false;
+  const char *snapshot_dir = ctx.options->snapshot_dir;
+  // snapshots cut through transactions, --tx reverts backwards
+  if (snapshot_dir && !tx_groups) {
+    // past the nearest snapshot, cloning it and replaying forward costs
+    // less than reverting the whole suffix backwards
+    int64_t seq = ctx.high_num - to;
+    struct pool_snapshot snap;
+    if (snapshot_find(ctx.options->pmem_file, snapshot_dir, seq, &snap) == 0 &&
+        snapshot_restore_cost(&snap, ctx.options->pmem_file, seq) <
+            to - from) {
+      long replayed = snapshot_trial_restore(&snap, ctx.pop, *ctx.options,
+                                             ctx.s_log, ctx.c_log, seq);
+      if (replayed >= 0) {
+        restored = true;
+        journaled = false;
+        // the pool changed as a whole, always re-execute
+        applied = replayed + 1;
+      }
+    }
+  }
+  if (!restored)
+    applied = revert_trial(ctx.s_log, seqs.data(), seqs.size(), ctx.c_log,
+                           *ctx.pop, journaled);
+  if (applied == 0) {
+    printf("reversion changes no bytes, skip re-execution\n");
+    return 0;
+  }
+  // --tx reverts whole transactions, more than the suffix
+  int64_t seq = tx_groups ? -1 : ctx.high_num - to;
+  int req_flag =
+      reexecute_target(ctx.pop, ctx.c_log, ctx.num_data, ctx.s_log,
+                       *ctx.options, seq, validate);
+  printf("arckpt with the newest %ld sequence numbers reverted %s\n", to,
+         req_flag == 1 ? "succeeded" : "failed");
+  return req_flag;
+}
+
+// Grow the reverted suffix by step sequence numbers per re-execution
+int arckpt_batched(arckpt_context &ctx, int step) {
+  std::vector<int64_t> seqs;
+  bool journaled;
+  for (int64_t done = 0; done < ctx.high_num; done += step) {
+    int64_t to = min(done + step, ctx.high_num);
+    int req_flag = arckpt_probe(ctx, done, to, seqs, journaled);
+    commit_trial(journaled);
+    if (req_flag == 1) return 1;
+  }
+  return 0;
+}
+
+// Verdict of the validator on a view of the pool with the newest len
+// sequence numbers reverted. Deciding on the view writes nothing to the pool,
+// so there is nothing to undo.
+static int arckpt_check_view(arckpt_context &ctx, int64_t len) {
+  // --tx reverts whole transactions, which the view does not model
+  if (!validator || tx_groups) return ARTHAS_VALIDATION_INCONCLUSIVE;
+  int64_t seq = ctx.high_num - len;
+  pool_overlay *ov = pool_overlay_open(ctx.options->pmem_file, ctx.s_log,
+                                       ctx.c_log, seq);
+  if (!ov) return ARTHAS_VALIDATION_INCONCLUSIVE;
+  int verdict = validate_pool(ov->base, ov->size, seq, *ctx.options);
+  pool_overlay_close(ov);
+  if (verdict != ARTHAS_VALIDATION_INCONCLUSIVE)
+    printf("arckpt with the newest %ld sequence numbers reverted %s on a "
+           "view\n",
+           len, verdict == ARTHAS_VALIDATION_PASS ? "succeeded" : "failed");
+  return verdict;
+}
+
+// Revert the sequence numbers in (high_num - to, high_num - from] for good,
+// without re-executing
+static void arckpt_apply(arckpt_context &ctx, int64_t from, int64_t to) {
+  std::vector<int64_t> seqs;
+  for (int64_t i = ctx.high_num - from; i > ctx.high_num - to; i--)
+    seqs.push_back(i);
+  bool journaled;
+  revert_trial(ctx.s_log, seqs.data(), seqs.size(), ctx.c_log, *ctx.pop,
+               journaled);
+  commit_trial(journaled);
+}
+
+// Find the shortest suffix of sequence numbers whose reversion makes the
+// re-execution succeed with O(log n) re-executions: grow the suffix
+// exponentially until it succeeds, then bisect between the last failing and
+// the first succeeding length. Assumes that reverting more never turns a
+// success into a failure. With a validator, lengths it decides on a view of
+// the pool are never written to the pool.
+int arckpt_gallop(arckpt_context &ctx) {
+  std::vector<int64_t> seqs;
+  bool journaled = false;
+  // lo is the longest suffix known to fail, hi the shortest one known to
+  // succeed. The pool has the newest committed sequence numbers reverted,
+  // and the newest open ones in a trial that stays open until it is either
+  // the answer or undone to probe a shorter suffix.
+  int64_t lo = 0, hi = 0, committed = 0, open = 0;
+  bool hi_viewed = false;
+  for (int64_t len = 1; hi == 0; len = min(len * 2, ctx.high_num)) {
+    int verdict = arckpt_check_view(ctx, len);
+    bool viewed = verdict != ARTHAS_VALIDATION_INCONCLUSIVE;
+    bool passed = verdict == ARTHAS_VALIDATION_PASS;
+    if (!viewed) {
+      passed = arckpt_probe(ctx, committed, len, seqs, journaled, false) == 1;
+      if (passed) {
+        open = len;
+      } else {
+        commit_trial(journaled);
+        committed = len;
+      }
+    }
+    if (passed) {
+      hi = len;
+      hi_viewed = viewed;
+    } else {
+      lo = len;
+      if (len == ctx.high_num) {
+        // leave everything reverted, as a failing search always did
+        arckpt_apply(ctx, committed, len);
+        return 0;
+      }
+    }
+  }
+  while (hi - lo > 1) {
+    int64_t mid = lo + (hi - lo) / 2;
+    int verdict = arckpt_check_view(ctx, mid);
+    bool viewed = verdict != ARTHAS_VALIDATION_INCONCLUSIVE;
+    bool passed = verdict == ARTHAS_VALIDATION_PASS;
+    if (!viewed) {
+      if (open) undo_trial(journaled, ctx.s_log, seqs, *ctx.pop);
+      passed = arckpt_probe(ctx, committed, mid, seqs, journaled, false) == 1;
+      open = 0;
+      if (passed) {
+        open = mid;
+      } else {
+        commit_trial(journaled);
+        committed = mid;
+      }
+    }
+    if (passed) {
+      hi = mid;
+      hi_viewed = viewed;
+    } else {
+      lo = mid;
+    }
+  }
+  if (open == hi) {
+    commit_trial(journaled);
+  } else {
+    if (open) undo_trial(journaled, ctx.s_log, seqs, *ctx.pop);
+    if (hi_viewed) {
+      arckpt_apply(ctx, committed, hi);
+    } else {
+      bool passed = arckpt_probe(ctx, committed, hi, seqs, journaled) == 1;
+      commit_trial(journaled);
+      // the target does not behave the same across re-executions
+      if (!passed) return 0;
+    }
+  }
+  printf("arckpt needs the newest %ld of %ld sequence numbers reverted\n", hi,
+         ctx.high_num);
+  return 1;
+}
+
 // Step 4a: Create hashmap of checkpoint entries where logical seq num
 // is the key
 void Reactor::seq_log_creation(seq_log * &s_log, size_t * &total_size,
-                               seq_log * &r_log, struct checkpoint_log *c_log) {
+                               seq_log * &r_log, struct checkpoint_log *c_log,
+                               tx_index *t_index) {
   // Sequence log creation and handling
   s_log->size = LOG_SIZE;
   s_log->list =
@@ -547,9 +1044,13 @@ void Reactor::seq_log_creation(seq_log * &s_log, size_t * &total_size,
   int i;
   for (i = 0; i < LOG_SIZE; i++) s_log->list[i] = NULL;
 
-  // Ordering by sequence number and then initializing the r_log
+  // Ordering by sequence number (and transaction) and then initializing
+  // the r_log
   *total_size = 0;
-  order_by_sequence_num(s_log, total_size, c_log);
+  order_by_sequence_num_tx(s_log, total_size, c_log, t_index);
+  if (t_index)
+    printf("%lu transactional entries in %lu transactions\n", t_index->total,
+           t_index->count);
   r_log->size = *total_size;
   r_log->list =
       (struct seq_node **)malloc(sizeof(struct seq_node) * *total_size);
@@ -560,90 +1061,31 @@ void Reactor::seq_log_creation(seq_log * &s_log, size_t * &total_size,
 
 }
 
-// Step 4b: Create hashmap of checkpoint entries where transaction id
-// is the key
-void Reactor::tx_log_creation(tx_log *t_log, struct checkpoint_log *c_log) {
-  t_log->size = LOG_SIZE;
-  t_log->list = (struct tx_node **)malloc(sizeof(struct tx_node *) * LOG_SIZE);
-  for (int i = 0; i < LOG_SIZE; i++) t_log->list[i] = NULL;
-
-  order_by_tx_id(t_log, c_log);
-  int pos = txhashCode(t_log, 1);
-  struct tx_node *t_list = t_log->list[pos];
-  struct tx_node *t_temp = t_list;
-  while (t_temp) {
-    printf("data is %f or %d tx id is %d\n",
-           *((double *)t_temp->ordered_data.data),
-           *((int *)t_temp->ordered_data.data), t_temp->ordered_data.tx_id);
-    t_temp = t_temp->next;
-  }
-
-}
-
-// Step 4c: create offset sequence mapping
-void Reactor::offset_seq_creation(multimap<uint64_t, int> &offset_seq_map,
-                struct checkpoint_log *c_log, seq_log * &s_log) {
-  std::cout << "before sort by seq num\n";
-  struct seq_node *list;
-  struct seq_node *temp;
-  for (int i = 0; i < (int)s_log->size; i++) {
-    list = s_log->list[i];
-    temp = list;
-    while (temp) {
-      offset_seq_map.insert(pair<uint64_t, int>(temp->ordered_data.offset,
-                                                temp->sequence_number));
-      temp = temp->next;
-    }
-  }
-}
-
-// Step 4c: sort the addresses arrays by sequence number
-void sort_creation(PmemAddrOffsetList &addr_off_list,
-                            size_t num_data, struct checkpoint_log *c_log,
-                            multimap<uint64_t, int> &offset_seq_map,
-                            seq_log * &s_log){
-  for (int j = 0; j < (int)num_data; j++) {
-    typedef std::multimap<uint64_t, int>::iterator MMAPIterator;
-    std::pair<MMAPIterator, MMAPIterator> result =
-        offset_seq_map.equal_range(addr_off_list.offsets[j]);
-    // Iterate over the range
-    for (MMAPIterator it = result.first; it != result.second; it++) {
-      lookup_modify(s_log, it->second, addr_off_list.pmem_addresses[j]);
-    }
-  }
-  std::cout << "finished multimap iteration\n";
-}
-
-// Step 4c: sort the addresses arrays by sequence number
-void address_seq_creation(multimap<const void *, int> &address_seq_nums,
-                          seq_log * &s_log, int * & sequences, int * highest_num,
+// Step 4c: index the sequence numbers by pool offset. Checkpoints and trace
+// are matched by offset, a rebuilt checkpoint log has no addresses.
+void address_seq_creation(offset_seq_index &offset_seqs,
+                          seq_log * &s_log, int64_t * & sequences,
+                          int64_t * highest_num,
                           std::unique_ptr<ReactorState> & _state,
-                          int *starting_seq_num, Instruction *fault_inst){
-  struct seq_node *list;
-  struct seq_node *temp;
-  int ind = 0;
-  for (int i = 0; i < (int)s_log->size; i++) {
-    list = s_log->list[i];
-    temp = list;
-    while (temp) {
-      address_seq_nums.insert(pair<const void *, int>(
-          temp->ordered_data.address, temp->sequence_number));
-      temp = temp->next;
-    }
+                          int64_t *starting_seq_num, Instruction *fault_inst){
+  if (offset_seq_index_build(&offset_seqs, s_log) != 0) {
+    cerr << "could not index the checkpoints by offset\n";
+    return;
   }
 
-  typedef std::multimap<const void *, int>::iterator MMAPIterator2;
+  int ind = 0;
   for (auto it = _state->addr_trace.begin(); it != _state->addr_trace.end();
        it++) {
     PmemAddrTraceItem *traceItem = *it;
-    if (traceItem->instr == fault_inst) {
-      std::pair<MMAPIterator2, MMAPIterator2> result =
-          address_seq_nums.equal_range((const void *)traceItem->addr);
+    if (traceItem->instr == fault_inst && traceItem->has_pool_offset) {
+      size_t first, last;
+      offset_seq_index_range(&offset_seqs, traceItem->pool_offset,
+                             traceItem->pool_offset, &first, &last);
       // Iterate over the range
       ind = 0;
       *highest_num = -1;
-      for (MMAPIterator2 it = result.first; it != result.second; it++) {
-        sequences[ind] = it->second;
+      for (size_t i = first; i < last; i++) {
+        sequences[ind] = offset_seqs.entries[i].sequence_number;
         if (sequences[ind] > *highest_num) *highest_num = sequences[ind];
         ind++;
       }
@@ -654,9 +1096,81 @@ void address_seq_creation(multimap<const void *, int> &address_seq_nums,
   }
 }
 
+// Step 5c: a site sampled by the address tracker may have touched addresses
+// that never made it into the trace. Widen its candidates to the sequence
+// numbers of every checkpointed offset within the range of offsets the site
+// did record. The sequence numbers of exact_offset were already collected
+// and are skipped. Returns the number of sequence numbers appended, at most
+// capacity - ind.
+int widen_sampled_site(PmemAddrTrace &addr_trace, uint64_t guid,
+                       uint64_t exact_offset, offset_seq_index &offset_seqs,
+                       set<uint64_t> &widened_sites, int64_t *sequences,
+                       int ind, size_t capacity) {
+  if (!addr_trace.siteIncomplete(guid)) return 0;
+  // only widen once per site
+  if (!widened_sites.insert(guid).second) return 0;
+  uint64_t low, high;
+  if (!addr_trace.siteOffsetRange(guid, low, high)) return 0;
+  int widened = 0;
+  size_t first, last;
+  offset_seq_index_range(&offset_seqs, low, high, &first, &last);
+  for (size_t i = first; i < last && (size_t)(ind + widened) < capacity;
+       i++) {
+    if (offset_seqs.entries[i].offset == exact_offset) continue;
+    sequences[ind + widened] = offset_seqs.entries[i].sequence_number;
+    widened++;
+  }
+  return widened;
+}
+
+// Step 5d: the window of clock stamps leading up to the fault, ending at
+// the last traced access of the fault instruction. Returns false if the
+// window is disabled or the trace carries no stamps.
+bool candidate_window(PmemAddrTrace &addr_trace, Instruction *fault_inst,
+                      unsigned long window_ms, uint64_t &low,
+                      uint64_t &high) {
+  if (window_ms == 0 || addr_trace.clock_hz() == 0) return false;
+  uint64_t fault_stamp = 0, last_stamp = 0;
+  for (auto item : addr_trace) {
+    if (item->stamp > last_stamp) last_stamp = item->stamp;
+    if (item->instr == fault_inst && item->stamp > fault_stamp)
+      fault_stamp = item->stamp;
+  }
+  // the fault instruction may not be traced, use the last access instead
+  high = fault_stamp ? fault_stamp : last_stamp;
+  if (high == 0) return false;
+  uint64_t span = addr_trace.clock_hz() / 1000 * window_ms;
+  low = high > span ? high - span : 0;
+  return true;
+}
+
+// Whether any checkpointed version carries a clock stamp. Versions read
+// from the checkpoint pool have none, only the append-only log keeps them.
+bool seq_log_has_timestamps(seq_log *s_log) {
+  for (size_t i = 0; i < s_log->size; i++)
+    for (struct seq_node *n = s_log->list[i]; n; n = n->next)
+      if (n->ordered_data.timestamp != 0) return true;
+  return false;
+}
+
+// Drop the candidates whose version was checkpointed outside the window,
+// versions without a stamp are kept. Returns the number of candidates left.
+int filter_candidate_window(seq_log *s_log, int64_t *sequences, int ind,
+                            uint64_t low, uint64_t high) {
+  int kept = 0;
+  for (int i = 0; i < ind; i++) {
+    single_data data = lookup(s_log, sequences[i]);
+    if (data.sequence_number != -1 && data.timestamp != 0 &&
+        (data.timestamp < low || data.timestamp > high))
+      continue;
+    sequences[kept++] = sequences[i];
+  }
+  return kept;
+}
+
 //finding smallest array elemnt
-int findSmallestElement(int arr[], int n){
-   int temp = arr[0];
+int64_t findSmallestElement(int64_t arr[], int n){
+   int64_t temp = arr[0];
    for(int i=0; i<n; i++) {
       if(temp>arr[i]) {
          temp=arr[i];
@@ -692,13 +1206,19 @@ bool Reactor::react(std::string fault_loc, string inst_str,
   }
 
   void *pop = NULL;
-  size_t mapped_len;
+  size_t mapped_len = 0;
   int is_pmem;
   if (strcmp(options.pmem_library, "libpmemobj") == 0)
     pop = (void *)pmemobj_open(options.pmem_file, options.pmem_layout);
-  else if (strcmp(options.pmem_library, "libpmem") == 0)
-    pop = (void *)pmem_map_file(options.pmem_file, PMEM_LEN, PMEM_FILE_CREATE,
-                                0666, &mapped_len, &is_pmem);
+  else if (strcmp(options.pmem_library, "libpmem") == 0) {
+    // map the existing file once with its exact length, it stays mapped
+    // across all the trials
+    pop = (void *)pmem_map_file(options.pmem_file, 0, 0, 0, &mapped_len,
+                                &is_pmem);
+    if (pop)
+      printf("mapped %lu bytes of %s (%s)\n", mapped_len, options.pmem_file,
+             is_pmem ? "pmem" : "not pmem");
+  }
   if (pop == NULL) {
     cerr << "Could not open pmem file " << options.pmem_file
          << " to get pool start address\n";
@@ -706,16 +1226,93 @@ bool Reactor::react(std::string fault_loc, string inst_str,
   }
   printf("pop is %p\n", pop);
 
+  // what the reaction opens and allocates, released on every return from
+  // here on. The pool may be reopened at another address by the trials.
+  struct reaction_resources {
+    void **pop;
+    bool pmemobj;
+    size_t mapped_len;
+    seq_log *s_log;
+    seq_log *r_log;
+    size_t *total_size;
+    int64_t *sequences;
+    int64_t *slice_seq_numbers;
+    int64_t *decided_slice_seq_numbers;
+    offset_seq_index offset_seqs;
+    ~reaction_resources() {
+      validator_unload(validator);
+      validator = NULL;
+      journal_close(journal);
+      journal = NULL;
+      if (tx_groups) {
+        tx_index_free(tx_groups);
+        free(tx_groups);
+        tx_groups = NULL;
+      }
+      seq_log_free(s_log);
+      seq_log_free(r_log);
+      free(total_size);
+      free(sequences);
+      free(slice_seq_numbers);
+      free(decided_slice_seq_numbers);
+      offset_seq_index_free(&offset_seqs);
+      snapshot_pool = NULL;
+      snapshot_options = NULL;
+      if (*pop == NULL) return;
+      if (pmemobj)
+        pmemobj_close((PMEMobjpool *)*pop);
+      else
+        pmem_unmap(*pop, mapped_len);
+    }
+  } res = {&pop, strcmp(options.pmem_library, "libpmemobj") == 0, mapped_len,
+           NULL, NULL, NULL, NULL, NULL, NULL, {NULL, 0}};
+
+  // undo the trials of a reactor run that died before finishing them
+  string journal_path = string(options.pmem_file) + JOURNAL_SUFFIX;
+  if (journal == NULL)
+    journal = journal_open(journal_path.c_str(), JOURNAL_DEFAULT_SIZE);
+  if (journal) {
+    int undone = journal_recover(journal, pop);
+    if (undone > 0)
+      printf("recovered %d interrupted reversion trials from %s\n", undone,
+             journal_path.c_str());
+  } else {
+    cerr << "could not open reversion journal " << journal_path
+         << ", falling back to undo from the checkpoint log\n";
+  }
+  // re-executions that print the fault location again have failed
+  struct reexec_config reexec = {};
+  for (int i = 0; i < options.fail_signature_count; i++)
+    reexec.signatures[reexec.signature_count++] = options.fail_signatures[i];
+  size_t line_end = fault_loc.find(':');
+  if (line_end != string::npos) line_end = fault_loc.find(':', line_end + 1);
+  fault_signature = fault_loc.substr(0, line_end);
+  // backtraces print paths as compiled, match from the file name on
+  size_t slash = fault_signature.rfind('/');
+  if (slash != string::npos) fault_signature.erase(0, slash + 1);
+  if (fault_signature.find(':') != string::npos)
+    reexec.signatures[reexec.signature_count++] = fault_signature.c_str();
+  reexec.deadline_ms = options.deadline_ms;
+  reexec_configure(&reexec);
+
+  if (options.validator_plugin && validator == NULL) {
+    validator = validator_load(options.validator_plugin, options.validator_arg);
+    if (validator == NULL)
+      cerr << "could not load validator " << options.validator_plugin
+           << ", re-executing every trial\n";
+  }
+
   // Step 2.c: Calculating offsets from pointers
-  // FIXME: assuming last pool is the pool of the pmemobj_open
+  // FIXME: assuming last pool is the pool of the pmemobj_open or
+  // pmem_map_file
   PmemAddrPool &last_pool = _state->addr_trace.pool_addrs().back();
   if (last_pool.addresses.empty()) {
-    cerr << "Last pool " << last_pool.pool_addr->addr_str
+    cerr << "Last pool " << (void *)last_pool.base
          << " has no associated addresses in the trace\n";
     return false;
   }
-  printf("Pool %s has %lu associated addresses in the trace\n",
-         last_pool.pool_addr->addr_str.c_str(), last_pool.addresses.size());
+  printf("Pool %p has %lu associated addresses in the trace\n",
+         (void *)last_pool.base, last_pool.addresses.size());
 
   size_t num_data = last_pool.addresses.size();
   PmemAddrOffsetList addr_off_list(num_data);
@@ -728,8 +1325,10 @@ bool Reactor::react(std::string fault_loc, string inst_str,
 
   // Step 3: Opening Checkpoint Component PMEM File
   std::clock_t time_start = clock();
-  struct checkpoint_log *c_log =
-      reconstruct_checkpoint(options.checkpoint_file, options.pmem_library);
+  struct checkpoint_log *c_log = _state->c_log;
+  if (c_log == NULL)
+    c_log =
+        reconstruct_checkpoint(options.checkpoint_file, options.pmem_library);
   if (c_log == NULL) {
     fprintf(stderr, "abort checkpoint rollback operation\n");
     return 1;
@@ -742,46 +1341,33 @@ bool Reactor::react(std::string fault_loc, string inst_str,
   // Step 4: Fine-grain reversion
   // Step 4a: Create hashmap of checkpoint entries where logical seq num
   // is the key
-  seq_log *s_log = (seq_log *)malloc(sizeof(seq_log));
-  size_t *total_size = (size_t *)malloc(sizeof(size_t));
-  seq_log *r_log = (seq_log *)malloc(sizeof(seq_log));
-  seq_log_creation(s_log, total_size, r_log, c_log);
-
-  // Step 4b: Create hashmap of checkpoint entries where transaction id
-  // is the key
-  tx_log *t_log = (tx_log *)malloc(sizeof(tx_log));
-  tx_log_creation(t_log, c_log);
+  seq_log *s_log = res.s_log = (seq_log *)malloc(sizeof(seq_log));
+  size_t *total_size = res.total_size = (size_t *)malloc(sizeof(size_t));
+  seq_log *r_log = res.r_log = (seq_log *)malloc(sizeof(seq_log));
+  // Step 4b: group the entries by transaction id in the same pass
+  tx_index *t_index = NULL;
+  if (options.tx_reversion) {
+    t_index = (tx_index *)malloc(sizeof(tx_index));
+    tx_index_init(t_index);
+  }
+  seq_log_creation(s_log, total_size, r_log, c_log, t_index);
+  tx_groups = t_index;
 
   // Step 5b: Bring in Slice Graph, find starting point in
   // terms of sequence number (connect LLVM Node to seq number)
-  int starting_seq_num = -1;
-
-  // Step 4c: sort the addresses arrays by sequence number
-  addr_off_list.sorted_addresses = (void **)malloc(num_data * sizeof(void *));
-  addr_off_list.sorted_pmem_addresses =
-      (void **)malloc(num_data * sizeof(void *));
-  time_start = clock();
-  multimap<uint64_t, int> offset_seq_map;
-  offset_seq_creation(offset_seq_map, c_log, s_log);
-  time_end = clock();
-  errs() << "Sort by seq num took  "
-         << 1000.0 * (time_end - time_start) / CLOCKS_PER_SEC << " ms\n";
+  int64_t starting_seq_num = -1;
 
-  std::cout << "insert into multimap" << num_data << "\n";
-  time_start = clock();
-  sort_creation(addr_off_list, num_data, c_log, offset_seq_map, s_log);
-  time_end = clock();
-  errs() << "Multimap iteration took  "
-         << 1000.0 * (time_end - time_start) / CLOCKS_PER_SEC << " ms\n";
+  // Step 4c: entries only keep pool offsets, which are resolved against
+  // the base of the currently open pool when they are written
+  set_pool_base(pop);
   time_start = clock();
 
-
-  int *sequences = (int *)malloc(sizeof(int) * s_log->size);
-  multimap<const void *, int> address_seq_nums;
-  int highest_num = -1;
-  address_seq_creation(address_seq_nums, s_log, sequences, &highest_num,
+  int64_t *sequences = res.sequences =
+      (int64_t *)malloc(sizeof(int64_t) * s_log->size);
+  offset_seq_index &offset_seqs = res.offset_seqs;
+  int64_t highest_num = -1;
+  address_seq_creation(offset_seqs, s_log, sequences, &highest_num,
                        _state, &starting_seq_num, fault_inst);
-  typedef std::multimap<const void *, int>::iterator MMAPIterator2;
   int ind = 0;
   time_end = clock();
   errs() << "highest num/starting seq num took  "
@@ -789,69 +1375,73 @@ bool Reactor::react(std::string fault_loc, string inst_str,
   time_start = clock();
 
   int req_flag2 = 0;
-  int *slice_seq_numbers = (int *)malloc(sizeof(int) * s_log->size);
+  int64_t *slice_seq_numbers = res.slice_seq_numbers =
+      (int64_t *)malloc(sizeof(int64_t) * s_log->size);
   int slice_seq_iterator = 0;
-  single_data empty_data;
+  single_data empty_data = {};
   starting_seq_num = -1;
   if (starting_seq_num != -1) {
     slice_seq_iterator = 1;
     slice_seq_numbers[0] = starting_seq_num;
     insert(r_log, starting_seq_num, empty_data);
   }
-  int high_num = find_highest_seq_num(s_log);
+  int64_t high_num = find_highest_seq_num(s_log);
   time_end = clock();
   errs() << "zzz high num took  "
          << 1000.0 * (time_end - time_start) / CLOCKS_PER_SEC << " ms\n";
   time_start = clock();
-  printf("zzz high num is %d\n", high_num);
-  int *decided_slice_seq_numbers = (int *)malloc(sizeof(int) * s_log->size);
+  printf("zzz high num is %ld\n", high_num);
+  int64_t *decided_slice_seq_numbers = res.decided_slice_seq_numbers =
+      (int64_t *)malloc(sizeof(int64_t) * s_log->size);
 
   time_end = clock();
   errs() << "pmem addr trace creation took  "
          << 1000.0 * (time_end - time_start) / CLOCKS_PER_SEC << " ms\n";
   time_start = clock();
 
-  //ArCkpt
-  //arckpt(high_num, decided_slice_seq_numbers);
-  if(options.arckpt){
-    printf("begin arcpkt\n");
-    int cpkt_ind = high_num;
-    while(cpkt_ind > 0){
-      ind = 0;
-      decided_slice_seq_numbers[ind] = cpkt_ind;
-      cpkt_ind--;
-      ind++;
-      total_reverted_items++;
-      total_reexecutions++;
-      revert_by_sequence_number_array(s_log,
-                                  decided_slice_seq_numbers, ind, c_log );
-      if (strcmp(options.pmem_library, "libpmemobj") == 0)
-              pmemobj_close((PMEMobjpool *)pop);
-      req_flag2 = re_execute(
-            options.reexecute_cmd, options.version_num, c_log,
-            num_data, options.pmem_file, options.pmem_layout, FINE_GRAIN,
-            starting_seq_num, (void *)last_pool.pool_addr->addr, s_log);
-       if(req_flag2 ==1){
-          printf("reversion has succeeded\n");
-          fprintf(fp, "%d items reverted\n", total_reverted_items);
-          fprintf(fp, "total re-executions is %d\n", total_reexecutions);
-          fclose(fp);
-          printf("reversion has succeeded\n");
-          return 1;
-       }
-       pop = (void *)redo_pmem_addresses(options.pmem_file, options.pmem_layout,
-                                          num_data, s_log);
+  if (options.arckpt != ARCKPT_NONE) {
+    printf("begin arckpt\n");
+    arckpt_context ctx = {s_log, c_log, &pop, (int)num_data, high_num,
+                          &options};
+    int req_flag;
+    if (options.arckpt == ARCKPT_GALLOP)
+      req_flag = arckpt_gallop(ctx);
+    else if (options.arckpt == ARCKPT_BATCH)
+      req_flag = arckpt_batched(ctx, options.batch_threshold > 0
+                                         ? options.batch_threshold
+                                         : ARCKPT_DEFAULT_BATCH);
+    else
+      req_flag = arckpt_batched(ctx, 1);
+    if (req_flag == 1) {
+      printf("reversion has succeeded\n");
+      fprintf(fp, "%d items reverted\n", total_reverted_items);
+      fprintf(fp, "total re-executions is %d\n", total_reexecutions);
+      fclose(fp);
     }
-    printf("finished arcpkt\n");
+    printf("finished arckpt\n");
     return 1;
   }
 
 
   // std::set <Instruction *> found_instructions;
-  vector<int> many_address_seq;
+  vector<int64_t> many_address_seq;
   int it_count = 0;
   int slice_id = 0;
   bool many_address_clear = false;
+  set<uint64_t> widened_sites;
+  uint64_t window_low = 0, window_high = 0;
+  bool windowed = candidate_window(_state->addr_trace, fault_inst,
+                                   options.candidate_window_ms, window_low,
+                                   window_high);
+  if (windowed && !seq_log_has_timestamps(s_log)) {
+    printf("candidate window is unavailable, the checkpointed versions "
+           "carry no timestamps\n");
+    windowed = false;
+  }
+  if (windowed) {
+    printf("keeping candidates checkpointed within %lu ms before the fault\n",
+           options.candidate_window_ms);
+  }
   for (Slice *slice : fault_slices) {
     cout << "Slice " << slice_id << "\n";
     slice_id++;
@@ -865,16 +1455,25 @@ bool Reactor::react(std::string fault_loc, string inst_str,
         // for dep_inst, find address inside of ordered_data,
         // find corresponding sequence numbers for address
         PmemAddrTraceItem *traceItem = trace_it->second;
-        if (traceItem->instr == dep_inst) {
-          std::pair<MMAPIterator2, MMAPIterator2> result =
-              address_seq_nums.equal_range((const void *)traceItem->addr);
+        if (traceItem->instr == dep_inst && traceItem->has_pool_offset) {
+          size_t first, last;
+          offset_seq_index_range(&offset_seqs, traceItem->pool_offset,
+                                 traceItem->pool_offset, &first, &last);
           // Iterate over the range
           ind = 0;
-          for (MMAPIterator2 it = result.first; it != result.second; it++) {
-            sequences[ind] = it->second;
+          for (size_t i = first; i < last && (size_t)ind < s_log->size; i++) {
+            sequences[ind] = offset_seqs.entries[i].sequence_number;
             ind++;
           }
-          sort(sequences, sequences + ind, greater<int>());
+          ind += widen_sampled_site(_state->addr_trace, traceItem->guid,
+                                    traceItem->pool_offset, offset_seqs,
+                                    widened_sites, sequences, ind,
+                                    s_log->size);
+          if (windowed) {
+            ind = filter_candidate_window(s_log, sequences, ind, window_low,
+                                          window_high);
+          }
+          sort(sequences, sequences + ind, greater<int64_t>());
           for (int i = ind - 1; i >= 0; i--) {
             int search_num = rev_lookup(r_log, sequences[i]);
             if (sequences[i] != -1 && search_num != 1) {
@@ -901,7 +1500,7 @@ bool Reactor::react(std::string fault_loc, string inst_str,
         binary_success = -1;
         binary_reversion(many_address_seq, 0, many_address_seq.size() - 1,
                              s_log, (PMEMobjpool **)&pop, c_log, num_data,
-                             (void *)last_pool.pool_addr->addr, options);
+                             options);
         total_reverted_items += binary_reverted_items;
         printf("done with binary reversion %d\n", binary_success);
         printf("total reverted items is %d\n", total_reverted_items);
@@ -922,20 +1521,21 @@ bool Reactor::react(std::string fault_loc, string inst_str,
       // Here we should do reversion on collected seq numbers and try
       // try reexecution
       if (slice_seq_iterator >= 1 && many_address_seq.size() < BATCH_REEXECUTION && !many_address_clear) {
-        int *decided_slice_seq_numbers =
-            (int *)malloc(sizeof(int) * s_log->size);
+        int64_t *decided_slice_seq_numbers =
+            (int64_t *)malloc(sizeof(int64_t) * s_log->size);
         int *decided_total = (int *)malloc(sizeof(int));
         *decided_total = 0;
         decision_func_sequence_array(slice_seq_numbers, slice_seq_iterator,
                                      decided_slice_seq_numbers, decided_total);
-        revert_by_sequence_number_array(s_log, decided_slice_seq_numbers,
-                                        *decided_total, c_log);
+        size_t applied = revert_candidates(s_log, decided_slice_seq_numbers,
+                                           *decided_total, c_log);
         if(ROLLBACK_MODE){
-          int lowest_number = findSmallestElement(decided_slice_seq_numbers,
-                                                   *decided_total);
-          int *rollback_seq_numbers = (int *)malloc(sizeof(int) * s_log->size);
+          int64_t lowest_number =
+              findSmallestElement(decided_slice_seq_numbers, *decided_total);
+          int64_t *rollback_seq_numbers =
+              (int64_t *)malloc(sizeof(int64_t) * s_log->size);
           int total_rollback = 0;
-          for(int i = high_num - 1; i >= lowest_number; i--){
+          for(int64_t i = high_num - 1; i >= lowest_number; i--){
             int s_num = rev_lookup(r_log, i);
             if(s_num != 1){
               rollback_seq_numbers[total_rollback] = i;
@@ -943,35 +1543,23 @@ bool Reactor::react(std::string fault_loc, string inst_str,
               insert(r_log, i, empty_data);
             }
           }
-          revert_by_sequence_number_array(s_log, rollback_seq_numbers,
-                                          total_rollback, c_log);
+          applied += revert_candidates(s_log, rollback_seq_numbers,
+                                       total_rollback, c_log);
           high_num = lowest_number;
         }
-        // Function that iterates through decided slice seq numbers
-        // gets the tx_ids associated with them, also reverts those values.
-        /* revert_by_transaction(addr_off_list.sorted_pmem_addresses, t_log,
-                             decided_slice_seq_numbers, *decided_total,
-           s_log);*/
-        if (*decided_total > 0) {
-          if (strcmp(options.pmem_library, "libpmemobj") == 0)
-            pmemobj_close((PMEMobjpool *)pop);
-          req_flag2 = re_execute(
-              options.reexecute_cmd, options.version_num, c_log,
-              num_data, options.pmem_file, options.pmem_layout,
-              FINE_GRAIN, starting_seq_num, (void *)last_pool.pool_addr->addr,
-              s_log);
-          total_reexecutions++;
-          pop = (void *)redo_pmem_addresses(
-              options.pmem_file, options.pmem_layout, num_data,
-              s_log);
+        if (*decided_total > 0 && applied == 0)
+          printf("reversion changes no bytes, skip re-execution\n");
+        if (applied > 0) {
+          req_flag2 = reexecute_target(&pop, c_log, num_data, s_log, options);
           total_reverted_items += *decided_total;
         }
+        free(decided_slice_seq_numbers);
+        free(decided_total);
         if (req_flag2 == 1) {
           cout << "reversion with sequence numbers array has succeeded\n";
           printf("total re-executions is %d\n", total_reexecutions);
           return 1;
         }
-        free(decided_slice_seq_numbers);
       }  // if(slice_seq_iterator >= 1 && many_address_seq.size() < 11)
       if (starting_seq_num != -1)
         slice_seq_iterator = 1;
@@ -1004,14 +1592,10 @@ PmemAddrOffsetList::PmemAddrOffsetList(size_t size) {
   offsets = (uint64_t *)malloc(num_data * sizeof(uint64_t));
   addresses = (void **)malloc(num_data * sizeof(void *));
   pmem_addresses = (void **)malloc(num_data * sizeof(void *));
-  sorted_addresses = nullptr;
-  sorted_pmem_addresses = nullptr;
 }
 
 PmemAddrOffsetList::~PmemAddrOffsetList() {
   if (offsets) free(offsets);
   if (addresses) free(addresses);
   if (pmem_addresses) free(pmem_addresses);
-  if (sorted_addresses) free(sorted_addresses);
-  if (sorted_pmem_addresses) free(sorted_pmem_addresses);
 }
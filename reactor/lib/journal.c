@@ -0,0 +1,207 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#include "journal.h"
+
+#include <libpmem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_FIRST_ENTRY sizeof(struct journal_header)
+#define JOURNAL_ALIGN(x) (((x) + 7) & ~7UL)
+
+static struct journal_entry *journal_entry_at(struct reversion_journal *j,
+                                              uint64_t off) {
+  return (struct journal_entry *)((char *)j->hdr + off);
+}
+
+static uint64_t journal_entry_end(struct reversion_journal *j, uint64_t off) {
+  if (off == 0) return JOURNAL_FIRST_ENTRY;
+  struct journal_entry *e = journal_entry_at(j, off);
+  return off + sizeof(struct journal_entry) + JOURNAL_ALIGN(e->size);
+}
+
+static void journal_persist(struct reversion_journal *j, void *addr,
+                            size_t len) {
+  if (j->is_pmem)
+    pmem_persist(addr, len);
+  else
+    pmem_msync(addr, len);
+}
+
+// Drop everything after the entry at off (0 empties the journal)
+static void journal_truncate(struct reversion_journal *j, uint64_t off) {
+  j->hdr->last = off;
+  journal_persist(j, &j->hdr->last, sizeof(j->hdr->last));
+  j->appended = off;
+  j->tail = journal_entry_end(j, off);
+}
+
+static uint64_t journal_append(struct reversion_journal *j, uint32_t type,
+                               uint64_t offset, const void *data,
+                               size_t size) {
+  uint64_t need = sizeof(struct journal_entry) + JOURNAL_ALIGN(size);
+  if (j->tail + need > j->hdr->capacity) {
+    fprintf(stderr, "reversion journal is full\n");
+    return 0;
+  }
+  uint64_t off = j->tail;
+  struct journal_entry *e = journal_entry_at(j, off);
+  e->type = type;
+  e->prev = j->appended;
+  e->offset = offset;
+  e->size = size;
+  if (j->is_pmem) {
+    pmem_flush(e, sizeof(*e));
+    if (size) pmem_memcpy_nodrain(e + 1, data, size);
+  } else if (size) {
+    memcpy(e + 1, data, size);
+  }
+  j->appended = off;
+  j->tail = off + need;
+  return off;
+}
+
+struct reversion_journal *journal_open(const char *path, size_t size) {
+  struct reversion_journal *j =
+      (struct reversion_journal *)calloc(1, sizeof(struct reversion_journal));
+  if (!j) return NULL;
+  // an existing journal is opened with its own size
+  void *addr = pmem_map_file(path, 0, 0, 0, &j->mapped_len, &j->is_pmem);
+  if (addr == NULL)
+    addr = pmem_map_file(path, size, PMEM_FILE_CREATE, 0666, &j->mapped_len,
+                         &j->is_pmem);
+  if (addr == NULL) {
+    fprintf(stderr, "failed to map reversion journal %s: %s\n", path,
+            pmem_errormsg());
+    free(j);
+    return NULL;
+  }
+  j->hdr = (struct journal_header *)addr;
+  if (j->hdr->magic == 0) {
+    // a new journal, the magic goes in last
+    memset(j->hdr, 0, sizeof(struct journal_header));
+    j->hdr->version = JOURNAL_VERSION;
+    j->hdr->capacity = j->mapped_len;
+    journal_persist(j, j->hdr, sizeof(struct journal_header));
+    j->hdr->magic = JOURNAL_MAGIC;
+    journal_persist(j, &j->hdr->magic, sizeof(j->hdr->magic));
+  } else if (j->hdr->magic != JOURNAL_MAGIC ||
+             j->hdr->version != JOURNAL_VERSION ||
+             j->hdr->capacity > j->mapped_len) {
+    fprintf(stderr, "%s is not a valid reversion journal\n", path);
+    pmem_unmap(addr, j->mapped_len);
+    free(j);
+    return NULL;
+  }
+  j->appended = j->hdr->last;
+  j->tail = journal_entry_end(j, j->hdr->last);
+  // trials that were open when the reactor stopped
+  for (uint64_t off = j->hdr->last; off;) {
+    struct journal_entry *e = journal_entry_at(j, off);
+    if (e->type == JOURNAL_TRIAL) j->depth++;
+    off = e->prev;
+  }
+  return j;
+}
+
+void journal_close(struct reversion_journal *j) {
+  if (!j) return;
+  journal_publish(j);
+  pmem_unmap(j->hdr, j->mapped_len);
+  free(j);
+}
+
+// Make the appended entries durable and visible, must be called before the
+// locations they describe are overwritten
+void journal_publish(struct reversion_journal *j) {
+  struct journal_header *hdr = j->hdr;
+  if (hdr->last == j->appended) return;
+  uint64_t from = journal_entry_end(j, hdr->last);
+  if (j->is_pmem)
+    pmem_drain();
+  else
+    pmem_msync((char *)hdr + from, j->tail - from);
+  hdr->last = j->appended;
+  journal_persist(j, &hdr->last, sizeof(hdr->last));
+}
+
+// Open a (possibly nested) trial, returns the new depth or -1
+int journal_begin_trial(struct reversion_journal *j) {
+  if (!journal_append(j, JOURNAL_TRIAL, 0, NULL, 0)) return -1;
+  journal_publish(j);
+  return ++j->depth;
+}
+
+// Save the bytes at pmem_address before the current trial overwrites them.
+// The image is only durable after journal_publish. Returns -1 on failure.
+int journal_record(struct reversion_journal *j, void *pool_base,
+                   void *pmem_address, size_t size) {
+  if (j->depth == 0) return -1;
+  uint64_t offset = (uint64_t)pmem_address - (uint64_t)pool_base;
+  if (!journal_append(j, JOURNAL_IMAGE, offset, pmem_address, size)) return -1;
+  return 0;
+}
+
+// Restore the images of the innermost trial in reverse order and close it.
+// Returns the number of images restored, or -1 if no trial is open.
+int journal_undo_trial(struct reversion_journal *j, void *pool_base) {
+  if (j->depth == 0) return -1;
+  journal_publish(j);
+  int restored = 0;
+  uint64_t off = j->hdr->last;
+  struct journal_entry *e = NULL;
+  while (off) {
+    e = journal_entry_at(j, off);
+    if (e->type == JOURNAL_TRIAL) break;
+    if (e->type == JOURNAL_IMAGE) {
+      pmem_memcpy_nodrain((char *)pool_base + e->offset, e + 1, e->size);
+      restored++;
+    }
+    off = e->prev;
+  }
+  pmem_drain();
+  // only forget the trial once the restored bytes are durable
+  journal_truncate(j, e ? e->prev : 0);
+  j->depth--;
+  return restored;
+}
+
+// Keep the changes of the innermost trial. Its images become part of the
+// enclosing trial; at the outermost level the journal is emptied. Returns
+// the new depth, or -1 if no trial is open.
+int journal_commit_trial(struct reversion_journal *j) {
+  if (j->depth == 0) return -1;
+  journal_publish(j);
+  for (uint64_t off = j->hdr->last; off;) {
+    struct journal_entry *e = journal_entry_at(j, off);
+    if (e->type == JOURNAL_TRIAL) {
+      e->type = JOURNAL_MERGED;
+      journal_persist(j, &e->type, sizeof(e->type));
+      break;
+    }
+    off = e->prev;
+  }
+  if (--j->depth == 0) journal_truncate(j, 0);
+  return j->depth;
+}
+
+// Undo the trials left open by a reactor that died, returns their number
+int journal_recover(struct reversion_journal *j, void *pool_base) {
+  int undone = 0;
+  while (j->depth > 0) {
+    int restored = journal_undo_trial(j, pool_base);
+    printf("undid interrupted reversion trial, %d locations restored\n",
+           restored);
+    undone++;
+  }
+  // committed trials whose journal was not emptied yet
+  if (j->hdr->last) journal_truncate(j, 0);
+  return undone;
+}
@@ -0,0 +1,246 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#include "overlay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint_index.h"
+#include "rollback.h"
+
+static size_t overlay_page_size;
+// open views, searched by the fault handler
+static pool_overlay *overlays = NULL;
+static struct sigaction overlay_prev_segv;
+static int overlay_handler_installed = 0;
+
+static int overlay_ref_cmp(const void *a, const void *b) {
+  const struct overlay_page_ref *r1 = (const struct overlay_page_ref *)a;
+  const struct overlay_page_ref *r2 = (const struct overlay_page_ref *)b;
+  if (r1->page != r2->page) return r1->page < r2->page ? -1 : 1;
+  return (r1->patch > r2->patch) - (r1->patch < r2->patch);
+}
+
+// Overlay the patches of a page, clipped to it
+static void overlay_build_page(pool_overlay *ov, uint64_t page) {
+  if (ov->built[page]) return;
+  char *page_addr = ov->base + page * overlay_page_size;
+  mprotect(page_addr, overlay_page_size, PROT_READ | PROT_WRITE);
+  // first ref of the page
+  size_t lo = 0, hi = ov->ref_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ov->refs[mid].page < page)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  uint64_t page_start = page * overlay_page_size;
+  uint64_t page_end = page_start + overlay_page_size;
+  for (size_t i = lo; i < ov->ref_count && ov->refs[i].page == page; i++) {
+    const struct overlay_patch *p = &ov->patches[ov->refs[i].patch];
+    uint64_t start = p->offset > page_start ? p->offset : page_start;
+    uint64_t end = p->offset + p->size < page_end ? p->offset + p->size
+                                                  : page_end;
+    memcpy(ov->base + start, (const char *)p->data + (start - p->offset),
+           end - start);
+  }
+  ov->built[page] = 1;
+  ov->built_count++;
+}
+
+static void overlay_segv_handler(int sig, siginfo_t *info, void *ctx) {
+  char *addr = (char *)info->si_addr;
+  int saved_errno = errno;
+  pool_overlay *ov = overlays;
+  while (ov && (addr < ov->base || addr >= ov->base + ov->size)) ov = ov->next;
+  if (ov) {
+    uint64_t page = (uint64_t)(addr - ov->base) / overlay_page_size;
+    if (!ov->built[page]) {
+      overlay_build_page(ov, page);
+      errno = saved_errno;
+      return;
+    }
+  }
+  errno = saved_errno;
+  // not a page of a view, or a fault on a built one
+  if (overlay_prev_segv.sa_flags & SA_SIGINFO) {
+    overlay_prev_segv.sa_sigaction(sig, info, ctx);
+  } else if (overlay_prev_segv.sa_handler != SIG_IGN &&
+             overlay_prev_segv.sa_handler != SIG_DFL) {
+    overlay_prev_segv.sa_handler(sig);
+  } else {
+    // returning re-executes the faulting instruction with the default
+    // action. The handler is no longer installed, the next view puts it back.
+    sigaction(SIGSEGV, &overlay_prev_segv, NULL);
+    overlay_handler_installed = 0;
+  }
+}
+
+static int overlay_install_handler(void) {
+  if (overlay_handler_installed) return 0;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = overlay_segv_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGSEGV, &sa, &overlay_prev_segv) != 0) {
+    perror("sigaction");
+    return -1;
+  }
+  overlay_handler_installed = 1;
+  return 0;
+}
+
+// Collect the version every offset written after seq had at seq. The
+// oldest entry after seq decides, its reversion target is that version.
+static int overlay_collect(pool_overlay *ov, seq_log *s_log,
+                           struct checkpoint_log *c_log) {
+  int64_t high = find_highest_seq_num(s_log);
+  if (high <= ov->seq) return 0;
+  uint64_t buckets = checkpoint_index_buckets_for(high - ov->seq);
+  void *mem;
+  if (posix_memalign(&mem, 64, checkpoint_index_size(buckets)) != 0)
+    return -1;
+  struct checkpoint_index *seen = (struct checkpoint_index *)mem;
+  checkpoint_index_init(seen, buckets);
+  size_t capacity = 0, ref_capacity = 0;
+  int ret = 0;
+  for (int64_t s = ov->seq + 1; s <= high; s++) {
+    single_data entry = lookup(s_log, s);
+    if (entry.sequence_number == -1) continue;
+    if (checkpoint_index_find(seen, entry.offset) != CHECKPOINT_INDEX_NONE)
+      continue;
+    checkpoint_index_insert(seen, entry.offset, 0);
+    size_t size;
+    const void *data = revert_target_version(&entry, c_log, &size);
+    // first checkpointed after seq, there is nothing older to overlay
+    if (!data || size == 0 || entry.offset + size > ov->size) continue;
+    if (ov->patch_count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      struct overlay_patch *grown = (struct overlay_patch *)realloc(
+          ov->patches, capacity * sizeof(struct overlay_patch));
+      if (!grown) {
+        ret = -1;
+        break;
+      }
+      ov->patches = grown;
+    }
+    struct overlay_patch *p = &ov->patches[ov->patch_count];
+    p->offset = entry.offset;
+    p->size = size;
+    p->data = data;
+    uint64_t first = p->offset / overlay_page_size;
+    uint64_t last = (p->offset + p->size - 1) / overlay_page_size;
+    if (ov->ref_count + (last - first + 1) > ref_capacity) {
+      ref_capacity = (ref_capacity ? ref_capacity * 2 : 64) + (last - first);
+      struct overlay_page_ref *grown = (struct overlay_page_ref *)realloc(
+          ov->refs, ref_capacity * sizeof(struct overlay_page_ref));
+      if (!grown) {
+        ret = -1;
+        break;
+      }
+      ov->refs = grown;
+    }
+    for (uint64_t page = first; page <= last; page++) {
+      ov->refs[ov->ref_count].page = page;
+      ov->refs[ov->ref_count].patch = (uint32_t)ov->patch_count;
+      ov->ref_count++;
+    }
+    ov->patch_count++;
+  }
+  free(seen);
+  qsort(ov->refs, ov->ref_count, sizeof(struct overlay_page_ref),
+        overlay_ref_cmp);
+  return ret;
+}
+
+pool_overlay *pool_overlay_open(const char *pool_path, seq_log *s_log,
+                                struct checkpoint_log *c_log, int64_t seq) {
+  if (!overlay_page_size) overlay_page_size = sysconf(_SC_PAGESIZE);
+  if (overlay_install_handler() != 0) return NULL;
+  int fd = open(pool_path, O_RDONLY);
+  if (fd < 0) {
+    perror(pool_path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  pool_overlay *ov = (pool_overlay *)calloc(1, sizeof(pool_overlay));
+  if (!ov) {
+    close(fd);
+    return NULL;
+  }
+  ov->size = st.st_size;
+  ov->seq = seq;
+  // private, so neither the patches nor writes through the view reach the
+  // file
+  ov->base = (char *)mmap(NULL, ov->size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ov->base == MAP_FAILED) {
+    perror("mmap");
+    free(ov);
+    return NULL;
+  }
+  ov->page_count = (ov->size + overlay_page_size - 1) / overlay_page_size;
+  ov->built = (uint8_t *)calloc(ov->page_count, 1);
+  if (!ov->built || overlay_collect(ov, s_log, c_log) != 0) {
+    pool_overlay_close(ov);
+    return NULL;
+  }
+  // pages with versions to overlay fault on first access
+  for (size_t i = 0; i < ov->ref_count; i++) {
+    if (i > 0 && ov->refs[i].page == ov->refs[i - 1].page) continue;
+    mprotect(ov->base + ov->refs[i].page * overlay_page_size,
+             overlay_page_size, PROT_NONE);
+    ov->overlaid_pages++;
+  }
+  ov->next = overlays;
+  overlays = ov;
+  return ov;
+}
+
+const void *pool_overlay_read(pool_overlay *ov, uint64_t offset, size_t len) {
+  if (len == 0 || offset >= ov->size || len > ov->size - offset) return NULL;
+  uint64_t last = (offset + len - 1) / overlay_page_size;
+  for (uint64_t page = offset / overlay_page_size; page <= last; page++)
+    overlay_build_page(ov, page);
+  return ov->base + offset;
+}
+
+size_t pool_overlay_changes(const pool_overlay *ov, const void *live_base) {
+  size_t changes = 0;
+  for (size_t i = 0; i < ov->patch_count; i++) {
+    const struct overlay_patch *p = &ov->patches[i];
+    if (memcmp((const char *)live_base + p->offset, p->data, p->size) != 0)
+      changes++;
+  }
+  return changes;
+}
+
+void pool_overlay_close(pool_overlay *ov) {
+  pool_overlay **link = &overlays;
+  while (*link && *link != ov) link = &(*link)->next;
+  if (*link) *link = ov->next;
+  if (ov->base && ov->base != MAP_FAILED) munmap(ov->base, ov->size);
+  free(ov->patches);
+  free(ov->refs);
+  free(ov->built);
+  free(ov);
+}
@@ -21,7 +21,7 @@
 // declaration below. It can optionally include additional short option
 // specifiers that do not have a corresponding long-option. ':'
 // after the character means this opt requires an argument.
-#define REACTOR_ARGS "hp:t:l:n:r:g:a:i:c:b:z:"
+#define REACTOR_ARGS "hp:t:l:n:r:g:a:i:c:b:z:e:w:d:m:s:v:V:f:D:"
 
 // Reference:
 // https://www.gnu.org/software/libc/manual/html_node/Getopt-Long-Options.html
@@ -40,6 +40,7 @@ static int support_thread = 0;
 static int intra_procedural = 0;
 static int inter_procedural = 1;  // by default inter-procedural
 static int entry_only = 0;
+static int tx_reversion = 0;
 
 static struct option long_options[] = {
     /* These options set a flag. */
@@ -55,6 +56,7 @@ static struct option long_options[] = {
     {"intra", no_argument, &intra_procedural, 1},
     {"inter", no_argument, &inter_procedural, 1},
     {"entry-only", no_argument, &entry_only, 1},
+    {"tx", no_argument, &tx_reversion, 1},
     /* These options don't set a flag.
        We distinguish them by their indices. */
     {"pmem-file", required_argument, 0, 'p'},
@@ -69,6 +71,14 @@ static struct option long_options[] = {
     {"bc-file", required_argument, 0, 'b'},
     {"batch-threshold", required_argument, 0, 'e'},
     {"arckpt", required_argument, 0, 'z'},
+    {"window", required_argument, 0, 'w'},
+    {"history-depth", required_argument, 0, 'd'},
+    {"history-mb", required_argument, 0, 'm'},
+    {"snapshot-dir", required_argument, 0, 's'},
+    {"validator", required_argument, 0, 'v'},
+    {"validator-arg", required_argument, 0, 'V'},
+    {"fail-signature", required_argument, 0, 'f'},
+    {"deadline", required_argument, 0, 'D'},
     {0, 0, 0, 0}};
 
 void usage() {
@@ -95,8 +105,30 @@ void usage() {
       "  -c  --fault-loc  <file:line\n"
       "                   [:func]>    : location of the fault instruction \n"
       "  -b  --bc-file <file>         : bytecode file \n"
-      "  -z  --arckpt                 : arckpt\n"
+      "  -z  --arckpt <mode>          : revert the newest sequence numbers\n"
+      "                                 until re-execution succeeds, mode is\n"
+      "                                 linear, batch or gallop\n"
       "  -e  --batch-threshold        : number of items to batch in a reversion\n"
+      "  -w  --window <msec>          : only revert versions checkpointed\n"
+      "                                 within msec before the fault\n"
+      "  -d  --history-depth <n>      : versions to keep per variable\n"
+      "  -m  --history-mb <MB>        : memory budget of the version history,\n"
+      "                                 evicting the oldest versions of the\n"
+      "                                 largest variable histories first\n"
+      "  -s  --snapshot-dir <dir>     : restore arckpt reversions that reach\n"
+      "                                 past a pool snapshot in dir from it\n"
+      "  -v  --validator <plugin.so>  : check trials on the pool state with\n"
+      "                                 the plugin, re-executing only when it\n"
+      "                                 is inconclusive\n"
+      "  -V  --validator-arg <arg>    : argument passed to the validator\n"
+      "  -f  --fail-signature <text>  : output that marks a failed\n"
+      "                                 re-execution, which is killed once\n"
+      "                                 it shows up, can be repeated. The\n"
+      "                                 file:line of --fault-loc is one too\n"
+      "  -D  --deadline <msec>        : kill re-executions that run longer\n"
+      "                                 and count them as failed\n"
+      "      --tx                     : revert whole transactions of the\n"
+      "                                 candidates\n"
       "\nSlicer Options:\n"
       "      --pta                    : enable pointer analysis\n"
       "      --no-pta                 : disable pointer analysis\n"
@@ -146,10 +178,68 @@ bool parse_options(int argc, char *argv[], reactor_options_t &options) {
         options.hook_guid_file = optarg;
         break;
       case 'z':
-        options.arckpt = optarg;
+        if (strcmp(optarg, "linear") == 0)
+          options.arckpt = ARCKPT_LINEAR;
+        else if (strcmp(optarg, "batch") == 0)
+          options.arckpt = ARCKPT_BATCH;
+        else if (strcmp(optarg, "gallop") == 0)
+          options.arckpt = ARCKPT_GALLOP;
+        else {
+          fprintf(stderr, "arckpt mode must be linear, batch or gallop\n");
+          return false;
+        }
         break;
       case 'e':
         options.batch_threshold = strtol(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0' || options.batch_threshold <= 0) {
+          fprintf(stderr, "batch threshold must be a positive integer\n");
+          return false;
+        }
+        break;
+      case 'w':
+        options.candidate_window_ms = strtoul(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "window must be a number of milliseconds\n");
+          return false;
+        }
+        break;
+      case 'd':
+        options.history_depth = strtoul(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0' || options.history_depth < 2) {
+          fprintf(stderr, "history depth must be at least 2\n");
+          return false;
+        }
+        break;
+      case 'm':
+        options.history_budget = strtoul(optarg, &pend, 10) << 20;
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "history budget must be a number of megabytes\n");
+          return false;
+        }
+        break;
+      case 's':
+        options.snapshot_dir = optarg;
+        break;
+      case 'v':
+        options.validator_plugin = optarg;
+        break;
+      case 'V':
+        options.validator_arg = optarg;
+        break;
+      case 'f':
+        if (options.fail_signature_count == REEXEC_MAX_SIGNATURES - 1) {
+          fprintf(stderr, "at most %d failure signatures\n",
+                  REEXEC_MAX_SIGNATURES - 1);
+          return false;
+        }
+        options.fail_signatures[options.fail_signature_count++] = optarg;
+        break;
+      case 'D':
+        options.deadline_ms = strtoul(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "deadline must be a number of milliseconds\n");
+          return false;
+        }
         break;
       case 'a':
         options.address_file = optarg;
@@ -184,6 +274,7 @@ bool parse_options(int argc, char *argv[], reactor_options_t &options) {
     while (optind < argc) printf("%s ", argv[optind++]);
     putchar('\n');
   }
+  options.tx_reversion = tx_reversion != 0;
   options.dg_options.entry_only = entry_only != 0;
   options.dg_options.enable_pta = enable_pta != 0;
   options.dg_options.enable_ctrl = enable_control != 0;
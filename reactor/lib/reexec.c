@@ -0,0 +1,147 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#define _GNU_SOURCE
+#include "reexec.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// how often to check whether the shell exited, for commands that leave
+// background processes holding the output pipe
+#define REEXEC_POLL_MS 100
+
+static struct reexec_config current_config;
+
+void reexec_configure(const struct reexec_config *config) {
+  current_config = *config;
+}
+
+const struct reexec_config *reexec_current_config(void) {
+  return &current_config;
+}
+
+static unsigned long reexec_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+// Index of the signature in line, -1 if it has none. A signature ending in
+// a digit, like file:line, does not match a longer number.
+static int reexec_match(const struct reexec_config *config, const char *line) {
+  for (int i = 0; i < config->signature_count; i++) {
+    const char *sig = config->signatures[i];
+    size_t len = strlen(sig);
+    if (len == 0) continue;
+    for (const char *p = strstr(line, sig); p; p = strstr(p + 1, sig)) {
+      if (!isdigit((unsigned char)sig[len - 1]) ||
+          !isdigit((unsigned char)p[len]))
+        return i;
+    }
+  }
+  return -1;
+}
+
+int reexec_run(const char *cmd, const struct reexec_config *config) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    perror("pipe");
+    return REEXEC_FAILED;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return REEXEC_FAILED;
+  }
+  if (pid == 0) {
+    // its own group, so the kill reaches everything the command started
+    setpgid(0, 0);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    _exit(127);
+  }
+  setpgid(pid, pid);
+  close(fds[1]);
+
+  unsigned long start = reexec_now_ms();
+  char line[REEXEC_LINE_MAX + 1];
+  size_t line_len = 0;
+  int outcome = REEXEC_PASSED, status = 0, matched = -1;
+  int exited = 0;
+  for (;;) {
+    int timeout = REEXEC_POLL_MS;
+    if (config->deadline_ms) {
+      unsigned long elapsed = reexec_now_ms() - start;
+      if (elapsed >= config->deadline_ms) {
+        outcome = REEXEC_DEADLINE;
+        break;
+      }
+      if (config->deadline_ms - elapsed < (unsigned long)timeout)
+        timeout = config->deadline_ms - elapsed;
+    }
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    int ready = poll(&pfd, 1, exited ? 0 : timeout);
+    if (ready < 0 && errno != EINTR) break;
+    if (ready <= 0) {
+      // the shell is gone and nothing is left to read, whatever it left
+      // running in the background keeps the pipe open
+      if (exited) break;
+      exited = waitpid(pid, &status, WNOHANG) == pid;
+      continue;
+    }
+    char buf[4096];
+    ssize_t n = read(fds[0], buf, sizeof(buf));
+    if (n <= 0) break;
+    fwrite(buf, 1, n, stdout);
+    for (ssize_t i = 0; i < n && matched < 0; i++) {
+      int eol = buf[i] == '\n';
+      if (!eol) line[line_len++] = buf[i];
+      if (!eol && line_len < REEXEC_LINE_MAX) continue;
+      line[line_len] = '\0';
+      matched = reexec_match(config, line);
+      line_len = 0;
+    }
+    if (matched >= 0) {
+      outcome = REEXEC_SIGNATURE;
+      break;
+    }
+  }
+  // the last line may not end with a newline
+  if (outcome == REEXEC_PASSED && line_len > 0) {
+    line[line_len] = '\0';
+    matched = reexec_match(config, line);
+    if (matched >= 0) outcome = REEXEC_SIGNATURE;
+  }
+  fflush(stdout);
+  close(fds[0]);
+  if (outcome != REEXEC_PASSED) kill(-pid, SIGKILL);
+  if (!exited) waitpid(pid, &status, 0);
+  if (outcome == REEXEC_SIGNATURE) {
+    printf("re-execution hit failure signature \"%s\" after %lu ms\n",
+           config->signatures[matched], reexec_now_ms() - start);
+  } else if (outcome == REEXEC_DEADLINE) {
+    printf("re-execution killed at the deadline of %lu ms\n",
+           config->deadline_ms);
+  } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    outcome = REEXEC_FAILED;
+  }
+  return outcome;
+}
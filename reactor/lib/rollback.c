@@ -15,134 +15,304 @@ int coarse_grained_tries = 0;
 int fine_grained_tries = 0;
 
 int reverse_cmpfunc(const void *a, const void *b) {
-  return (*(int *)b - *(int *)a);
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x < y) - (x > y);
 }
 
-void decision_func_sequence_array(int *old_seq_numbers, int old_total,
-                                  int *new_seq_numbers, int *new_total) {
+void decision_func_sequence_array(int64_t *old_seq_numbers, int old_total,
+                                  int64_t *new_seq_numbers, int *new_total) {
   for (int i = 0; i < old_total; i++) {
     new_seq_numbers[i] = old_seq_numbers[i];
     *new_total = *new_total + 1;
   }
-  qsort(new_seq_numbers, *new_total, sizeof(int), reverse_cmpfunc);
+  qsort(new_seq_numbers, *new_total, sizeof(int64_t), reverse_cmpfunc);
 }
 
-void revert_by_sequence_number_array(seq_log *s_log, int *seq_numbers,
-                                     int total_seq_num,
+void revert_batch_init(revert_batch *batch) {
+  batch->writes = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+}
+
+void revert_batch_add(revert_batch *batch, void *pmem_address,
+                      const void *data, size_t size, int64_t seq_num) {
+  if (batch->count == batch->capacity) {
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+    struct revert_write *writes = (struct revert_write *)realloc(
+        batch->writes, capacity * sizeof(struct revert_write));
+    if (!writes) {
+      fprintf(stderr, "failed to grow reversion batch\n");
+      return;
+    }
+    batch->writes = writes;
+    batch->capacity = capacity;
+  }
+  struct revert_write *w = &batch->writes[batch->count++];
+  w->pmem_address = pmem_address;
+  w->data = data;
+  w->size = size;
+  w->sequence_number = seq_num;
+}
+
+static int revert_write_cmpfunc(const void *a, const void *b) {
+  const struct revert_write *w1 = (const struct revert_write *)a;
+  const struct revert_write *w2 = (const struct revert_write *)b;
+  if (w1->pmem_address != w2->pmem_address)
+    return (uintptr_t)w1->pmem_address < (uintptr_t)w2->pmem_address ? -1 : 1;
+  if (w1->sequence_number != w2->sequence_number)
+    return w1->sequence_number < w2->sequence_number ? -1 : 1;
+  return 0;
+}
+
+// Merge the writes to the same address in place, keeping the oldest target
+// version, and leave the rest in address order. Returns the merged count.
+size_t revert_batch_merge(revert_batch *batch) {
+  if (batch->count == 0) return 0;
+  qsort(batch->writes, batch->count, sizeof(struct revert_write),
+        revert_write_cmpfunc);
+  size_t merged = 0;
+  for (size_t i = 0; i < batch->count; i++) {
+    if (merged > 0 &&
+        batch->writes[i].pmem_address ==
+            batch->writes[merged - 1].pmem_address)
+      continue;
+    batch->writes[merged++] = batch->writes[i];
+  }
+  batch->count = merged;
+  return merged;
+}
+
+// Drop the merged writes whose target bytes already equal the live pool
+// contents, e.g., because the value was set back since. They would change
+// nothing, but still cost a trial. Returns the remaining count.
+size_t revert_batch_drop_noops(revert_batch *batch) {
+  size_t kept = 0;
+  for (size_t i = 0; i < batch->count; i++) {
+    struct revert_write *w = &batch->writes[i];
+    if (memcmp(w->pmem_address, w->data, w->size) == 0) continue;
+    batch->writes[kept++] = *w;
+  }
+  if (kept < batch->count)
+    printf("skipped %lu reversions that change no bytes\n",
+           batch->count - kept);
+  batch->count = kept;
+  return kept;
+}
+
+// Write the batch in its current order with a single drain at the end
+static size_t revert_batch_write(revert_batch *batch) {
+  size_t written = batch->count;
+  if (written == 0) return 0;
+  for (size_t i = 0; i < written; i++) {
+    struct revert_write *w = &batch->writes[i];
+    pmem_memcpy_nodrain(w->pmem_address, w->data, w->size);
+  }
+  pmem_drain();
+  batch->count = 0;
+  return written;
+}
+
+// Merge the batch, drop the no-op writes and write the rest in address
+// order. Returns the number of writes applied; the batch is emptied.
+size_t revert_batch_apply(revert_batch *batch) {
+  revert_batch_merge(batch);
+  revert_batch_drop_noops(batch);
+  return revert_batch_write(batch);
+}
+
+void revert_batch_free(revert_batch *batch) {
+  free(batch->writes);
+  revert_batch_init(batch);
+}
+
+// The bytes an entry is reverted to, i.e., the version of its offset right
+// before it. NULL if the entry is the oldest version there is.
+const void *revert_target_version(const single_data *entry,
+                                  struct checkpoint_log *c_log, size_t *size) {
+  // the version history reaches past the MAX_VERSIONS slots of the entry
+  const struct version_ref *prev = checkpoint_previous_version(
+      c_log, entry->offset, entry->sequence_number);
+  if (prev) {
+    *size = prev->size;
+    return prev->data;
+  }
+  int rollback_version = entry->version - 1;
+  if (rollback_version >= 0) {
+    *size = entry->old_size[rollback_version];
+    return entry->old_data[rollback_version];
+  }
+  if (!entry->old_checkpoint_entry) return NULL;
+  struct node *c_node = search_for_offset(entry->old_checkpoint_entry, c_log);
+  if (!c_node) return NULL;
+  rollback_version = c_node->c_data.version;
+  *size = c_node->c_data.size[rollback_version];
+  return c_node->c_data.data[rollback_version];
+}
+
+// Collect the reversions of the sequence numbers into the batch. The live
+// bytes are saved for undo before anything in the batch is written.
+void revert_by_sequence_number_batch(revert_batch *batch, seq_log *s_log,
+                                     int64_t *seq_numbers, int total_seq_num,
                                      struct checkpoint_log *c_log) {
-  int curr_version, rollback_version;
   for (int i = 0; i < total_seq_num; i++) {
     single_data search_data = lookup(s_log, seq_numbers[i]);
     if (search_data.sequence_number == -1) {
       continue;
     }
-    curr_version = search_data.version;
-    rollback_version = curr_version - 1;
-    if (rollback_version < 0) {
-      if (search_data.old_checkpoint_entry) {
-        struct node *c_node =
-            search_for_offset(search_data.old_checkpoint_entry, c_log);
-        if (c_node) {
-          checkpoint_data old_check_data = c_node->c_data;
-          curr_version = old_check_data.version;
-          rollback_version = curr_version;
-          revert_by_sequence_number_checkpoint(old_check_data, rollback_version,
-                                               search_data);
-        }
-      }
-      continue;
+    size_t size;
+    const void *data = revert_target_version(&search_data, c_log, &size);
+    if (!data) continue;
+    void *pmem_address = entry_pmem_address(&search_data);
+    // undo_by_sequence_number skips the oldest versions, they need no saved
+    // bytes
+    if (search_data.version > 0)
+      lookup_undo_save(s_log, seq_numbers[i], pmem_address, search_data.size);
+    revert_batch_add(batch, pmem_address, data, size, seq_numbers[i]);
+  }
+}
+
+// Returns the number of writes applied, 0 if the reversion changes no bytes
+size_t revert_by_sequence_number_array(seq_log *s_log, int64_t *seq_numbers,
+                                       int total_seq_num,
+                                       struct checkpoint_log *c_log) {
+  revert_batch batch;
+  revert_batch_init(&batch);
+  revert_by_sequence_number_batch(&batch, s_log, seq_numbers, total_seq_num,
+                                  c_log);
+  size_t applied = revert_batch_apply(&batch);
+  printf("reverted %d sequence numbers with %lu writes\n", total_seq_num,
+         applied);
+  revert_batch_free(&batch);
+  return applied;
+}
+
+// Same as revert_by_sequence_number_array, but the before-images of the
+// merged writes go to the journal (in the trial the caller opened) and are
+// durable before the pool is written, so the trial can be undone in O(k)
+// or after a crash. Returns the number of writes applied, -1 if the journal
+// is full and nothing was written.
+int revert_by_sequence_number_journaled(struct reversion_journal *j,
+                                        void *pool_base, seq_log *s_log,
+                                        int64_t *seq_numbers, int total_seq_num,
+                                        struct checkpoint_log *c_log) {
+  if (!j)
+    return (int)revert_by_sequence_number_array(s_log, seq_numbers,
+                                                total_seq_num, c_log);
+  revert_batch batch;
+  revert_batch_init(&batch);
+  revert_by_sequence_number_batch(&batch, s_log, seq_numbers, total_seq_num,
+                                  c_log);
+  revert_batch_merge(&batch);
+  size_t changed = revert_batch_drop_noops(&batch);
+  for (size_t i = 0; i < changed; i++) {
+    struct revert_write *w = &batch.writes[i];
+    if (journal_record(j, pool_base, w->pmem_address, w->size) != 0) {
+      revert_batch_free(&batch);
+      return -1;
     }
-    revert_by_sequence_number(search_data, seq_numbers[i], 
-                              rollback_version, s_log);
   }
+  journal_publish(j);
+  size_t applied = revert_batch_write(&batch);
+  printf("reverted %d sequence numbers with %lu journaled writes\n",
+         total_seq_num, applied);
+  revert_batch_free(&batch);
+  return (int)applied;
 }
 
-void revert_by_transaction(void **sorted_pmem_addresses, struct tx_log *t_log,
-                           int *seq_numbers, int total_seq_num,
-                           seq_log *s_log) {
-  int tx_id;
-  int already_reverted = 0;
+// Extend the sequence numbers to every entry of the transactions they
+// belong to, so that a trial never sees a torn transaction. Entries outside
+// transactions are kept as is. Returns the number of sequence numbers in
+// *closure, which the caller frees.
+int tx_closure(tx_index *t_index, seq_log *s_log, int64_t *seq_numbers,
+               int total_seq_num, int64_t **closure) {
+  // dense transaction index of each candidate, -1 if it has none
+  long *txs = (long *)malloc(sizeof(long) * (total_seq_num + 1));
+  char *added = (char *)calloc(t_index->count + 1, 1);
+  int count = 0;
   for (int i = 0; i < total_seq_num; i++) {
     single_data search_data = lookup(s_log, seq_numbers[i]);
-    tx_id = search_data.tx_id;
-    int pos = txhashCode(t_log, tx_id);
-    struct tx_node *t_list = t_log->list[pos];
-    struct tx_node *t_temp = t_list;
-    while (t_temp) {
-      for (int j = 0; j < total_seq_num; j++) {
-        if (t_temp->ordered_data.sequence_number == seq_numbers[j]) {
-          already_reverted = 1;
-        }
-      }
-      if (t_temp->ordered_data.version != 0 && !already_reverted) {
-        search_data = lookup(s_log, t_temp->ordered_data.sequence_number);
-        revert_by_sequence_number(search_data,
-                                  t_temp->ordered_data.sequence_number,
-                                  t_temp->ordered_data.version - 1, s_log);
-      }
-      already_reverted = 0;
-      t_temp = t_temp->next;
+    txs[i] = -1;
+    if (search_data.sequence_number != -1 &&
+        search_data.tx_id > CHECKPOINT_NO_TX)
+      txs[i] = tx_index_find(t_index, search_data.tx_id);
+    if (txs[i] < 0) {
+      count++;
+    } else if (!added[txs[i]]) {
+      added[txs[i]] = 1;
+      count += t_index->begin[txs[i] + 1] - t_index->begin[txs[i]];
+    }
+  }
+  int64_t *result = (int64_t *)malloc(sizeof(int64_t) * (count + 1));
+  count = 0;
+  for (int i = 0; i < total_seq_num; i++) {
+    long d = txs[i];
+    if (d < 0) {
+      result[count++] = seq_numbers[i];
+    } else if (added[d]) {
+      // each transaction is expanded once
+      added[d] = 0;
+      for (size_t e = t_index->begin[d]; e < t_index->begin[d + 1]; e++)
+        result[count++] = t_index->entries[e].sequence_number;
     }
   }
+  free(added);
+  free(txs);
+  *closure = result;
+  return count;
+}
+
+// Revert the transactions of the sequence numbers as a single batch
+size_t revert_by_transaction(tx_index *t_index, seq_log *s_log,
+                             int64_t *seq_numbers, int total_seq_num,
+                             struct checkpoint_log *c_log) {
+  int64_t *closure;
+  int total = tx_closure(t_index, s_log, seq_numbers, total_seq_num, &closure);
+  if (total > total_seq_num)
+    printf("reverting %d sequence numbers to complete their transactions\n",
+           total - total_seq_num);
+  size_t applied =
+      revert_by_sequence_number_array(s_log, closure, total, c_log);
+  free(closure);
+  return applied;
 }
 
-void revert_by_sequence_number_nonslice(void *old_pop, single_data ordered_data,
-                                        int seq_num, int rollback_version,
-                                        void *pop) {
+void revert_by_sequence_number_nonslice(single_data ordered_data,
+                                        int64_t seq_num, int rollback_version) {
   if (rollback_version < 0) return;
-  void *pmem_address = (void *)((uint64_t)ordered_data.address -
-                                (uint64_t)old_pop + (uint64_t)pop);
-  memcpy(pmem_address, ordered_data.old_data[rollback_version],
-         ordered_data.old_size[rollback_version]);
+  pmem_memcpy_persist(entry_pmem_address(&ordered_data),
+                      ordered_data.old_data[rollback_version],
+                      ordered_data.old_size[rollback_version]);
 }
 
-void undo_by_sequence_number(single_data search_data, int seq_num) {
+void undo_by_sequence_number(single_data search_data, int64_t seq_num) {
   int curr_version = search_data.version;
   int rollback_version = curr_version - 1;
   if (rollback_version < 0) {
     return;
   }
-  memcpy(search_data.sorted_pmem_address, search_data.data, search_data.size);
+  // the caller drains once the whole undo is issued
+  pmem_memcpy_nodrain(entry_pmem_address(&search_data), search_data.data,
+                      search_data.size);
 }
 
 void revert_by_sequence_number_checkpoint(checkpoint_data old_check_data,
                                           int rollback_version,
                                           single_data search_data) {
-  memcpy(search_data.sorted_pmem_address, old_check_data.data[rollback_version],
-         old_check_data.size[rollback_version]);
+  pmem_memcpy_persist(entry_pmem_address(&search_data),
+                      old_check_data.data[rollback_version],
+                      old_check_data.size[rollback_version]);
 }
 
-void revert_by_sequence_number(single_data search_data, int seq_num,
+void revert_by_sequence_number(single_data search_data, int64_t seq_num,
                                int rollback_version, seq_log *s_log) {
-  lookup_undo_save(s_log, seq_num, search_data.sorted_pmem_address,
-                   search_data.size);
-  memcpy(search_data.sorted_pmem_address,
-         search_data.old_data[rollback_version],
-         search_data.old_size[rollback_version]);
-}
-
-void sort_by_sequence_number(void **addresses, size_t total_size, int num_data,
-                             void **pmem_addresses,
-                             void **sorted_pmem_addresses, uint64_t *offsets,
-                             seq_log *s_log) {
-  struct seq_node *list;
-  struct seq_node *temp;
-  for (int i = 0; i < (int)s_log->size; i++) {
-    for (int j = 0; j < num_data; j++) {
-      list = s_log->list[i];
-      temp = list;
-      while (temp) {
-        if (temp->ordered_data.offset == offsets[j]) {
-          temp->ordered_data.sorted_pmem_address = pmem_addresses[j];
-        }
-        temp = temp->next;
-      }
-    }
-  }
+  void *pmem_address = entry_pmem_address(&search_data);
+  lookup_undo_save(s_log, seq_num, pmem_address, search_data.size);
+  pmem_memcpy_persist(pmem_address,
+                      search_data.old_data[rollback_version],
+                      search_data.old_size[rollback_version]);
 }
 
-
-void seq_coarse_grain_reversion(int seq_num, void *pop, void *old_pop,
+void seq_coarse_grain_reversion(int64_t seq_num,
                                 struct checkpoint_log *c_log, seq_log *s_log) {
   single_data revert_data = lookup(s_log, seq_num);
   int curr_version = revert_data.version;
@@ -151,8 +321,7 @@ void seq_coarse_grain_reversion(int seq_num, void *pop, void *old_pop,
   if (rollback_version < 0) {
     return;
   }
-  revert_by_sequence_number_nonslice(old_pop, revert_data, seq_num,
-                                     curr_version - 1, pop);
+  revert_by_sequence_number_nonslice(revert_data, seq_num, curr_version - 1);
 }
 
 int checkpoint_hashcode(checkpoint_log *c_log, uint64_t offset) {
@@ -166,16 +335,7 @@ int checkpoint_hashcode(checkpoint_log *c_log, uint64_t offset) {
 }
 
 struct node *search_for_offset(uint64_t old_off, checkpoint_log *c_log) {
-  int pos = checkpoint_hashcode(c_log, old_off);
-  struct node *list = c_log->list[pos];
-  struct node *temp = list;
-  while (temp) {
-    if (temp->offset == old_off) {
-      return temp;
-    }
-    temp = temp->next;
-  }
-  return NULL;
+  return checkpoint_find_node(c_log, old_off);
 }
 
 PMEMobjpool *redo_pmem_addresses(const char *path, const char *layout,
@@ -186,25 +346,15 @@ PMEMobjpool *redo_pmem_addresses(const char *path, const char *layout,
     printf("could not open pop %s\n", pmemobj_errormsg());
     return NULL;
   }
-  struct seq_node *list;
-  struct seq_node *temp;
-  for (int i = 0; i < (int)s_log->size; i++) {
-    list = s_log->list[i];
-    temp = list;
-    while (temp) {
-      temp->ordered_data.sorted_pmem_address =
-          (void *)((uint64_t)pop + temp->ordered_data.offset);
-      temp = temp->next;
-    }
-  }
+  // the entries are resolved against the new base when they are written
+  set_pool_base(pop);
   return pop;
 }
 
 int re_execute(const char *reexecution_cmd, int version_num,
                struct checkpoint_log *c_log, int num_data, const char *path,
                const char *layout, int reversion_type,
-               int seq_num,  void *old_pop,
-               seq_log *s_log) {
+               int64_t seq_num, seq_log *s_log) {
   int ret_val;
   int reexecute_flag = 0;
   // the reexcution command is a single line command string
@@ -213,18 +363,17 @@ int re_execute(const char *reexecution_cmd, int version_num,
   // executed in bash. if the rexecution command is so complex,
   // it can also be put into a script and then the rexecution
   // command is simply './rx_script.sh'
-  // ret_val = system(timeout);
-  ret_val = system(reexecution_cmd);
+  // the run ends early on a failure signature or the deadline, and a
+  // target that dies of a signal has failed as well
+  ret_val = reexec_run(reexecution_cmd, reexec_current_config());
   printf("ret val is %d reexecute is %d\n", ret_val, reexecute_flag);
-  if (WIFEXITED(ret_val)) {
-    printf("WEXITSTATUS OS %d\n", WEXITSTATUS(ret_val));
-    if (WEXITSTATUS(ret_val) != 0) {
-      reexecute_flag = 1;
-    }
-  }
+  if (ret_val != REEXEC_PASSED) reexecute_flag = 1;
   if (coarse_grained_tries == MAX_COARSE_ATTEMPTS) {
     return -1;
   }
+  // fine-grained trials are undone and reopened by the caller, which also
+  // works for libpmem files that have no pool to reopen
+  if (reexecute_flag && reversion_type == FINE_GRAIN) return -1;
   // Try again if we need to re-execute
   if (reexecute_flag) {
     printf("Reversion attempt %d\n", coarse_grained_tries + 1);
@@ -242,7 +391,7 @@ int re_execute(const char *reexecution_cmd, int version_num,
       //                       num_data, offsets);
     } else if (reversion_type == COARSE_GRAIN_SEQUENCE) {
       if (seq_num < 0) return -1;
-      seq_coarse_grain_reversion(seq_num, pop, old_pop, c_log, s_log);
+      seq_coarse_grain_reversion(seq_num, c_log, s_log);
     } else {
       pmemobj_close(pop);
       return -1;
@@ -252,7 +401,7 @@ int re_execute(const char *reexecution_cmd, int version_num,
     printf("\n");
     re_execute(reexecution_cmd, version_num - 1, c_log,
                num_data, path, layout, reversion_type,
-               seq_num - 1, old_pop, s_log);
+               seq_num - 1, s_log);
   }
   return 1;
 }
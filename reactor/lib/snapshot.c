@@ -0,0 +1,296 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#define _GNU_SOURCE
+#include "snapshot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmem.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint_index.h"
+
+#define SNAPSHOT_COPY_CHUNK (1UL << 20)
+
+// Copy [off, off + len) of in to the same range of out
+static int snapshot_copy_range(int in, int out, off_t off, off_t len) {
+  while (len > 0) {
+    loff_t in_off = off, out_off = off;
+    ssize_t n = copy_file_range(in, &in_off, out, &out_off, len, 0);
+    if (n <= 0) break;
+    off += n;
+    len -= n;
+  }
+  if (len == 0) return 0;
+  // copy_file_range is not supported across these files
+  char *buf = (char *)malloc(SNAPSHOT_COPY_CHUNK);
+  if (!buf) return -1;
+  while (len > 0) {
+    size_t chunk =
+        len < (off_t)SNAPSHOT_COPY_CHUNK ? (size_t)len : SNAPSHOT_COPY_CHUNK;
+    ssize_t n = pread(in, buf, chunk, off);
+    if (n <= 0 || pwrite(out, buf, n, off) != n) {
+      free(buf);
+      return -1;
+    }
+    off += n;
+    len -= n;
+  }
+  free(buf);
+  return 0;
+}
+
+// Make [off, off + len) of out read as zeros
+static int snapshot_zero_range(int out, off_t off, off_t len) {
+  if (fallocate(out, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) ==
+      0)
+    return 0;
+  char *zeros = (char *)calloc(1, SNAPSHOT_COPY_CHUNK);
+  if (!zeros) return -1;
+  while (len > 0) {
+    size_t chunk =
+        len < (off_t)SNAPSHOT_COPY_CHUNK ? (size_t)len : SNAPSHOT_COPY_CHUNK;
+    if (pwrite(out, zeros, chunk, off) != (ssize_t)chunk) {
+      free(zeros);
+      return -1;
+    }
+    off += chunk;
+    len -= chunk;
+  }
+  free(zeros);
+  return 0;
+}
+
+int snapshot_clone_file(const char *src, const char *dst) {
+  int in = open(src, O_RDONLY);
+  if (in < 0) {
+    perror(src);
+    return -1;
+  }
+  int out = open(dst, O_RDWR | O_CREAT, 0666);
+  if (out < 0) {
+    perror(dst);
+    close(in);
+    return -1;
+  }
+  struct stat st;
+  int ret = fstat(in, &st);
+  // a reflink shares the extents, so it is O(1) in the size of the pool
+  if (ret == 0 && ioctl(out, FICLONE, in) != 0) {
+    // DAX file systems do not support reflinks, copy the data extents and
+    // leave the holes as holes
+    ret = ftruncate(out, st.st_size);
+    off_t pos = 0;
+    while (ret == 0 && pos < st.st_size) {
+      off_t data = lseek(in, pos, SEEK_DATA);
+      if (data < 0) data = st.st_size;
+      if (data > pos) ret = snapshot_zero_range(out, pos, data - pos);
+      if (ret != 0 || data >= st.st_size) break;
+      off_t hole = lseek(in, data, SEEK_HOLE);
+      if (hole < 0) hole = st.st_size;
+      ret = snapshot_copy_range(in, out, data, hole - data);
+      pos = hole;
+    }
+  }
+  if (ret == 0) ret = fsync(out);
+  if (ret != 0) fprintf(stderr, "failed to copy %s to %s\n", src, dst);
+  close(in);
+  close(out);
+  return ret;
+}
+
+// Directory and file name of the pool's snapshots
+static void snapshot_location(const char *pool_path, const char *dir,
+                              char *dir_buf, const char **name) {
+  const char *slash = strrchr(pool_path, '/');
+  *name = slash ? slash + 1 : pool_path;
+  if (dir)
+    snprintf(dir_buf, PATH_MAX, "%s", dir);
+  else if (slash)
+    snprintf(dir_buf, PATH_MAX, "%.*s", (int)(slash - pool_path), pool_path);
+  else
+    strcpy(dir_buf, ".");
+  if (dir_buf[0] == '\0') strcpy(dir_buf, "/");
+}
+
+// Parse <name>.snap.<begin>.<end>, returns 0 if the file is a snapshot
+static int snapshot_parse(const char *file, const char *name,
+                          int64_t *begin, int64_t *end) {
+  size_t name_len = strlen(name);
+  size_t suffix_len = strlen(SNAPSHOT_SUFFIX);
+  if (strncmp(file, name, name_len) != 0 ||
+      strncmp(file + name_len, SNAPSHOT_SUFFIX, suffix_len) != 0 ||
+      file[name_len + suffix_len] != '.')
+    return -1;
+  const char *p = file + name_len + suffix_len + 1;
+  char *stop;
+  *begin = strtoll(p, &stop, 10);
+  if (stop == p || *stop != '.') return -1;
+  p = stop + 1;
+  *end = strtoll(p, &stop, 10);
+  if (stop == p || *stop != '\0') return -1;
+  return 0;
+}
+
+int snapshot_take(const char *pool_path, const char *dir,
+                  const char *log_base, struct pool_snapshot *snap) {
+  char dir_buf[PATH_MAX], tmp[PATH_MAX + 32];
+  const char *name;
+  snapshot_location(pool_path, dir, dir_buf, &name);
+  snprintf(tmp, sizeof(tmp), "%s/%s%s.tmp", dir_buf, name, SNAPSHOT_SUFFIX);
+  unlink(tmp);
+  snap->begin = checkpoint_log_last_seq(log_base);
+  // without a checkpoint log there is no sequence number to tag it with
+  if (snap->begin < 0) {
+    fprintf(stderr, "no checkpoint log at %s, not taking a snapshot\n",
+            log_base);
+    return -1;
+  }
+  if (snapshot_clone_file(pool_path, tmp) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+  snap->end = checkpoint_log_last_seq(log_base);
+  snprintf(snap->path, sizeof(snap->path), "%s/%s%s.%ld.%ld", dir_buf, name,
+           SNAPSHOT_SUFFIX, (long)snap->begin, (long)snap->end);
+  // readers only ever see complete snapshots
+  if (rename(tmp, snap->path) != 0) {
+    perror(snap->path);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int snapshot_find(const char *pool_path, const char *dir, int64_t seq,
+                  struct pool_snapshot *snap) {
+  char dir_buf[PATH_MAX];
+  const char *name;
+  snapshot_location(pool_path, dir, dir_buf, &name);
+  DIR *d = opendir(dir_buf);
+  if (!d) return -1;
+  int found = -1;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    int64_t begin, end;
+    if (snapshot_parse(ent->d_name, name, &begin, &end) != 0) continue;
+    if (begin > seq || (found == 0 && begin <= snap->begin)) continue;
+    snprintf(snap->path, sizeof(snap->path), "%s/%s", dir_buf, ent->d_name);
+    snap->begin = begin;
+    snap->end = end;
+    found = 0;
+  }
+  closedir(d);
+  return found;
+}
+
+static int snapshot_begin_cmp(const void *a, const void *b) {
+  const struct pool_snapshot *s1 = (const struct pool_snapshot *)a;
+  const struct pool_snapshot *s2 = (const struct pool_snapshot *)b;
+  if (s1->begin != s2->begin) return s1->begin < s2->begin ? -1 : 1;
+  return 0;
+}
+
+int snapshot_prune(const char *pool_path, const char *dir, int keep) {
+  char dir_buf[PATH_MAX];
+  const char *name;
+  snapshot_location(pool_path, dir, dir_buf, &name);
+  DIR *d = opendir(dir_buf);
+  if (!d) return 0;
+  struct pool_snapshot *snaps = NULL;
+  int count = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    int64_t begin, end;
+    if (snapshot_parse(ent->d_name, name, &begin, &end) != 0) continue;
+    struct pool_snapshot *grown = (struct pool_snapshot *)realloc(
+        snaps, sizeof(struct pool_snapshot) * (count + 1));
+    if (!grown) break;
+    snaps = grown;
+    snprintf(snaps[count].path, sizeof(snaps[count].path), "%s/%s", dir_buf,
+             ent->d_name);
+    snaps[count].begin = begin;
+    snaps[count].end = end;
+    count++;
+  }
+  closedir(d);
+  qsort(snaps, count, sizeof(struct pool_snapshot), snapshot_begin_cmp);
+  int deleted = 0;
+  for (int i = 0; i < count - keep; i++)
+    if (unlink(snaps[i].path) == 0) deleted++;
+  free(snaps);
+  return deleted;
+}
+
+// Newest version of offset at or before seq, NULL if it has none
+static const void *snapshot_version_at(struct checkpoint_log *c_log,
+                                       uint64_t offset, int64_t seq,
+                                       size_t *size) {
+  struct version_chain *chain = checkpoint_version_chain(c_log, offset);
+  if (chain) {
+    for (uint32_t i = chain->count; i > 0; i--) {
+      struct version_ref *v = version_chain_at(chain, i - 1);
+      if (v->sequence_number > seq) continue;
+      *size = v->size;
+      return v->data;
+    }
+    return NULL;
+  }
+  struct node *n = checkpoint_find_node(c_log, offset);
+  if (!n) return NULL;
+  for (int j = n->c_data.version; j >= 0; j--) {
+    if (checkpoint_data_seq(&n->c_data, j) > seq) continue;
+    *size = n->c_data.size[j];
+    return n->c_data.data[j];
+  }
+  return NULL;
+}
+
+int64_t snapshot_restore_cost(const struct pool_snapshot *snap,
+                              const char *pool_path, int64_t seq) {
+  struct stat st;
+  if (snap->begin > seq || stat(pool_path, &st) != 0) return INT64_MAX;
+  int64_t upper = seq > snap->end ? seq : snap->end;
+  return upper - snap->begin + 2 * st.st_size / SNAPSHOT_BYTES_PER_VERSION;
+}
+
+long snapshot_restore(const struct pool_snapshot *snap, seq_log *s_log,
+                      struct checkpoint_log *c_log, int64_t seq) {
+  if (snap->begin > seq) return -1;
+  int64_t upper = seq > snap->end ? seq : snap->end;
+  // every offset is replayed once, with its version as of seq
+  uint64_t buckets = checkpoint_index_buckets_for(upper - snap->begin);
+  void *mem;
+  if (posix_memalign(&mem, 64, checkpoint_index_size(buckets)) != 0)
+    return -1;
+  struct checkpoint_index *replayed = (struct checkpoint_index *)mem;
+  checkpoint_index_init(replayed, buckets);
+  long count = 0;
+  for (int64_t s = snap->begin + 1; s <= upper; s++) {
+    single_data entry = lookup(s_log, s);
+    if (entry.sequence_number == -1) continue;
+    if (checkpoint_index_find(replayed, entry.offset) != CHECKPOINT_INDEX_NONE)
+      continue;
+    checkpoint_index_insert(replayed, entry.offset, 0);
+    size_t size;
+    const void *data = snapshot_version_at(c_log, entry.offset, seq, &size);
+    // first checkpointed after seq, there is nothing older to restore
+    if (!data) continue;
+    pmem_memcpy_persist(entry_pmem_address(&entry), data, size);
+    count++;
+  }
+  free(replayed);
+  return count;
+}
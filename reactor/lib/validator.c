@@ -0,0 +1,64 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#include "validator.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct validator *validator_load(const char *path, const char *arg) {
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    fprintf(stderr, "could not load validator: %s\n", dlerror());
+    return NULL;
+  }
+  arthas_validate_fn validate =
+      (arthas_validate_fn)dlsym(handle, ARTHAS_VALIDATOR_VALIDATE);
+  if (!validate) {
+    fprintf(stderr, "validator %s does not export %s\n", path,
+            ARTHAS_VALIDATOR_VALIDATE);
+    dlclose(handle);
+    return NULL;
+  }
+  arthas_validator_init_fn init =
+      (arthas_validator_init_fn)dlsym(handle, ARTHAS_VALIDATOR_INIT);
+  if (init && init(arg) != 0) {
+    fprintf(stderr, "validator %s refused to initialize\n", path);
+    dlclose(handle);
+    return NULL;
+  }
+  struct validator *v = (struct validator *)calloc(1, sizeof(struct validator));
+  if (!v) {
+    dlclose(handle);
+    return NULL;
+  }
+  v->handle = handle;
+  v->validate = validate;
+  v->fini = (arthas_validator_fini_fn)dlsym(handle, ARTHAS_VALIDATOR_FINI);
+  return v;
+}
+
+int validator_run(struct validator *v, const struct arthas_validation *args) {
+  int verdict = v->validate(args);
+  if (verdict != ARTHAS_VALIDATION_FAIL && verdict != ARTHAS_VALIDATION_PASS)
+    verdict = ARTHAS_VALIDATION_INCONCLUSIVE;
+  v->verdicts[verdict]++;
+  return verdict;
+}
+
+void validator_unload(struct validator *v) {
+  if (!v) return;
+  if (v->fini) v->fini();
+  printf("validator verdicts: %lu passed, %lu failed, %lu inconclusive\n",
+         v->verdicts[ARTHAS_VALIDATION_PASS],
+         v->verdicts[ARTHAS_VALIDATION_FAIL],
+         v->verdicts[ARTHAS_VALIDATION_INCONCLUSIVE]);
+  dlclose(v->handle);
+  free(v);
+}
@@ -0,0 +1,103 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+#include "checkpoint.h"
+#include "checkpoint_log_format.h"
+
+using namespace std;
+
+const char* program = "checkpoint-compact";
+static int show_help = 0;
+
+static struct option long_options[] = {
+    /* These options set a flag. */
+    {"help", no_argument, &show_help, 1},
+    {"stable", required_argument, 0, 's'},
+    {"interval", required_argument, 0, 'i'},
+    {0, 0, 0, 0}};
+
+void usage() {
+  fprintf(
+      stderr,
+      "Usage: %s [-h] [OPTION] <checkpoint file>\n\n"
+      "Options:\n"
+      "  -h, --help                   : show this help\n"
+      "  -s  --stable <seq>           : the stable point, versions replaced\n"
+      "                                 at or before it are dropped\n"
+      "  -i  --interval <sec>         : keep compacting every sec seconds\n"
+      "\n\n",
+      program);
+}
+
+struct compact_options {
+  string checkpoint_file;
+  uint64_t stable_seq;
+  unsigned interval;
+};
+
+struct compact_options options;
+
+bool parse_args(int argc, char** argv) {
+  program = argv[0];
+  int option_index = 0;
+  int c;
+  char* pend;
+  while ((c = getopt_long(argc, argv, "hs:i:", long_options,
+                          &option_index)) != -1) {
+    switch (c) {
+      case 'h':
+        show_help = 1;
+        break;
+      case 's':
+        options.stable_seq = strtoull(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "stable point must be a sequence number\n");
+          return false;
+        }
+        break;
+      case 'i':
+        options.interval = strtoul(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "interval must be a number of seconds\n");
+          return false;
+        }
+        break;
+      case 0:
+        break;
+      case '?':
+      default:
+        return false;
+    }
+  }
+  if (show_help) {
+    usage();
+    exit(0);
+  }
+  if (optind != argc - 1) return false;
+  options.checkpoint_file = argv[optind];
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (!parse_args(argc, argv)) {
+    usage();
+    exit(1);
+  }
+  string base = options.checkpoint_file + ARTHAS_CKPT_LOG_SUFFIX;
+  for (;;) {
+    struct checkpoint_compact_stats stats;
+    if (compact_checkpoint_log(base.c_str(), options.stable_seq, &stats) != 0)
+      exit(1);
+    cout << "Compacted " << stats.segments << " sealed segments, kept "
+         << stats.kept << " of " << stats.entries << " entries, "
+         << stats.bytes_before << " -> " << stats.bytes_after << " bytes\n";
+    if (!options.interval) break;
+    sleep(options.interval);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+#include "checkpoint.h"
+#include "checkpoint_log_format.h"
+#include "snapshot.h"
+
+using namespace std;
+
+const char* program = "checkpoint-snapshot";
+static int show_help = 0;
+
+static struct option long_options[] = {
+    /* These options set a flag. */
+    {"help", no_argument, &show_help, 1},
+    {"dir", required_argument, 0, 'd'},
+    {"interval", required_argument, 0, 'i'},
+    {"keep", required_argument, 0, 'k'},
+    {0, 0, 0, 0}};
+
+void usage() {
+  fprintf(
+      stderr,
+      "Usage: %s [-h] [OPTION] <pmem file> <checkpoint file>\n\n"
+      "Options:\n"
+      "  -h, --help                   : show this help\n"
+      "  -d  --dir <dir>              : directory of the snapshots, the\n"
+      "                                 pmem file's directory by default\n"
+      "  -i  --interval <sec>         : keep snapshotting every sec seconds\n"
+      "  -k  --keep <n>               : snapshots to keep, 4 by default\n"
+      "\n\n",
+      program);
+}
+
+struct snapshot_options {
+  string pmem_file;
+  string checkpoint_file;
+  const char* dir;
+  unsigned interval;
+  int keep;
+};
+
+struct snapshot_options options;
+
+bool parse_args(int argc, char** argv) {
+  program = argv[0];
+  options.keep = 4;
+  int option_index = 0;
+  int c;
+  char* pend;
+  while ((c = getopt_long(argc, argv, "hd:i:k:", long_options,
+                          &option_index)) != -1) {
+    switch (c) {
+      case 'h':
+        show_help = 1;
+        break;
+      case 'd':
+        options.dir = optarg;
+        break;
+      case 'i':
+        options.interval = strtoul(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "interval must be a number of seconds\n");
+          return false;
+        }
+        break;
+      case 'k':
+        options.keep = strtol(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0' || options.keep <= 0) {
+          fprintf(stderr, "snapshots to keep must be a positive integer\n");
+          return false;
+        }
+        break;
+      case 0:
+        break;
+      case '?':
+      default:
+        return false;
+    }
+  }
+  if (show_help) {
+    usage();
+    exit(0);
+  }
+  if (optind != argc - 2) return false;
+  options.pmem_file = argv[optind];
+  options.checkpoint_file = argv[optind + 1];
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (!parse_args(argc, argv)) {
+    usage();
+    exit(1);
+  }
+  string base = options.checkpoint_file + ARTHAS_CKPT_LOG_SUFFIX;
+  for (;;) {
+    struct pool_snapshot snap;
+    if (snapshot_take(options.pmem_file.c_str(), options.dir, base.c_str(),
+                      &snap) != 0)
+      exit(1);
+    int pruned =
+        snapshot_prune(options.pmem_file.c_str(), options.dir, options.keep);
+    cout << "Snapshot " << snap.path << " covers sequence numbers up to "
+         << snap.begin << ", pruned " << pruned << " old snapshots\n";
+    if (!options.interval) break;
+    sleep(options.interval);
+  }
+  return 0;
+}
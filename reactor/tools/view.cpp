@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+#include "checkpoint.h"
+#include "overlay.h"
+#include "validator.h"
+
+using namespace std;
+
+// buckets of the sequence log, the reactor's LOG_SIZE is sized for the
+// largest workloads
+#define VIEW_LOG_SIZE (1 << 20)
+
+const char* program = "pool-view";
+static int show_help = 0;
+
+static struct option long_options[] = {
+    /* These options set a flag. */
+    {"help", no_argument, &show_help, 1},
+    {"pmem-lib", required_argument, 0, 'l'},
+    {"pmem-layout", required_argument, 0, 't'},
+    {"seq", required_argument, 0, 's'},
+    {"offset", required_argument, 0, 'o'},
+    {"length", required_argument, 0, 'n'},
+    {"dump", required_argument, 0, 'd'},
+    {"validator", required_argument, 0, 'v'},
+    {"validator-arg", required_argument, 0, 'V'},
+    {0, 0, 0, 0}};
+
+void usage() {
+  fprintf(
+      stderr,
+      "Usage: %s [-h] [OPTION] <pmem file> <checkpoint file>\n\n"
+      "Options:\n"
+      "  -h, --help                   : show this help\n"
+      "  -l  --pmem-lib <lib>         : pmem library, libpmem or libpmemobj\n"
+      "  -t  --pmem-layout <layout>   : layout of a libpmemobj pool\n"
+      "  -s  --seq <seq>              : view the pool as of this sequence\n"
+      "                                 number\n"
+      "  -o  --offset <off>           : print the view from this offset\n"
+      "  -n  --length <len>           : number of bytes to print, 64 by\n"
+      "                                 default\n"
+      "  -d  --dump <file>            : write the whole view to file\n"
+      "  -v  --validator <plugin.so>  : run the validator on the view\n"
+      "  -V  --validator-arg <arg>    : argument passed to the validator\n"
+      "\n\n",
+      program);
+}
+
+struct view_options {
+  string pmem_file;
+  string checkpoint_file;
+  const char* pmem_library;
+  const char* pmem_layout;
+  int64_t seq;
+  bool print;
+  uint64_t offset;
+  size_t length;
+  const char* dump_file;
+  const char* validator_plugin;
+  const char* validator_arg;
+};
+
+struct view_options options;
+
+bool parse_args(int argc, char** argv) {
+  program = argv[0];
+  options.pmem_library = "libpmemobj";
+  options.seq = -1;
+  options.length = 64;
+  int option_index = 0;
+  int c;
+  char* pend;
+  while ((c = getopt_long(argc, argv, "hl:t:s:o:n:d:v:V:", long_options,
+                          &option_index)) != -1) {
+    switch (c) {
+      case 'h':
+        show_help = 1;
+        break;
+      case 'l':
+        options.pmem_library = optarg;
+        break;
+      case 't':
+        options.pmem_layout = optarg;
+        break;
+      case 's':
+        options.seq = strtoll(optarg, &pend, 10);
+        if (pend == optarg || *pend != '\0' || options.seq < 0) {
+          fprintf(stderr, "seq must be a sequence number\n");
+          return false;
+        }
+        break;
+      case 'o':
+        options.offset = strtoull(optarg, &pend, 0);
+        if (pend == optarg || *pend != '\0') {
+          fprintf(stderr, "offset must be a number\n");
+          return false;
+        }
+        options.print = true;
+        break;
+      case 'n':
+        options.length = strtoul(optarg, &pend, 0);
+        if (pend == optarg || *pend != '\0' || options.length == 0) {
+          fprintf(stderr, "length must be a positive number\n");
+          return false;
+        }
+        options.print = true;
+        break;
+      case 'd':
+        options.dump_file = optarg;
+        break;
+      case 'v':
+        options.validator_plugin = optarg;
+        break;
+      case 'V':
+        options.validator_arg = optarg;
+        break;
+      case 0:
+        break;
+      case '?':
+      default:
+        return false;
+    }
+  }
+  if (show_help) {
+    usage();
+    exit(0);
+  }
+  if (optind != argc - 2 || options.seq < 0) return false;
+  options.pmem_file = argv[optind];
+  options.checkpoint_file = argv[optind + 1];
+  return true;
+}
+
+static void print_range(const unsigned char* data, uint64_t offset,
+                        size_t length) {
+  for (size_t i = 0; i < length; i += 16) {
+    printf("%016lx ", offset + i);
+    for (size_t j = i; j < i + 16 && j < length; j++) printf(" %02x", data[j]);
+    printf("\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  if (!parse_args(argc, argv)) {
+    usage();
+    exit(1);
+  }
+  struct checkpoint_log* c_log = reconstruct_checkpoint(
+      options.checkpoint_file.c_str(), options.pmem_library);
+  if (!c_log) exit(1);
+  seq_log s_log;
+  s_log.size = VIEW_LOG_SIZE;
+  s_log.list =
+      (struct seq_node**)calloc(VIEW_LOG_SIZE, sizeof(struct seq_node*));
+  size_t total_size = 0;
+  order_by_sequence_num(&s_log, &total_size, c_log);
+
+  pool_overlay* ov = pool_overlay_open(options.pmem_file.c_str(), &s_log,
+                                       c_log, options.seq);
+  if (!ov) exit(1);
+  // the live pool, to count the bytes the view differs in
+  int fd = open(options.pmem_file.c_str(), O_RDONLY);
+  void* live = fd < 0 ? MAP_FAILED
+                      : mmap(NULL, ov->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (fd >= 0) close(fd);
+  cout << "View of " << options.pmem_file << " as of " << options.seq << ": "
+       << ov->patch_count << " versions overlaid on " << ov->overlaid_pages
+       << " pages";
+  if (live != MAP_FAILED)
+    cout << ", " << pool_overlay_changes(ov, live) << " differ from the pool";
+  cout << "\n";
+  if (live != MAP_FAILED) munmap(live, ov->size);
+
+  int ret = 0;
+  if (options.print) {
+    const unsigned char* data = (const unsigned char*)pool_overlay_read(
+        ov, options.offset, options.length);
+    if (data) {
+      print_range(data, options.offset, options.length);
+    } else {
+      fprintf(stderr, "range is outside the pool\n");
+      ret = 1;
+    }
+  }
+  if (options.dump_file) {
+    const void* data = pool_overlay_read(ov, 0, ov->size);
+    FILE* out = fopen(options.dump_file, "w");
+    if (!out || fwrite(data, 1, ov->size, out) != ov->size) {
+      perror(options.dump_file);
+      ret = 1;
+    }
+    if (out) fclose(out);
+  }
+  if (options.validator_plugin) {
+    struct validator* v =
+        validator_load(options.validator_plugin, options.validator_arg);
+    if (v) {
+      bool pmemobj = strcmp(options.pmem_library, "libpmemobj") == 0;
+      struct arthas_validation args = {
+          ov->base, ov->size, options.pmem_file.c_str(),
+          pmemobj ? options.pmem_layout : NULL, options.seq};
+      int verdict = validator_run(v, &args);
+      cout << "Validator: "
+           << (verdict == ARTHAS_VALIDATION_PASS
+                   ? "pass"
+                   : verdict == ARTHAS_VALIDATION_FAIL ? "fail"
+                                                       : "inconclusive")
+           << "\n";
+      validator_unload(v);
+    } else {
+      ret = 1;
+    }
+  }
+  pool_overlay_close(ov);
+  return ret;
+}
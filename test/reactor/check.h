@@ -0,0 +1,25 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+#ifndef _TEST_REACTOR_CHECK_H_
+#define _TEST_REACTOR_CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Abort the test with the failed condition and its location
+#define CHECK(cond)                                                  \
+  do {                                                               \
+    if (!(cond)) {                                                   \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                \
+      exit(1);                                                       \
+    }                                                                \
+  } while (0)
+
+#endif /* _TEST_REACTOR_CHECK_H_ */
@@ -0,0 +1,128 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Compacting the checkpoint log drops the versions superseded at the stable
+// point and the versions of objects freed before it, and keeps everything
+// still revertible byte for byte, even versions that were stored as deltas
+// against a dropped one.
+
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "checkpoint.h"
+#include "checkpoint_log_format.h"
+
+#define OBJ_SIZE 256
+#define OFFSET_A 4096
+#define OFFSET_B 8192
+
+static char dir[] = "/tmp/arthas-compact-test-XXXXXX";
+
+// content of offset A at sequence number seq, each version changes a few
+// bytes of the one before so that it is stored as a delta
+static void version_a(unsigned char *obj, uint64_t seq) {
+  memset(obj, 0x5a, OBJ_SIZE);
+  for (uint64_t s = 10; s <= seq; s++) obj[s * 7 % OBJ_SIZE] = (unsigned char)s;
+}
+
+static void append(struct arthas_ckpt_header *hdr, uint64_t seq,
+                   uint64_t offset, const void *data) {
+  unsigned char scratch[OBJ_SIZE];
+  uint64_t n;
+  if (data)
+    n = arthas_ckpt_append(hdr, seq, offset, data, OBJ_SIZE, 0, 0, 0, scratch);
+  else
+    n = arthas_ckpt_append_tombstone(hdr, seq, offset, 0, 0);
+  CHECK(n != ARTHAS_CKPT_NO_ENTRY);
+  arthas_ckpt_commit(hdr, n);
+  arthas_ckpt_index_update(hdr, offset, n);
+}
+
+//   seq 10  A full
+//   seq 11  B
+//   seq 12  A delta against 10
+//   seq 13  B freed
+//   seq 15  A delta against 12
+static void write_segment(const char *path) {
+  uint64_t index_offset, entry_offset, payload_offset;
+  uint64_t size = arthas_ckpt_layout(16, 16, 1 << 12, &index_offset,
+                                     &entry_offset, &payload_offset);
+  size_t mapped_len;
+  int is_pmem;
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)pmem_map_file(
+      path, size, PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
+  CHECK(hdr != NULL);
+  arthas_ckpt_init(hdr, 0, 16, 16, mapped_len - payload_offset);
+  hdr->magic = ARTHAS_CKPT_MAGIC;
+  unsigned char obj[OBJ_SIZE];
+  version_a(obj, 10);
+  append(hdr, 10, OFFSET_A, obj);
+  memset(obj, 0xbb, sizeof(obj));
+  append(hdr, 11, OFFSET_B, obj);
+  version_a(obj, 12);
+  append(hdr, 12, OFFSET_A, obj);
+  CHECK(arthas_ckpt_entries(hdr)[2].encoding == ARTHAS_CKPT_DELTA);
+  append(hdr, 13, OFFSET_B, NULL);
+  version_a(obj, 15);
+  append(hdr, 15, OFFSET_A, obj);
+  hdr->sealed = 1;
+  pmem_unmap(hdr, mapped_len);
+}
+
+int main(void) {
+  CHECK(mkdtemp(dir) != NULL);
+  char base[PATH_MAX], path[PATH_MAX];
+  snprintf(base, sizeof(base), "%s/ckpt%s", dir, ARTHAS_CKPT_LOG_SUFFIX);
+  snprintf(path, sizeof(path), "%s.0", base);
+  write_segment(path);
+
+  // A at 12 and 15 stay revertible, B is freed at the stable point
+  struct checkpoint_compact_stats stats;
+  CHECK(compact_checkpoint_log(base, 13, &stats) == 0);
+  CHECK(stats.segments == 1);
+  CHECK(stats.entries == 5);
+  CHECK(stats.kept == 3);
+  CHECK(stats.bytes_after < stats.bytes_before);
+
+  size_t mapped_len;
+  int is_pmem;
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)pmem_map_file(
+      path, 0, 0, 0, &mapped_len, &is_pmem);
+  CHECK(hdr != NULL);
+  CHECK(hdr->compacted && hdr->sealed);
+  CHECK(hdr->committed == 3);
+  struct arthas_ckpt_entry *entries = arthas_ckpt_entries(hdr);
+  CHECK(entries[0].seq == 12 && entries[0].offset == OFFSET_A);
+  CHECK(entries[1].seq == 13 &&
+        entries[1].encoding == ARTHAS_CKPT_TOMBSTONE);
+  CHECK(entries[2].seq == 15 && entries[2].offset == OFFSET_A);
+  // the delta base of seq 12 was dropped, so the copy holds it in full
+  CHECK(entries[0].encoding != ARTHAS_CKPT_DELTA);
+  unsigned char expected[OBJ_SIZE], version[OBJ_SIZE];
+  arthas_ckpt_materialize(hdr, 0, version);
+  version_a(expected, 12);
+  CHECK(memcmp(version, expected, OBJ_SIZE) == 0);
+  arthas_ckpt_materialize(hdr, 2, version);
+  version_a(expected, 15);
+  CHECK(memcmp(version, expected, OBJ_SIZE) == 0);
+  pmem_unmap(hdr, mapped_len);
+
+  // compacting again at the same point finds nothing left to drop
+  CHECK(compact_checkpoint_log(base, 13, &stats) == 0);
+  CHECK(stats.entries == 3 && stats.kept == 3);
+
+  unlink(path);
+  rmdir(dir);
+  printf("compact_test passed\n");
+  return 0;
+}
@@ -0,0 +1,150 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Delta encoding of checkpoint log versions: encode/apply round trips and
+// versions rebuilt from a segment of full and delta entries.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "checkpoint_log_format.h"
+
+#define OBJ_SIZE 256
+#define RUN_SIZE sizeof(struct arthas_ckpt_delta_run)
+
+static void round_trip(const unsigned char *prev, const unsigned char *cur,
+                       uint64_t size) {
+  unsigned char delta[OBJ_SIZE], out[OBJ_SIZE];
+  uint64_t stored = arthas_ckpt_delta_encode(prev, cur, size, delta, size);
+  CHECK(stored > 0 && stored < size);
+  memcpy(out, prev, size);
+  arthas_ckpt_delta_apply(out, size, delta, stored);
+  CHECK(memcmp(out, cur, size) == 0);
+}
+
+static void test_encode_apply(void) {
+  unsigned char prev[OBJ_SIZE], cur[OBJ_SIZE], delta[OBJ_SIZE];
+  for (int i = 0; i < OBJ_SIZE; i++) prev[i] = (unsigned char)rand();
+
+  // unchanged, a single empty run that applies as a no-op
+  memcpy(cur, prev, OBJ_SIZE);
+  uint64_t stored = arthas_ckpt_delta_encode(prev, cur, OBJ_SIZE, delta,
+                                             OBJ_SIZE);
+  CHECK(stored == RUN_SIZE);
+  round_trip(prev, cur, OBJ_SIZE);
+
+  // changes closer than ARTHAS_CKPT_DELTA_GAP share a run
+  cur[10] ^= 1;
+  cur[10 + ARTHAS_CKPT_DELTA_GAP - 2] ^= 1;
+  stored = arthas_ckpt_delta_encode(prev, cur, OBJ_SIZE, delta, OBJ_SIZE);
+  CHECK(stored == RUN_SIZE + ARTHAS_CKPT_DELTA_GAP - 1);
+  round_trip(prev, cur, OBJ_SIZE);
+
+  // farther apart, two runs
+  memcpy(cur, prev, OBJ_SIZE);
+  cur[10] ^= 1;
+  cur[100] ^= 1;
+  stored = arthas_ckpt_delta_encode(prev, cur, OBJ_SIZE, delta, OBJ_SIZE);
+  CHECK(stored == 2 * (RUN_SIZE + 1));
+  round_trip(prev, cur, OBJ_SIZE);
+
+  // first and last byte
+  memcpy(cur, prev, OBJ_SIZE);
+  cur[0] ^= 0xff;
+  cur[OBJ_SIZE - 1] ^= 0xff;
+  round_trip(prev, cur, OBJ_SIZE);
+
+  // random sparse edits
+  for (int trial = 0; trial < 1000; trial++) {
+    memcpy(cur, prev, OBJ_SIZE);
+    int edits = 1 + rand() % 8;
+    for (int e = 0; e < edits; e++) cur[rand() % OBJ_SIZE] ^= 1 + rand() % 255;
+    round_trip(prev, cur, OBJ_SIZE);
+  }
+
+  // a delta that is not smaller than the version is refused
+  for (int i = 0; i < OBJ_SIZE; i++) cur[i] = prev[i] ^ 0x5a;
+  CHECK(arthas_ckpt_delta_encode(prev, cur, OBJ_SIZE, delta, OBJ_SIZE) == 0);
+  // and so is one that does not fit the cap
+  memcpy(cur, prev, OBJ_SIZE);
+  cur[0] ^= 1;
+  CHECK(arthas_ckpt_delta_encode(prev, cur, OBJ_SIZE, delta, RUN_SIZE) == 0);
+}
+
+// Append versions of a few offsets to a segment in DRAM and rebuild every
+// entry from the segment
+static void test_segment(void) {
+  const uint64_t index_slots = 64, entries = 512, payload = 1 << 20;
+  const int offsets = 4, versions = 100;
+  uint64_t index_offset, entry_offset, payload_offset;
+  uint64_t size = arthas_ckpt_layout(index_slots, entries, payload,
+                                     &index_offset, &entry_offset,
+                                     &payload_offset);
+  void *mem;
+  CHECK(posix_memalign(&mem, 64, size) == 0);
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)mem;
+  arthas_ckpt_init(hdr, 0, index_slots, entries, payload);
+  hdr->magic = ARTHAS_CKPT_MAGIC;
+
+  unsigned char obj[offsets][OBJ_SIZE];
+  unsigned char *expected = (unsigned char *)malloc(entries * OBJ_SIZE);
+  unsigned char scratch[OBJ_SIZE], out[OBJ_SIZE];
+  for (int o = 0; o < offsets; o++)
+    for (int i = 0; i < OBJ_SIZE; i++) obj[o][i] = (unsigned char)rand();
+
+  uint64_t seq = 1, deltas = 0;
+  for (int v = 0; v < versions; v++) {
+    for (int o = 0; o < offsets; o++) {
+      uint64_t offset = 4096 * (o + 1);
+      if (v == 50 && o == 0) {
+        // a freed and reallocated object starts over with a full version
+        uint64_t n = arthas_ckpt_append_tombstone(hdr, seq++, offset, 0, 0);
+        CHECK(n != ARTHAS_CKPT_NO_ENTRY);
+        arthas_ckpt_commit(hdr, n);
+        arthas_ckpt_index_update(hdr, offset, n);
+      }
+      obj[o][rand() % OBJ_SIZE]++;
+      uint64_t n = arthas_ckpt_append(hdr, seq++, offset, obj[o], OBJ_SIZE, 0,
+                                      0, 0, scratch);
+      CHECK(n != ARTHAS_CKPT_NO_ENTRY);
+      struct arthas_ckpt_entry *e = &arthas_ckpt_entries(hdr)[n];
+      CHECK(e->chain < ARTHAS_CKPT_FULL_INTERVAL);
+      if (e->encoding == ARTHAS_CKPT_DELTA) {
+        deltas++;
+        CHECK(e->stored < OBJ_SIZE);
+        CHECK(arthas_ckpt_entries(hdr)[e->prev].offset == offset);
+      }
+      if (v == 50 && o == 0) CHECK(e->encoding == ARTHAS_CKPT_FULL);
+      arthas_ckpt_commit(hdr, n);
+      arthas_ckpt_index_update(hdr, offset, n);
+      memcpy(expected + n * OBJ_SIZE, obj[o], OBJ_SIZE);
+    }
+  }
+  CHECK(deltas > 0);
+  CHECK(hdr->first_seq == 1 && hdr->last_seq == seq - 1);
+
+  for (uint64_t n = 0; n < hdr->committed; n++) {
+    struct arthas_ckpt_entry *e = &arthas_ckpt_entries(hdr)[n];
+    if (e->encoding == ARTHAS_CKPT_TOMBSTONE) continue;
+    arthas_ckpt_materialize(hdr, n, out);
+    CHECK(memcmp(out, expected + n * OBJ_SIZE, OBJ_SIZE) == 0);
+  }
+  free(expected);
+  free(hdr);
+}
+
+int main(void) {
+  srand(41);
+  test_encode_apply();
+  test_segment();
+  printf("delta_test passed\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Cache-line bucketed offset index: lookups of aligned offsets, reference
+// updates, misses and a full table.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "checkpoint_index.h"
+
+static struct checkpoint_index *index_new(uint64_t buckets) {
+  void *mem;
+  CHECK(posix_memalign(&mem, 64, checkpoint_index_size(buckets)) == 0);
+  struct checkpoint_index *idx = (struct checkpoint_index *)mem;
+  checkpoint_index_init(idx, buckets);
+  return idx;
+}
+
+static void test_lookup(uint64_t count, uint64_t align) {
+  struct checkpoint_index *idx = index_new(checkpoint_index_buckets_for(count));
+  for (uint64_t i = 0; i < count; i++)
+    CHECK(checkpoint_index_insert(idx, (i + 1) * align, (uint32_t)i) == 0);
+  CHECK(idx->count == count);
+  for (uint64_t i = 0; i < count; i++)
+    CHECK(checkpoint_index_find(idx, (i + 1) * align) == i);
+  // offsets that were never inserted
+  CHECK(checkpoint_index_find(idx, 0) == CHECKPOINT_INDEX_NONE);
+  for (uint64_t i = 0; i < count; i++)
+    CHECK(checkpoint_index_find(idx, (i + 1) * align + 1) ==
+          CHECKPOINT_INDEX_NONE);
+  // checkpointed again, only the reference changes
+  for (uint64_t i = 0; i < count; i += 3)
+    CHECK(checkpoint_index_insert(idx, (i + 1) * align, (uint32_t)(i + count)) ==
+          0);
+  CHECK(idx->count == count);
+  for (uint64_t i = 0; i < count; i++)
+    CHECK(checkpoint_index_find(idx, (i + 1) * align) ==
+          (i % 3 == 0 ? i + count : i));
+  free(idx);
+}
+
+static void test_full(void) {
+  const uint64_t buckets = 4;
+  const uint64_t capacity = buckets * CHECKPOINT_INDEX_WAYS;
+  struct checkpoint_index *idx = index_new(buckets);
+  for (uint64_t i = 0; i < capacity; i++)
+    CHECK(checkpoint_index_insert(idx, i * 64, (uint32_t)i) == 0);
+  CHECK(checkpoint_index_insert(idx, capacity * 64, 0) == -1);
+  // a full table still finds and updates what it holds
+  CHECK(checkpoint_index_insert(idx, 0, 7) == 0);
+  for (uint64_t i = 0; i < capacity; i++)
+    CHECK(checkpoint_index_find(idx, i * 64) == (i == 0 ? 7 : i));
+  CHECK(checkpoint_index_find(idx, capacity * 64) == CHECKPOINT_INDEX_NONE);
+  free(idx);
+}
+
+int main(void) {
+  // a bucket is one cache line
+  CHECK(sizeof(struct checkpoint_index_bucket) == 64);
+  CHECK(checkpoint_index_buckets_for(0) == 1);
+  test_lookup(1, 8);
+  test_lookup(1000, 8);
+  test_lookup(100000, 64);
+  test_lookup(100000, 4096);
+  test_full();
+  printf("index_test passed\n");
+  return 0;
+}
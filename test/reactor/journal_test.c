@@ -0,0 +1,183 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Reversion journal: undo and commit of (nested) trials, and recovery of
+// the trials a reactor left open when it died.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "journal.h"
+
+#define POOL_SIZE 4096
+#define JOURNAL_SIZE (1 << 20)
+
+static char journal_path[] = "/tmp/arthas-journal-test-XXXXXX";
+// shared with the children that crash in the middle of a trial
+static unsigned char *pool;
+static unsigned char original[POOL_SIZE];
+
+static struct reversion_journal *reopen(struct reversion_journal *j) {
+  if (j) journal_close(j);
+  j = journal_open(journal_path, JOURNAL_SIZE);
+  CHECK(j != NULL);
+  return j;
+}
+
+// Record the bytes at offset and overwrite them, like a reversion
+static void revert(struct reversion_journal *j, size_t offset, size_t size,
+                   unsigned char value) {
+  CHECK(journal_record(j, pool, pool + offset, size) == 0);
+  journal_publish(j);
+  memset(pool + offset, value, size);
+}
+
+static void reset_pool(void) {
+  for (int i = 0; i < POOL_SIZE; i++) pool[i] = (unsigned char)(i * 7);
+  memcpy(original, pool, POOL_SIZE);
+}
+
+static void test_undo(struct reversion_journal *j) {
+  reset_pool();
+  CHECK(journal_begin_trial(j) == 1);
+  revert(j, 0, 16, 0xaa);
+  revert(j, 100, 300, 0xbb);
+  // overlapping the first one, undone in reverse so the original wins
+  revert(j, 8, 16, 0xcc);
+  CHECK(journal_undo_trial(j, pool) == 3);
+  CHECK(j->depth == 0 && j->hdr->last == 0);
+  CHECK(memcmp(pool, original, POOL_SIZE) == 0);
+  CHECK(journal_undo_trial(j, pool) == -1);
+}
+
+static void test_nested(struct reversion_journal *j) {
+  reset_pool();
+  CHECK(journal_begin_trial(j) == 1);
+  revert(j, 0, 64, 1);
+  CHECK(journal_begin_trial(j) == 2);
+  revert(j, 64, 64, 2);
+  // undoing the inner trial keeps the outer one's change
+  CHECK(journal_undo_trial(j, pool) == 1);
+  CHECK(memcmp(pool + 64, original + 64, 64) == 0);
+  CHECK(pool[0] == 1);
+  // a committed inner trial is undone with the outer one
+  CHECK(journal_begin_trial(j) == 2);
+  revert(j, 200, 10, 3);
+  CHECK(journal_commit_trial(j) == 1);
+  CHECK(pool[200] == 3);
+  CHECK(journal_undo_trial(j, pool) == 2);
+  CHECK(memcmp(pool, original, POOL_SIZE) == 0);
+}
+
+static void test_commit(struct reversion_journal *j) {
+  reset_pool();
+  CHECK(journal_begin_trial(j) == 1);
+  revert(j, 500, 20, 9);
+  CHECK(journal_commit_trial(j) == 0);
+  // the outermost commit empties the journal and keeps the changes
+  CHECK(j->hdr->last == 0);
+  CHECK(pool[500] == 9 && pool[519] == 9);
+  CHECK(journal_commit_trial(j) == -1);
+}
+
+// Run a child that opens the journal, calls trial and dies without closing
+// it
+static void crash_during(void (*trial)(struct reversion_journal *)) {
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0) {
+    struct reversion_journal *j = journal_open(journal_path, JOURNAL_SIZE);
+    if (!j) _exit(2);
+    trial(j);
+    _exit(0);
+  }
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void open_trials(struct reversion_journal *j) {
+  journal_begin_trial(j);
+  revert(j, 0, 32, 0x11);
+  journal_begin_trial(j);
+  revert(j, 16, 64, 0x22);
+  journal_begin_trial(j);
+  revert(j, 1000, 8, 0x33);
+  journal_commit_trial(j);
+}
+
+// the image is appended but the reactor dies before publishing it, and
+// thus before the pool is written
+static void unpublished_image(struct reversion_journal *j) {
+  journal_begin_trial(j);
+  revert(j, 0, 8, 0x44);
+  journal_record(j, pool, pool + 2000, 8);
+}
+
+static void test_recover(void) {
+  reset_pool();
+  crash_during(open_trials);
+  struct reversion_journal *j = reopen(NULL);
+  CHECK(j->depth == 2);
+  CHECK(journal_recover(j, pool) == 2);
+  CHECK(memcmp(pool, original, POOL_SIZE) == 0);
+  CHECK(j->depth == 0 && j->hdr->last == 0);
+  // recovering again finds nothing to undo
+  j = reopen(j);
+  CHECK(j->depth == 0);
+  CHECK(journal_recover(j, pool) == 0);
+  CHECK(memcmp(pool, original, POOL_SIZE) == 0);
+  journal_close(j);
+
+  // only published images are restored
+  reset_pool();
+  crash_during(unpublished_image);
+  pool[2000] = 0x55;
+  j = reopen(NULL);
+  CHECK(j->depth == 1);
+  CHECK(journal_recover(j, pool) == 1);
+  CHECK(memcmp(pool, original, 8) == 0);
+  CHECK(pool[2000] == 0x55);
+  journal_close(j);
+}
+
+int main(void) {
+  int fd = mkstemp(journal_path);
+  CHECK(fd >= 0);
+  close(fd);
+  // journal_open creates the journal
+  unlink(journal_path);
+  pool = (unsigned char *)mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  CHECK(pool != MAP_FAILED);
+
+  struct reversion_journal *j = reopen(NULL);
+  test_undo(j);
+  test_nested(j);
+  test_commit(j);
+  // trials survive reopening the journal at another address
+  CHECK(journal_begin_trial(j) == 1);
+  reset_pool();
+  revert(j, 300, 40, 0x66);
+  j = reopen(j);
+  CHECK(j->depth == 1);
+  CHECK(journal_undo_trial(j, pool) == 1);
+  CHECK(memcmp(pool, original, POOL_SIZE) == 0);
+  journal_close(j);
+
+  test_recover();
+  unlink(journal_path);
+  printf("journal_test passed\n");
+  return 0;
+}
@@ -0,0 +1,97 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Checkpoints rebuilt from log segments carry pool offsets but no
+// addresses: the pool offset of a traced access still finds the sequence
+// numbers of its versions as reversion candidates.
+
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "checkpoint.h"
+#include "checkpoint_log_format.h"
+
+#define OBJ_SIZE 64
+#define SEQ_LOG_SIZE 1024
+
+static char dir[] = "/tmp/arthas-offset-test-XXXXXX";
+
+// Write a segment with two versions of offset 4096 and one of offset 8192
+static void write_segment(const char *path) {
+  uint64_t index_offset, entry_offset, payload_offset;
+  uint64_t size = arthas_ckpt_layout(16, 16, 1 << 12, &index_offset,
+                                     &entry_offset, &payload_offset);
+  size_t mapped_len;
+  int is_pmem;
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)pmem_map_file(
+      path, size, PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
+  CHECK(hdr != NULL);
+  arthas_ckpt_init(hdr, 0, 16, 16, mapped_len - payload_offset);
+  hdr->magic = ARTHAS_CKPT_MAGIC;
+  unsigned char obj[OBJ_SIZE], scratch[OBJ_SIZE];
+  const uint64_t offsets[] = {4096, 8192, 4096};
+  for (int i = 0; i < 3; i++) {
+    memset(obj, i + 1, sizeof(obj));
+    uint64_t n = arthas_ckpt_append(hdr, 10 + i, offsets[i], obj, OBJ_SIZE, 0,
+                                    0, 0, scratch);
+    CHECK(n != ARTHAS_CKPT_NO_ENTRY);
+    arthas_ckpt_commit(hdr, n);
+    arthas_ckpt_index_update(hdr, offsets[i], n);
+  }
+  hdr->sealed = 1;
+  pmem_unmap(hdr, mapped_len);
+}
+
+int main(void) {
+  CHECK(mkdtemp(dir) != NULL);
+  char base[PATH_MAX], path[PATH_MAX];
+  snprintf(base, sizeof(base), "%s/ckpt%s", dir, ARTHAS_CKPT_LOG_SUFFIX);
+  snprintf(path, sizeof(path), "%s.0", base);
+  write_segment(path);
+
+  struct checkpoint_log *c_log = reconstruct_checkpoint_segments(base);
+  CHECK(c_log != NULL);
+  seq_log *s_log = (seq_log *)malloc(sizeof(seq_log));
+  s_log->size = SEQ_LOG_SIZE;
+  s_log->list = (struct seq_node **)calloc(SEQ_LOG_SIZE,
+                                           sizeof(struct seq_node *));
+  size_t total = 0;
+  order_by_sequence_num(s_log, &total, c_log);
+  CHECK(total == 3);
+  // nothing to match by address
+  CHECK(lookup(s_log, 10).address == NULL);
+
+  offset_seq_index offset_seqs = {NULL, 0};
+  CHECK(offset_seq_index_build(&offset_seqs, s_log) == 0);
+  size_t first, last;
+  // a traced access at offset 4096 has both of its versions as candidates
+  offset_seq_index_range(&offset_seqs, 4096, 4096, &first, &last);
+  CHECK(last - first == 2);
+  CHECK(offset_seqs.entries[first].sequence_number == 10);
+  CHECK(offset_seqs.entries[first + 1].sequence_number == 12);
+  offset_seq_index_range(&offset_seqs, 8192, 8192, &first, &last);
+  CHECK(last - first == 1 && offset_seqs.entries[first].sequence_number == 11);
+  // an offset that was never checkpointed has none
+  offset_seq_index_range(&offset_seqs, 4097, 8191, &first, &last);
+  CHECK(last == first);
+  // a widened site covers every offset in its range
+  offset_seq_index_range(&offset_seqs, 0, UINT64_MAX, &first, &last);
+  CHECK(last - first == 3);
+
+  offset_seq_index_free(&offset_seqs);
+  seq_log_free(s_log);
+  unlink(path);
+  rmdir(dir);
+  printf("offset_match_test passed\n");
+  return 0;
+}
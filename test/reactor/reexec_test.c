@@ -0,0 +1,53 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// A re-execution ends as soon as its output shows a failure signature. A
+// signature that ends in a digit, like file:line, only matches where the
+// number ends, so foo.c:12 does not match foo.c:123.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "check.h"
+#include "reexec.h"
+
+static unsigned long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+int main(void) {
+  struct reexec_config config = {{"foo.c:12", "assertion"}, 2, 0};
+
+  // a longer line number is another location
+  CHECK(reexec_run("echo 'crash at foo.c:123'", &config) == REEXEC_PASSED);
+  CHECK(reexec_run("echo 'crash at foo.c:123, foo.c:12'", &config) ==
+        REEXEC_SIGNATURE);
+  CHECK(reexec_run("echo 'crash at foo.c:12: bad'", &config) ==
+        REEXEC_SIGNATURE);
+  // the last line may not end with a newline
+  CHECK(reexec_run("printf 'crash at foo.c:12'", &config) == REEXEC_SIGNATURE);
+  // signatures that do not end in a digit match anywhere
+  CHECK(reexec_run("echo 'assertions checked'", &config) == REEXEC_SIGNATURE);
+  CHECK(reexec_run("echo fine; exit 3", &config) == REEXEC_FAILED);
+
+  // the trial is killed at the signature, not left to finish its workload
+  unsigned long start = now_ms();
+  CHECK(reexec_run("echo 'foo.c:12' >&2; sleep 5", &config) ==
+        REEXEC_SIGNATURE);
+  CHECK(now_ms() - start < 2000);
+
+  config.deadline_ms = 200;
+  start = now_ms();
+  CHECK(reexec_run("sleep 5", &config) == REEXEC_DEADLINE);
+  CHECK(now_ms() - start < 2000);
+
+  printf("reexec_test passed\n");
+  return 0;
+}
@@ -0,0 +1,90 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// 64-bit sequence numbers stored as 32-bit slots plus the epoch of the
+// newest version: decoding across epoch boundaries, after the oldest
+// version is shifted out, and after a gap of 2^32 or more starts a new
+// chain.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "checkpoint.h"
+
+// Add a version the way the checkpoint runtime does, shifting the oldest
+// one out once every slot is used
+static void push_version(checkpoint_data *c_data, int64_t seq) {
+  int v;
+  if (c_data->version < 0 || checkpoint_data_new_chain(c_data, seq)) {
+    v = 0;
+  } else if (c_data->version == MAX_VERSIONS - 1) {
+    for (int j = 0; j < MAX_VERSIONS - 1; j++)
+      c_data->sequence_number[j] = c_data->sequence_number[j + 1];
+    v = MAX_VERSIONS - 1;
+  } else {
+    v = c_data->version + 1;
+  }
+  c_data->version = v;
+  checkpoint_data_set_seq(c_data, v, seq);
+}
+
+static void check_sequence(const int64_t *seqs, int count) {
+  checkpoint_data c_data;
+  memset(&c_data, 0, sizeof(c_data));
+  c_data.version = -1;
+  for (int i = 0; i < count; i++) {
+    push_version(&c_data, seqs[i]);
+    // the slots hold the newest versions pushed so far
+    for (int v = 0; v <= c_data.version; v++)
+      CHECK(checkpoint_data_seq(&c_data, v) ==
+            seqs[i - c_data.version + v]);
+  }
+}
+
+int main(void) {
+  const int64_t epoch = 1LL << 32;
+
+  // within the first epoch
+  int64_t small[] = {1, 2, 7, 100, 65536};
+  check_sequence(small, sizeof(small) / sizeof(small[0]));
+
+  // crossing into the next epoch, the low halves go down
+  int64_t cross[] = {epoch - 3, epoch - 1, epoch, epoch + 2, 2 * epoch - 1,
+                     2 * epoch + 5};
+  check_sequence(cross, sizeof(cross) / sizeof(cross[0]));
+
+  // versions whose low halves are equal, one epoch apart
+  int64_t same_low[] = {5 * epoch + 9, 6 * epoch + 8, 6 * epoch + 10};
+  check_sequence(same_low, sizeof(same_low) / sizeof(same_low[0]));
+
+  // far beyond 32 bits
+  int64_t large[] = {(int64_t)0x7ffffffe00000000LL, (int64_t)0x7ffffffe00000001LL,
+                     (int64_t)0x7fffffff00000000LL, (int64_t)0x7fffffff7fffffffLL};
+  check_sequence(large, sizeof(large) / sizeof(large[0]));
+
+  // a gap of a whole epoch or more cannot be decoded, only the newest
+  // version is kept
+  checkpoint_data c_data;
+  memset(&c_data, 0, sizeof(c_data));
+  c_data.version = -1;
+  push_version(&c_data, 3);
+  push_version(&c_data, epoch - 1);
+  CHECK(c_data.version == 1);
+  push_version(&c_data, 2 * epoch + 1);
+  CHECK(c_data.version == 0);
+  CHECK(checkpoint_data_seq(&c_data, 0) == 2 * epoch + 1);
+  push_version(&c_data, 3 * epoch);
+  CHECK(c_data.version == 1);
+  CHECK(checkpoint_data_seq(&c_data, 0) == 2 * epoch + 1);
+  CHECK(checkpoint_data_seq(&c_data, 1) == 3 * epoch);
+
+  printf("seq_epoch_test passed\n");
+  return 0;
+}
@@ -0,0 +1,149 @@
+// The Arthas Project
+//
+// Copyright (c) 2019, Johns Hopkins University - Order Lab.
+//
+//    All rights reserved.
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//
+
+// Restoring a pool from a snapshot clones the snapshot back and replays,
+// for every offset written since, its newest version as of the restore
+// point, which brings the pool to the same state as reverting the versions
+// one by one.
+
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "checkpoint.h"
+#include "checkpoint_log_format.h"
+#include "snapshot.h"
+
+#define POOL_SIZE (16 << 10)
+#define OBJ_SIZE 64
+#define OFFSET_A 4096
+#define OFFSET_B 8192
+#define SEQ_LOG_SIZE 1024
+
+static char dir[] = "/tmp/arthas-snapshot-test-XXXXXX";
+
+// Write the content of an object with a fill byte to the pool file and log
+// it as a version
+static void write_version(const char *pool_path, const char *log_path,
+                          uint64_t seq, uint64_t offset, int fill) {
+  size_t mapped_len;
+  int is_pmem;
+  char *pool = (char *)pmem_map_file(pool_path, 0, 0, 0, &mapped_len,
+                                     &is_pmem);
+  CHECK(pool != NULL);
+  memset(pool + offset, fill, OBJ_SIZE);
+  pmem_persist(pool + offset, OBJ_SIZE);
+  pmem_unmap(pool, mapped_len);
+
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)pmem_map_file(
+      log_path, 0, 0, 0, &mapped_len, &is_pmem);
+  CHECK(hdr != NULL);
+  unsigned char obj[OBJ_SIZE], scratch[OBJ_SIZE];
+  memset(obj, fill, sizeof(obj));
+  uint64_t n =
+      arthas_ckpt_append(hdr, seq, offset, obj, OBJ_SIZE, 0, 0, 0, scratch);
+  CHECK(n != ARTHAS_CKPT_NO_ENTRY);
+  arthas_ckpt_commit(hdr, n);
+  arthas_ckpt_index_update(hdr, offset, n);
+  pmem_unmap(hdr, mapped_len);
+}
+
+static void create_files(const char *pool_path, const char *log_path) {
+  size_t mapped_len;
+  int is_pmem;
+  void *pool = pmem_map_file(pool_path, POOL_SIZE, PMEM_FILE_CREATE, 0666,
+                             &mapped_len, &is_pmem);
+  CHECK(pool != NULL);
+  pmem_unmap(pool, mapped_len);
+  uint64_t index_offset, entry_offset, payload_offset;
+  uint64_t size = arthas_ckpt_layout(16, 16, 1 << 12, &index_offset,
+                                     &entry_offset, &payload_offset);
+  struct arthas_ckpt_header *hdr = (struct arthas_ckpt_header *)pmem_map_file(
+      log_path, size, PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
+  CHECK(hdr != NULL);
+  arthas_ckpt_init(hdr, 0, 16, 16, mapped_len - payload_offset);
+  hdr->magic = ARTHAS_CKPT_MAGIC;
+  pmem_unmap(hdr, mapped_len);
+}
+
+static int object_is(const char *pool, uint64_t offset, int fill) {
+  for (int i = 0; i < OBJ_SIZE; i++)
+    if (pool[offset + i] != fill) return 0;
+  return 1;
+}
+
+int main(void) {
+  CHECK(mkdtemp(dir) != NULL);
+  char pool_path[PATH_MAX], base[PATH_MAX], log_path[PATH_MAX];
+  snprintf(pool_path, sizeof(pool_path), "%s/pool", dir);
+  snprintf(base, sizeof(base), "%s/ckpt%s", dir, ARTHAS_CKPT_LOG_SUFFIX);
+  snprintf(log_path, sizeof(log_path), "%s.0", base);
+  create_files(pool_path, log_path);
+
+  write_version(pool_path, log_path, 10, OFFSET_A, 1);
+  write_version(pool_path, log_path, 11, OFFSET_B, 1);
+  struct pool_snapshot snap;
+  CHECK(snapshot_take(pool_path, NULL, base, &snap) == 0);
+  CHECK(snap.begin == 11 && snap.end == 11);
+  write_version(pool_path, log_path, 12, OFFSET_A, 2);
+  write_version(pool_path, log_path, 13, OFFSET_B, 2);
+  write_version(pool_path, log_path, 14, OFFSET_A, 3);
+
+  struct pool_snapshot found;
+  CHECK(snapshot_find(pool_path, NULL, 12, &found) == 0);
+  CHECK(strcmp(found.path, snap.path) == 0);
+  // nothing was snapshotted that early
+  CHECK(snapshot_find(pool_path, NULL, 10, &found) == -1);
+  // the replayed range plus cloning the pool twice
+  CHECK(snapshot_restore_cost(&snap, pool_path, 12) ==
+        1 + 2 * POOL_SIZE / SNAPSHOT_BYTES_PER_VERSION);
+  CHECK(snapshot_restore_cost(&snap, pool_path, 10) == INT64_MAX);
+
+  struct checkpoint_log *c_log = reconstruct_checkpoint_segments(base);
+  CHECK(c_log != NULL);
+  seq_log *s_log = (seq_log *)malloc(sizeof(seq_log));
+  s_log->size = SEQ_LOG_SIZE;
+  s_log->list = (struct seq_node **)calloc(SEQ_LOG_SIZE,
+                                           sizeof(struct seq_node *));
+  size_t total = 0;
+  order_by_sequence_num(s_log, &total, c_log);
+  CHECK(total == 5);
+
+  // restore the pool as of seq 12: A at its second version, B at its first,
+  // which the snapshot already holds
+  CHECK(snapshot_clone_file(snap.path, pool_path) == 0);
+  size_t mapped_len;
+  int is_pmem;
+  char *pool = (char *)pmem_map_file(pool_path, 0, 0, 0, &mapped_len,
+                                     &is_pmem);
+  CHECK(pool != NULL);
+  CHECK(object_is(pool, OFFSET_A, 1) && object_is(pool, OFFSET_B, 1));
+  set_pool_base(pool);
+  CHECK(snapshot_restore(&snap, s_log, c_log, 12) == 1);
+  CHECK(object_is(pool, OFFSET_A, 2));
+  CHECK(object_is(pool, OFFSET_B, 1));
+  // as of seq 13, A is replayed once with its version at 12, not 14
+  CHECK(snapshot_restore(&snap, s_log, c_log, 13) == 2);
+  CHECK(object_is(pool, OFFSET_A, 2));
+  CHECK(object_is(pool, OFFSET_B, 2));
+  // a point before the snapshot cannot be restored from it
+  CHECK(snapshot_restore(&snap, s_log, c_log, 10) == -1);
+  pmem_unmap(pool, mapped_len);
+
+  CHECK(snapshot_prune(pool_path, NULL, 0) == 1);
+  seq_log_free(s_log);
+  unlink(pool_path);
+  unlink(log_path);
+  rmdir(dir);
+  printf("snapshot_test passed\n");
+  return 0;
+}